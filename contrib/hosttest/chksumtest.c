@@ -0,0 +1,93 @@
+/*
+ * chksumtest - check ipchksum() in core/misc.c against the byte at a
+ * time version it replaced, and time both.
+ *
+ * Random data is summed at every alignment and at lengths that hit the
+ * odd head and the 16 bit and byte tails.  Exits with 1 on a mismatch.
+ */
+
+#include "etherboot.h"
+#include "hostlib.h"
+
+/* misc.c wants it for random(), which is not used here */
+struct arptable_t arptable[MAX_ARP];
+
+/* ipchksum() before it summed 32 bit words, as it was in core/misc.c */
+static uint16_t old_ipchksum(const void *data, unsigned long length)
+{
+	unsigned long sum;
+	unsigned long i;
+	const uint8_t *ptr;
+
+	sum = 0;
+	ptr = data;
+	for(i = 0; i < length; i++) {
+		unsigned long value;
+		value = ptr[i];
+		if (i & 1) {
+			value <<= 8;
+		}
+		sum += value;
+		if (sum > 0xFFFF) {
+			sum = (sum + (sum >> 16)) & 0xFFFF;
+		}
+	}
+	return (~cpu_to_le16(sum)) & 0xFFFF;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+#define MAX_LEN		2048
+#define ROUNDS		20000
+#define TIME_LEN	1500
+#define TIME_ROUNDS	20000
+
+static uint8_t buf[MAX_LEN + 16];
+
+int test_main(int argc __unused, char **argv __unused)
+{
+	unsigned long i, len, align, errors = 0, cases = 0;
+	unsigned long start, old_usecs, new_usecs;
+	volatile uint16_t sink;
+
+	for (i = 0; i < ROUNDS; i++) {
+		for (len = 0; len < sizeof(buf); len++)
+			buf[len] = next_random();
+		if (i % 4 == 0) {
+			/* All ones makes the carries pile up */
+			memset(buf, 0xff, sizeof(buf));
+		}
+		len = i < 256 ? i : next_random() % MAX_LEN;
+		for (align = 0; align < 16; align++) {
+			uint16_t old = old_ipchksum(buf + align, len);
+			uint16_t new = ipchksum(buf + align, len);
+			cases++;
+			if (old != new) {
+				if (errors++ < 10) {
+					printf("len %d align %d: old %hx new %hx\n",
+					       len, align, old, new);
+				}
+			}
+		}
+	}
+	printf("ipchksum: %d cases, %d mismatches\n", cases, errors);
+
+	start = host_usecs();
+	for (i = 0; i < TIME_ROUNDS; i++)
+		sink = old_ipchksum(buf, TIME_LEN);
+	old_usecs = host_usecs() - start;
+	start = host_usecs();
+	for (i = 0; i < TIME_ROUNDS; i++)
+		sink = ipchksum(buf, TIME_LEN);
+	new_usecs = host_usecs() - start;
+	printf("%d x %d bytes: old %dus, new %dus\n",
+	       TIME_ROUNDS, TIME_LEN, old_usecs, new_usecs);
+	(void)sink;
+	return errors != 0;
+}
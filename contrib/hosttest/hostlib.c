@@ -0,0 +1,147 @@
+/*
+ * hostlib - just enough of a Linux i386 runtime to run Etherboot core
+ * code as a userspace program, see hostlib.h.
+ */
+
+#include "etherboot.h"
+#include "hostlib.h"
+
+#define SYS_exit		1
+#define SYS_read		3
+#define SYS_write		4
+#define SYS_open		5
+#define SYS_close		6
+#define SYS_clock_gettime	265
+#define CLOCK_MONOTONIC		1
+
+static long host_syscall(long nr, long a, long b, long c)
+{
+	long ret;
+	__asm__ __volatile__ ("int $0x80"
+		: "=a" (ret)
+		: "0" (nr), "b" (a), "c" (b), "d" (c)
+		: "memory");
+	return ret;
+}
+
+/* Called from _start with the stack as the kernel left it */
+__asm__ (
+	".globl _start\n"
+	"_start:\n\t"
+	"xorl %ebp, %ebp\n\t"
+	"movl (%esp), %eax\n\t"		/* argc */
+	"leal 4(%esp), %ecx\n\t"	/* argv */
+	"andl $-16, %esp\n\t"
+	"subl $8, %esp\n\t"
+	"pushl %ecx\n\t"
+	"pushl %eax\n\t"
+	"call host_main\n\t"
+	"hlt\n");
+
+void host_main(int argc, char **argv)
+{
+	host_exit(test_main(argc, argv));
+}
+
+/* Same as in arch/i386/core/start32.S, which can't be linked here */
+__asm__ (
+	".globl setjmp\n"
+	"setjmp:\n\t"
+	"movl 4(%esp), %ecx\n\t"
+	"movl 0(%esp), %edx\n\t"
+	"movl %edx, 0(%ecx)\n\t"
+	"movl %ebx, 4(%ecx)\n\t"
+	"movl %esp, 8(%ecx)\n\t"
+	"movl %ebp, 12(%ecx)\n\t"
+	"movl %esi, 16(%ecx)\n\t"
+	"movl %edi, 20(%ecx)\n\t"
+	"movl $0, %eax\n\t"
+	"ret\n"
+	".globl longjmp\n"
+	"longjmp:\n\t"
+	"movl 4(%esp), %edx\n\t"
+	"movl 8(%esp), %eax\n\t"
+	"movl 0(%edx), %ecx\n\t"
+	"movl 4(%edx), %ebx\n\t"
+	"movl 8(%edx), %esp\n\t"
+	"movl 12(%edx), %ebp\n\t"
+	"movl 16(%edx), %esi\n\t"
+	"movl 20(%edx), %edi\n\t"
+	"cmpl $0, %eax\n\t"
+	"jne 1f\n\t"
+	"movl $1, %eax\n"
+	"1:\tmovl %ecx, 0(%esp)\n\t"
+	"ret\n");
+
+int host_open(const char *name)
+{
+	return host_syscall(SYS_open, (long)name, 0, 0);
+}
+
+long host_read(int fd, void *buf, unsigned long len)
+{
+	return host_syscall(SYS_read, fd, (long)buf, len);
+}
+
+void host_close(int fd)
+{
+	host_syscall(SYS_close, fd, 0, 0);
+}
+
+unsigned long host_usecs(void)
+{
+	struct { long sec, nsec; } ts;
+
+	host_syscall(SYS_clock_gettime, CLOCK_MONOTONIC, (long)&ts, 0);
+	return ts.sec * 1000000UL + ts.nsec / 1000;
+}
+
+/* Console output is collected a line at a time */
+static char out_buf[256];
+static int out_len;
+
+void host_flush(void)
+{
+	if (out_len)
+		host_syscall(SYS_write, 1, (long)out_buf, out_len);
+	out_len = 0;
+}
+
+void host_exit(int status)
+{
+	host_flush();
+	for (;;)
+		host_syscall(SYS_exit, status, 0, 0);
+}
+
+void console_putc(int c)
+{
+	out_buf[out_len++] = c;
+	if (c == '\n' || out_len == sizeof(out_buf))
+		host_flush();
+}
+
+int console_getc(void)
+{
+	return 0;
+}
+
+int console_ischar(void)
+{
+	return 0;
+}
+
+int int15(int ax __unused)
+{
+	return 0;
+}
+
+/* currticks() counts microseconds, as with CONFIG_TSC_CURRTICKS */
+unsigned long currticks(void)
+{
+	return host_usecs();
+}
+
+unsigned long virt_offset;
+jmp_buf restart_etherboot;
+char as_main_program;
@@ -0,0 +1,20 @@
+/*
+ * hostlib - just enough of a Linux i386 runtime to run Etherboot core
+ * code as a userspace program.  The core files are built as they are
+ * for the ROM, so there is no C library; these calls go straight to the
+ * kernel.
+ */
+#ifndef HOSTLIB_H
+#define HOSTLIB_H
+
+extern int host_open(const char *name);
+extern long host_read(int fd, void *buf, unsigned long len);
+extern void host_close(int fd);
+extern void host_exit(int status) __attribute__ ((noreturn));
+extern unsigned long host_usecs(void);
+extern void host_flush(void);
+
+/* Provided by the test program */
+extern int test_main(int argc, char **argv);
+
+#endif /* HOSTLIB_H */
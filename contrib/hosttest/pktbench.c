@@ -0,0 +1,602 @@
+/*
+ * pktbench - replay a captured download through Etherboot's network
+ * stack and report what the packets cost.
+ *
+ *	pktbench [-n rounds] [-v] capture.pcap tftp|nfs|http file
+ *
+ * core/nic.c, core/nfs.c and core/proto_http.c are built as for the ROM
+ * with PACKET_STATS, and run against an in-memory NIC in the style of
+ * drivers/net/pnic.c: poll() copies the next frame into nic.packet and
+ * transmit() takes a frame off the client.  file is the name as it
+ * follows proto://server/ in a boot URL.
+ *
+ * The capture should be of an Etherboot client loading the same file,
+ * taken on the wire (with TSO/GRO off if taken on the server).  The
+ * download is found by its first request: a TFTP read request, a call
+ * to the portmapper, or a TCP SYN.  Its source and destination are the
+ * client and the server, and everything before it is skipped.
+ *
+ * Frames from the server are handed out in order, but not ahead of the
+ * client: each client frame that says something new (any UDP datagram,
+ * or a TCP segment with data, SYN or FIN) must first be matched by one
+ * the live client sends.  The matches give the live client's ports,
+ * TCP sequence numbers and RPC transaction ids, and the server frames
+ * are rewritten to use them before they are delivered.
+ *
+ * Each of the rounds prints the PACKET_STATS counters, the wall time
+ * and the frames that went each way.  The download ends when the
+ * loader gets its eof block; a client that asks for something the
+ * capture does not have ends it as diverged.
+ */
+
+#include "etherboot.h"
+#include "nic.h"
+#include "http.h"
+#include "hostlib.h"
+
+#define CAPTURE_MAX	(128 * 1024 * 1024)
+#define FRAMES_MAX	(1024 * 1024)
+#define HEAP_SIZE	(4 * 1024 * 1024)
+#define MAPS_MAX	64
+#define XIDS_MAX	64
+
+#define IP_HLEN(ip)	(((ip)->verhdrlen & 0xf) * 4)
+#define TCP_HLEN(tcp)	((ntohs((tcp)->ctrl) >> 10) & 0x3C)
+
+enum dir { SKIP, FROM_CLIENT, TO_CLIENT };
+
+struct frame {
+	unsigned char *data;
+	unsigned int len;
+	unsigned char dir;
+	unsigned char gate;	/* client frame the server waits for */
+};
+
+/* A port of the captured client and what the live client uses */
+struct port_map {
+	int proto;
+	unsigned short cap_port, live_port;
+	long seq_delta;		/* live ISN - captured ISN */
+	long sent_max;		/* TCP, end of the last new segment */
+};
+
+struct xid_map {
+	uint32_t cap_xid, live_xid;
+};
+
+static unsigned char capture[CAPTURE_MAX];
+static struct frame frames[FRAMES_MAX];
+static int nframes;
+static int start_frame;
+
+static in_addr client_ip, server_ip;
+static unsigned char client_mac[ETH_ALEN], server_mac[ETH_ALEN];
+static int rpc_mode;
+
+static int rx_cursor;		/* next frame to look at for delivery */
+static int tx_cursor;		/* next frame to match a client gate */
+static struct port_map maps[MAPS_MAX];
+static int nmaps;
+static struct xid_map xids[XIDS_MAX];
+static int next_xid;
+
+static unsigned long rx_frames, tx_frames, tx_gates;
+static int next_block;
+static unsigned long loaded_bytes;
+static jmp_buf replay_done;
+static int verbose;
+
+/* Stand-ins for what the rest of Etherboot would provide */
+int url_port = -1;
+struct meminfo meminfo;
+
+int probe(struct dev *dev __unused)
+{
+	return 0;
+}
+
+void disable(struct dev *dev __unused)
+{
+}
+
+void exit(int status)
+{
+	host_exit(status);
+}
+
+int loadkernel(const char *fname __unused)
+{
+	return 0;
+}
+
+int load_at(unsigned long offset __unused, unsigned char *data __unused,
+	unsigned int len __unused)
+{
+	return -1;		/* everything comes through load_block */
+}
+
+/* The loader: check the block order and count the bytes */
+int load_block(unsigned char *data __unused, unsigned int block,
+	unsigned int len, int eof)
+{
+	if ((int)block != next_block) {
+		printf("block %d out of order, expected %d\n",
+			block, next_block);
+		return 0;
+	}
+	next_block++;
+	loaded_bytes += len;
+	if (eof)
+		longjmp(replay_done, 1);
+	return 1;
+}
+
+/* Heap handed out top down as in core/heap.c, forget() only frees the
+ * most recent allocation */
+static unsigned char heap[HEAP_SIZE] __aligned;
+static unsigned long heap_used;
+
+void *allot(size_t size)
+{
+	size = (size + sizeof(size_t) + 15) & ~15UL;
+	if (size > HEAP_SIZE - heap_used)
+		return 0;
+	heap_used += size;
+	*(size_t *)(heap + HEAP_SIZE - heap_used) = size;
+	return heap + HEAP_SIZE - heap_used + sizeof(size_t);
+}
+
+void forget(void *ptr)
+{
+	unsigned char *p = ptr;
+
+	if (p && p - sizeof(size_t) == heap + HEAP_SIZE - heap_used)
+		heap_used -= *(size_t *)(p - sizeof(size_t));
+}
+
+/* Ones complement sum, kept apart from ipchksum() so that the harness
+ * does not show up in the checksum counters */
+static uint32_t sum16(uint32_t sum, const unsigned char *p, unsigned int len)
+{
+	for (; len > 1; p += 2, len -= 2)
+		sum += (p[0] << 8) | p[1];
+	if (len)
+		sum += p[0] << 8;
+	return sum;
+}
+
+static uint16_t l4_chksum(struct iphdr *ip)
+{
+	unsigned int hlen = IP_HLEN(ip);
+	unsigned int len = ntohs(ip->len) - hlen;
+	unsigned char pseudo[4];
+	uint32_t sum;
+
+	sum = sum16(0, (unsigned char *)&ip->src, 8);
+	pseudo[0] = 0;
+	pseudo[1] = ip->protocol;
+	pseudo[2] = len >> 8;
+	pseudo[3] = len;
+	sum = sum16(sum, pseudo, 4);
+	sum = sum16(sum, (unsigned char *)ip + hlen, len);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = ~sum & 0xFFFF;
+	if (!sum && ip->protocol == IP_UDP)
+		sum = 0xFFFF;
+	return htons(sum);
+}
+
+/* The IP header of a frame, if it is whole */
+static struct iphdr *frame_ip(unsigned char *data, unsigned int len)
+{
+	struct iphdr *ip = (struct iphdr *)(data + ETH_HLEN);
+
+	if (len < ETH_HLEN + sizeof(struct iphdr) ||
+	    data[12] != (ETH_P_IP >> 8) || data[13] != (ETH_P_IP & 0xff) ||
+	    ip->verhdrlen < 0x45 || ip->verhdrlen > 0x4F ||
+	    ETH_HLEN + ntohs(ip->len) > (int)len)
+		return 0;
+	return ip;
+}
+
+/* Does a client frame carry something new for the server */
+static int is_gate(struct iphdr *ip)
+{
+	struct tcphdr *tcp;
+
+	if (ip->protocol == IP_UDP)
+		return 1;
+	if (ip->protocol != IP_TCP)
+		return 0;
+	tcp = (struct tcphdr *)((char *)ip + IP_HLEN(ip));
+	return (tcp->ctrl & htons(SYN | FIN)) ||
+		ntohs(ip->len) > IP_HLEN(ip) + TCP_HLEN(tcp);
+}
+
+static int classify(unsigned char *data, unsigned int len)
+{
+	struct iphdr *ip = frame_ip(data, len);
+
+	if (!ip)
+		return SKIP;
+	if (ip->src.s_addr == client_ip.s_addr &&
+	    ip->dest.s_addr == server_ip.s_addr)
+		return FROM_CLIENT;
+	if (ip->src.s_addr == server_ip.s_addr &&
+	    ip->dest.s_addr == client_ip.s_addr)
+		return TO_CLIENT;
+	return SKIP;
+}
+
+static int load_capture(const char *name)
+{
+	unsigned char *p, *end;
+	unsigned long size = 0;
+	int swap, fd;
+	long n;
+
+	fd = host_open(name);
+	if (fd < 0) {
+		printf("can't open %s\n", name);
+		return 0;
+	}
+	while ((n = host_read(fd, capture + size, CAPTURE_MAX - size)) > 0)
+		size += n;
+	host_close(fd);
+	if (size == CAPTURE_MAX) {
+		printf("%s is too large\n", name);
+		return 0;
+	}
+	if (size < 24) {
+		printf("%s is not a pcap file\n", name);
+		return 0;
+	}
+	/* Either byte order, microsecond or nanosecond time stamps */
+	if (capture[0] == 0xa1 && capture[1] == 0xb2) {
+		swap = 1;
+	} else if (capture[3] == 0xa1 && capture[2] == 0xb2) {
+		swap = 0;
+	} else {
+		printf("%s is not a pcap file\n", name);
+		return 0;
+	}
+#define PCAP32(q) (swap ? (q)[3] | (q)[2] << 8 | (q)[1] << 16 | (q)[0] << 24 \
+			: (q)[0] | (q)[1] << 8 | (q)[2] << 16 | (q)[3] << 24)
+	if (PCAP32(capture + 20) != 1) {
+		printf("%s is not an Ethernet capture\n", name);
+		return 0;
+	}
+	end = capture + size;
+	for (p = capture + 24; p + 16 <= end; ) {
+		unsigned int len = PCAP32(p + 8);
+		if (p + 16 + len > end)
+			break;
+		if (nframes == FRAMES_MAX) {
+			printf("more than %d frames\n", FRAMES_MAX);
+			return 0;
+		}
+		frames[nframes].data = p + 16;
+		frames[nframes].len = len;
+		nframes++;
+		p += 16 + len;
+	}
+#undef PCAP32
+	return 1;
+}
+
+/* Find the first request of the download, the client and the server */
+static int find_start(const char *proto)
+{
+	int i;
+
+	for (i = 0; i < nframes; i++) {
+		struct iphdr *ip = frame_ip(frames[i].data, frames[i].len);
+		struct udphdr *udp;
+		struct tcphdr *tcp;
+
+		if (!ip)
+			continue;
+		udp = (struct udphdr *)((char *)ip + IP_HLEN(ip));
+		tcp = (struct tcphdr *)((char *)ip + IP_HLEN(ip));
+		if (!memcmp(proto, "tftp", 5)) {
+			if (ip->protocol != IP_UDP ||
+			    ntohs(udp->dest) != TFTP_PORT)
+				continue;
+		} else if (!memcmp(proto, "nfs", 4)) {
+			if (ip->protocol != IP_UDP ||
+			    ntohs(udp->dest) != SUNRPC_PORT)
+				continue;
+		} else {
+			if (ip->protocol != IP_TCP ||
+			    (tcp->ctrl & htons(SYN | ACK)) != htons(SYN))
+				continue;
+		}
+		start_frame = i;
+		client_ip = ip->src;
+		server_ip = ip->dest;
+		memcpy(server_mac, frames[i].data, ETH_ALEN);
+		memcpy(client_mac, frames[i].data + ETH_ALEN, ETH_ALEN);
+		break;
+	}
+	if (i == nframes) {
+		printf("no %s request in the capture\n", proto);
+		return 0;
+	}
+	for (i = start_frame; i < nframes; i++) {
+		struct iphdr *ip;
+		frames[i].dir = classify(frames[i].data, frames[i].len);
+		if (frames[i].dir == SKIP)
+			continue;
+		if (frames[i].len > ETH_FRAME_LEN) {
+			printf("frame %d has %d bytes, turn off TSO and GRO "
+				"where the capture is taken\n",
+				i + 1, frames[i].len);
+			return 0;
+		}
+		ip = frame_ip(frames[i].data, frames[i].len);
+		frames[i].gate = frames[i].dir == FROM_CLIENT && is_gate(ip);
+	}
+	return 1;
+}
+
+/* nfs() keeps the mount and NFS ports it looked up, so later rounds
+ * do not ask the portmapper again */
+static void skip_portmap(void)
+{
+	int i;
+
+	for (i = start_frame; i < nframes; i++) {
+		struct iphdr *ip;
+		struct udphdr *udp;
+
+		if (frames[i].dir == SKIP)
+			continue;
+		ip = frame_ip(frames[i].data, frames[i].len);
+		udp = (struct udphdr *)((char *)ip + IP_HLEN(ip));
+		if (ip->protocol == IP_UDP &&
+		    (ntohs(udp->src) == SUNRPC_PORT ||
+		     ntohs(udp->dest) == SUNRPC_PORT)) {
+			frames[i].dir = SKIP;
+			frames[i].gate = 0;
+		}
+	}
+}
+
+static void diverged(const char *why)
+{
+	printf("replay diverged at frame %d: %s\n", tx_cursor + 1, why);
+	longjmp(replay_done, 2);
+}
+
+static struct port_map *find_map(int proto, unsigned short port, int live)
+{
+	int i;
+
+	for (i = 0; i < nmaps; i++) {
+		if (maps[i].proto == proto &&
+		    (live ? maps[i].live_port : maps[i].cap_port) == port)
+			return &maps[i];
+	}
+	return 0;
+}
+
+/* The live client sent a frame, match it to the capture */
+static void replay_transmit(struct nic *nic __unused, const char *d __unused,
+	unsigned int t, unsigned int s, const char *p)
+{
+	struct iphdr *ip = (struct iphdr *)p, *cap_ip;
+	struct udphdr *udp, *cap_udp;
+	struct tcphdr *tcp, *cap_tcp;
+	struct port_map *map;
+	unsigned short live_port, cap_port;
+
+	tx_frames++;
+	if (t != ETH_P_IP || s < sizeof(struct iphdr) ||
+	    ip->dest.s_addr != server_ip.s_addr || !is_gate(ip))
+		return;
+	udp = (struct udphdr *)(p + IP_HLEN(ip));
+	tcp = (struct tcphdr *)(p + IP_HLEN(ip));
+	live_port = ntohs(udp->src);
+	map = find_map(ip->protocol, live_port, 1);
+	if (ip->protocol == IP_TCP && map && !(tcp->ctrl & htons(SYN))) {
+		/* A retransmission says nothing new */
+		long end = ntohl(tcp->seq) + !!(tcp->ctrl & htons(FIN)) +
+			ntohs(ip->len) - IP_HLEN(ip) - TCP_HLEN(tcp);
+		if (end - map->sent_max <= 0)
+			return;
+		map->sent_max = end;
+	}
+	tx_gates++;
+	while (tx_cursor < nframes && !frames[tx_cursor].gate)
+		tx_cursor++;
+	if (tx_cursor == nframes)
+		diverged("the client sent more than the capture has");
+	cap_ip = frame_ip(frames[tx_cursor].data, frames[tx_cursor].len);
+	cap_udp = (struct udphdr *)((char *)cap_ip + IP_HLEN(cap_ip));
+	cap_tcp = (struct tcphdr *)((char *)cap_ip + IP_HLEN(cap_ip));
+	if (cap_ip->protocol != ip->protocol || cap_udp->dest != udp->dest)
+		diverged("the client sent to another port");
+	cap_port = ntohs(cap_udp->src);
+	if (!map || map->cap_port != cap_port) {
+		map = find_map(ip->protocol, cap_port, 0);
+		if (!map) {
+			if (nmaps == MAPS_MAX)
+				diverged("too many connections");
+			map = &maps[nmaps++];
+			map->proto = ip->protocol;
+			map->cap_port = cap_port;
+		}
+		map->live_port = live_port;
+	}
+	if (ip->protocol == IP_TCP && (tcp->ctrl & htons(SYN))) {
+		map->seq_delta = ntohl(tcp->seq) - ntohl(cap_tcp->seq);
+		map->sent_max = ntohl(tcp->seq) + 1;
+	}
+	if (rpc_mode && ip->protocol == IP_UDP) {
+		/* RPC call: xid, then message type 0 */
+		const uint32_t *live_rpc = (const uint32_t *)(udp + 1);
+		const uint32_t *cap_rpc = (const uint32_t *)(cap_udp + 1);
+		xids[next_xid].cap_xid = cap_rpc[0];
+		xids[next_xid].live_xid = live_rpc[0];
+		next_xid = (next_xid + 1) % XIDS_MAX;
+	}
+	if (verbose)
+		printf("tx %d matched frame %d\n", tx_gates, tx_cursor + 1);
+	tx_cursor++;
+}
+
+/* Make a server frame fit the live client */
+static void rewrite(unsigned char *data)
+{
+	struct iphdr *ip = (struct iphdr *)(data + ETH_HLEN);
+	struct udphdr *udp = (struct udphdr *)((char *)ip + IP_HLEN(ip));
+	struct tcphdr *tcp = (struct tcphdr *)((char *)ip + IP_HLEN(ip));
+	struct port_map *map;
+	int i;
+
+	if (ip->protocol != IP_UDP && ip->protocol != IP_TCP)
+		return;
+	map = find_map(ip->protocol, ntohs(udp->dest), 0);
+	if (map)
+		udp->dest = htons(map->live_port);
+	if (ip->protocol == IP_UDP) {
+		if (rpc_mode) {
+			uint32_t *rpc = (uint32_t *)(udp + 1);
+			for (i = 0; i < XIDS_MAX; i++) {
+				if (xids[i].cap_xid == rpc[0]) {
+					rpc[0] = xids[i].live_xid;
+					break;
+				}
+			}
+		}
+		if (udp->chksum) {
+			udp->chksum = 0;
+			udp->chksum = l4_chksum(ip);
+		}
+	} else {
+		if (map && (tcp->ctrl & htons(ACK)))
+			tcp->ack = htonl(ntohl(tcp->ack) + map->seq_delta);
+		tcp->chksum = 0;
+		tcp->chksum = l4_chksum(ip);
+	}
+}
+
+/* Hand out the next server frame, if the client has caught up with it */
+static int replay_poll(struct nic *nic, int retrieve)
+{
+	struct frame *f;
+
+	while (rx_cursor < nframes) {
+		f = &frames[rx_cursor];
+		if (f->dir == SKIP || (f->dir == FROM_CLIENT && !f->gate)) {
+			rx_cursor++;
+			continue;
+		}
+		if (f->dir == FROM_CLIENT) {
+			if (rx_cursor >= tx_cursor)
+				return 0;	/* wait for the client */
+			rx_cursor++;
+			continue;
+		}
+		if (!retrieve)
+			return 1;
+		/* Copied in, as pnic.c does */
+		memcpy(nic->packet, f->data, f->len);
+		nic->packetlen = f->len;
+		rewrite(nic->packet);
+		rx_frames++;
+		rx_cursor++;
+		return 1;
+	}
+	return 0;
+}
+
+static void replay_irq(struct nic *nic __unused, irq_action_t action __unused)
+{
+}
+
+static int replay(const char *proto, const char *file)
+{
+	unsigned long start, usecs;
+	int result;
+
+	rx_cursor = tx_cursor = start_frame;
+	nmaps = 0;
+	next_xid = 0;
+	memset(xids, 0, sizeof(xids));
+	rx_frames = tx_frames = tx_gates = 0;
+	next_block = 1;
+	loaded_bytes = 0;
+	heap_used = 0;
+
+	memset(arptable, 0, sizeof(arptable));
+	arptable[ARP_CLIENT].ipaddr = client_ip;
+	memcpy(arptable[ARP_CLIENT].node, client_mac, ETH_ALEN);
+	arptable[ARP_SERVER].ipaddr = server_ip;
+	memcpy(arptable[ARP_SERVER].node, server_mac, ETH_ALEN);
+	nic.node_addr = arptable[ARP_CLIENT].node;
+	nic.poll = replay_poll;
+	nic.transmit = replay_transmit;
+	nic.irq = replay_irq;
+
+	packet_stats_reset();
+	start = host_usecs();
+	result = setjmp(replay_done);
+	if (!result) {
+		if (!memcmp(proto, "tftp", 5))
+			tftp(file, load_block);
+		else if (!memcmp(proto, "nfs", 4))
+			nfs(file, load_block);
+		else
+			http(file, load_block);
+	}
+	usecs = host_usecs() - start;
+	packet_stats_print();
+	printf("loaded %d bytes in %d blocks, %d us; %d frames in, %d out\n",
+		loaded_bytes, next_block - 1, usecs, rx_frames, tx_frames);
+	if (result != 1) {
+		printf("download did not complete\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void usage(void)
+{
+	printf("usage: pktbench [-n rounds] [-v] capture.pcap "
+		"tftp|nfs|http file\n");
+	host_exit(2);
+}
+
+int test_main(int argc, char **argv)
+{
+	int rounds = 1, i, ok = 1;
+	const char *proto;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!memcmp(argv[i], "-n", 3) && i + 1 < argc)
+			rounds = strtoul(argv[++i], 0, 10);
+		else if (!memcmp(argv[i], "-v", 3))
+			verbose = 1;
+		else
+			usage();
+	}
+	if (argc - i != 3)
+		usage();
+	proto = argv[i + 1];
+	if (memcmp(proto, "tftp", 5) && memcmp(proto, "nfs", 4) &&
+	    memcmp(proto, "http", 5))
+		usage();
+	rpc_mode = !memcmp(proto, "nfs", 4);
+	if (!load_capture(argv[i]) || !find_start(proto))
+		return 1;
+	printf("%d frames, client %@ server %@, download from frame %d\n",
+		nframes, client_ip.s_addr, server_ip.s_addr, start_frame + 1);
+	for (i = 0; i < rounds && ok; i++) {
+		ok = replay(proto, argv[argc - 1]);
+		if (!i && rpc_mode)
+			skip_portmap();
+	}
+	return !ok;
+}
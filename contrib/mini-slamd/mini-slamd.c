@@ -62,6 +62,18 @@
  *   received packets
  *   requested packtes
  *   0
+ *
+ * Parity Packet (with -f, sent to the multicast port + 1)
+ *   transaction
+ *   total bytes
+ *   block size
+ *   group size
+ *   group #
+ *   data, the xor of the group's packets padded to the block size
+ *
+ * A client that is missing just one packet of a group rebuilds it
+ * from the parity packet instead of asking for it again.  Clients
+ * without parity support never see the parity packets.
  */
 
 #define MAX_HDR (7 + 7 + 7) /* transaction, total size, block size */
@@ -70,6 +82,10 @@
 #define MAX_DATA_HDR (MAX_HDR + 7) /* header, packet # */
 #define MIN_DATA_HDR (MAX_HDR + 1) /* header, packet # */
 
+#define MAX_PARITY_HDR (MAX_HDR + 7 + 7) /* header, group size, group # */
+
+#define SLAM_MAX_FEC_GROUP	255
+
 /* ETH_MAX_MTU 1500 - sizeof(iphdr) 20  - sizeof(udphdr) 8 = 1472 */
 #define SLAM_MAX_NACK		(1500 - (20 + 8))
 /* ETH_MAX_MTU 1500 - sizeof(iphdr) 20  - sizeof(udphdr) 8 - MAX_HDR = 1451 */
@@ -144,6 +160,51 @@ static unsigned long slam_decode(unsigned char **ptr, unsigned char *end, int *e
 }
 
 
+static int send_parity(int sockfd, struct sockaddr_in *sa, int filefd,
+	uint64_t transaction, off_t size, unsigned long fec, unsigned long group)
+{
+	uint8_t parity_packet[MAX_PARITY_HDR + SLAM_BLOCK_SIZE];
+	uint8_t block[SLAM_BLOCK_SIZE];
+	uint8_t *ptr, *end, *parity;
+	unsigned long i;
+	ssize_t bytes, j;
+	int len, result;
+
+	ptr = parity_packet;
+	end = parity_packet + sizeof(parity_packet);
+	slam_encode(&ptr, end, transaction);
+	slam_encode(&ptr, end, size);
+	slam_encode(&ptr, end, SLAM_BLOCK_SIZE);
+	slam_encode(&ptr, end, fec);
+	slam_encode(&ptr, end, group);
+	parity = ptr;
+	len = (ptr - parity_packet) + SLAM_BLOCK_SIZE;
+
+	/* Xor together the packets of the group, the short last
+	 * packet is padded with zeros.
+	 */
+	memset(parity, 0, SLAM_BLOCK_SIZE);
+	for(i = 0; i < fec; i++) {
+		off_t offset = (off_t)(group*fec + i) * SLAM_BLOCK_SIZE;
+		if (offset >= size)
+			break;
+		bytes = pread(filefd, block, SLAM_BLOCK_SIZE, offset);
+		if (bytes <= 0) {
+			fprintf(stderr, "Read failed: %s\n", strerror(errno));
+			return -1;
+		}
+		for(j = 0; j < bytes; j++) {
+			parity[j] ^= block[j];
+		}
+	}
+	result = sendto(sockfd, parity_packet, len, 0, sa, sizeof(*sa));
+	if (result != len) {
+		fprintf(stderr, "Send failed %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 static struct sockaddr_in client[SLAM_MAX_CLIENTS];
 static int clients;
 
@@ -207,6 +268,7 @@ int main(int argc, char **argv)
 	struct sockaddr_in master_client;
 	struct sockaddr_in sa_src;
 	struct sockaddr_in sa_mcast;
+	struct sockaddr_in sa_parity;
 	uint8_t mcast_ttl;
 	uint8_t mcast_loop;
 	int sockfd, filefd;
@@ -224,14 +286,26 @@ int main(int argc, char **argv)
 	unsigned long packet_count;
 	unsigned slam_port, slam_multicast_port;
 	struct in_addr slam_multicast_ip;
+	unsigned long fec;
 
 	slam_port = SLAM_PORT;
 	slam_multicast_port = SLAM_MULTICAST_PORT;
 	slam_multicast_ip.s_addr = htonl(SLAM_MULTICAST_IP);
 	
+	fec = 0;
+	if ((argc == 4) && (strcmp(argv[1], "-f") == 0)) {
+		fec = strtoul(argv[2], 0, 10);
+		if ((fec < 2) || (fec > SLAM_MAX_FEC_GROUP)) {
+			fprintf(stderr, "Parity group size must be 2 to %d\n",
+				SLAM_MAX_FEC_GROUP);
+			exit(EXIT_FAILURE);
+		}
+		argc -= 2;
+		argv += 2;
+	}
 	if (argc != 2) {
 		fprintf(stderr, "Bad argument count\n");
-		fprintf(stderr, "Usage: mini-slamd filename\n");
+		fprintf(stderr, "Usage: mini-slamd [-f group-size] filename\n");
 		exit(EXIT_FAILURE);
 	}
 	filename = argv[1];
@@ -267,6 +341,10 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	/* Parity packets go to the next port up */
+	memcpy(&sa_parity, &sa_mcast, sizeof(sa_parity));
+	sa_parity.sin_port = htons(slam_multicast_port + 1);
+
 	/* Set the multicast ttl */
 	mcast_ttl = SLAM_MULTICAST_TTL;
 	setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL,
@@ -494,6 +572,12 @@ int main(int argc, char **argv)
 			printf("Transmitted: %d\n", packet);
 			fflush(stdout);
 #endif
+			/* Follow the last packet of a group with its parity */
+			if (fec && (((packet + 1) % fec == 0) ||
+				((off_t)(packet + 1) * SLAM_BLOCK_SIZE >= size))) {
+				send_parity(sockfd, &sa_parity, filefd,
+					transaction, size, fec, packet / fec);
+			}
 			/* Compute the next packet */
 			packet++;
 			packet_count--;
@@ -118,6 +118,11 @@ static sector_t aout_download(unsigned char *data, unsigned int len, int eof)
 			astate.skip = 0;
 			astate.toread = 0;
 			memset(phys_to_virt(astate.curaddr), '\0', astate.head.a_bss);
+			if (load_wait_eof) {
+				/* Pass over the rest of the file until eof */
+				astate.skip = ~0UL;
+				break;
+			}
 			goto aout_startkernel;
 		default:
 			break;
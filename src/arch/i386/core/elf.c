@@ -38,6 +38,16 @@ struct elf_notes {
 	char     nf3_name[SZ(EB_PARAM_NOTE)];
 	struct meminfo nf3_meminfo;
 
+#ifdef BOOT_TRACE
+	/* Pointer to the boot timeline */
+	Elf_Nhdr nf4;
+	char     nf4_name[SZ(EB_PARAM_NOTE)];
+	uint32_t nf4_boot_trace;
+#define BOOT_TRACE_NOTES 1
+#else
+#define BOOT_TRACE_NOTES 0
+#endif
+
 	/* Then the variable sized data string data where alignment does not matter */
 
 	/* The bootloader name */
@@ -57,7 +67,7 @@ struct elf_notes {
 	char     nv5_cmdline[SZ("")];
 };
 
-#define ELF_NOTE_COUNT  (3 + 5)
+#define ELF_NOTE_COUNT  (3 + BOOT_TRACE_NOTES + 5)
 
 static struct elf_notes notes;
 struct Elf_Bhdr *prepare_boot_params(void *header)
@@ -87,6 +97,14 @@ struct Elf_Bhdr *prepare_boot_params(void *header)
 	CP(notes.nf3_name,   EB_PARAM_NOTE);
 	memcpy(&notes.nf3_meminfo, &meminfo, sizeof(meminfo));
 
+#ifdef BOOT_TRACE
+	notes.nf4.n_namesz = sizeof(EB_PARAM_NOTE);
+	notes.nf4.n_descsz = sizeof(notes.nf4_boot_trace);
+	notes.nf4.n_type   = EB_BOOT_TRACE;
+	CP(notes.nf4_name,   EB_PARAM_NOTE);
+	notes.nf4_boot_trace = virt_to_phys(&boot_trace_data);
+#endif
+
 	/* Initialize the variable length entries */
 	notes.nv1.n_namesz = 0;
 	notes.nv1.n_descsz = sizeof(NAME);
@@ -67,18 +67,18 @@ void udelay(unsigned int usecs)
 
 #if defined(CONFIG_TSC_CURRTICKS)
 
-#define rdtsc(low,high) \
-     __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high))
-
 #define rdtscll(val) \
      __asm__ __volatile__ ("rdtsc" : "=A" (val))
 
 
-/* Number of clock ticks to time with the rtc */
-#define LATCH 0xFF
+/* Number of clock ticks to time with the rtc, as long as timer 2 allows */
+#define LATCH 0xFFFF
+
+/* currticks() counts microseconds, see latch.h */
+#define USECS_PER_LATCH ((unsigned long)((LATCH * 1000000ULL) / CLOCK_TICK_RATE))
 
-#define LATCHES_PER_SEC ((CLOCK_TICK_RATE + (LATCH/2))/LATCH)
-#define TICKS_PER_LATCH ((LATCHES_PER_SEC + (TICKS_PER_SEC/2))/TICKS_PER_SEC)
+/* Used when the TSC can't be timed against timer 2 */
+#define DEFAULT_CLOCKS_PER_TICK 1000
 
 static void sleep_latch(void)
 {
@@ -88,65 +88,72 @@ static void sleep_latch(void)
 
 /* ------ Calibrate the TSC ------- 
  * Time how long it takes to excute a loop that runs in known time.
- * And find the convertion needed to get to CLOCK_TICK_RATE
+ * And find the convertion needed to get to microseconds.
  */
 
 
-static unsigned long long calibrate_tsc(void)
+static unsigned long calibrate_tsc(void)
 {
-	unsigned long startlow, starthigh;
-	unsigned long endlow, endhigh;
-	
-	rdtsc(startlow,starthigh);
+	unsigned long long start, end;
+	unsigned long clocks;
+
+	rdtscll(start);
 	sleep_latch();
-	rdtsc(endlow,endhigh);
-
-	/* 64-bit subtract - gcc just messes up with long longs */
-	__asm__("subl %2,%0\n\t"
-		"sbbl %3,%1"
-		:"=a" (endlow), "=d" (endhigh)
-		:"g" (startlow), "g" (starthigh),
-		"0" (endlow), "1" (endhigh));
-	
+	rdtscll(end);
+
 	/* Error: ECPUTOOFAST */
-	if (endhigh)
+	if ((end - start) >> 32)
 		goto bad_ctc;
-	
-	endlow *= TICKS_PER_LATCH;
-	return endlow;
+	clocks = end - start;
+
+	/* Error: ECPUTOOSLOW, count a tick per clock rather than none */
+	if (clocks < USECS_PER_LATCH) {
+		printf("Warning: TSC below 1 MHz, timeouts will be long\n");
+		return 1;
+	}
+	return clocks / USECS_PER_LATCH;
 
 	/*
 	 * The CTC wasn't reliable: we got a hit on the very first read,
-	 * or the CPU was so fast/slow that the quotient wouldn't fit in
-	 * 32 bits..
+	 * or the CPU was so fast that the quotient wouldn't fit in
+	 * 32 bits.  currticks() divides by the result, so never hand
+	 * back 0; guess a plausible clock instead.
 	 */
 bad_ctc:
-	printf("bad_ctc\n");
-	return 0;
+	printf("Warning: TSC calibration failed, assuming %d Mhz\n",
+	       DEFAULT_CLOCKS_PER_TICK);
+	return DEFAULT_CLOCKS_PER_TICK;
 }
 
 static unsigned long clocks_per_tick;
+static unsigned long long tsc_base;
 void setup_timers(void)
 {
 	if (!clocks_per_tick) {
 		clocks_per_tick = calibrate_tsc();
+		rdtscll(tsc_base);
 		/* Display the CPU Mhz to easily test if the calibration was bad */
-		printf("CPU %ld Mhz\n", (clocks_per_tick/1000 * TICKS_PER_SEC)/1000);
+		printf("CPU %ld Mhz\n", clocks_per_tick);
 	}
 }
 
 unsigned long currticks(void)
 {
-	unsigned long clocks_high, clocks_low;
-	unsigned long currticks;
+	unsigned long long clocks;
+	unsigned long currticks, rem;
 	/* Read the Time Stamp Counter */
-	rdtsc(clocks_low, clocks_high);
-
-	/* currticks = clocks / clocks_per_tick; */
-	__asm__("divl %1"
-		:"=a" (currticks)
-		:"r" (clocks_per_tick), "0" (clocks_low), "d" (clocks_high));
-
+	rdtscll(clocks);
+	clocks -= tsc_base;
+
+	/* currticks = clocks / clocks_per_tick; in two steps so that the
+	 * quotient can't overflow, it wraps like any other tick count */
+	__asm__("divl %2"
+		:"=a" (currticks), "=d" (rem)
+		:"r" (clocks_per_tick), "0" ((unsigned long)(clocks >> 32)),
+		 "1" (0UL));
+	__asm__("divl %2"
+		:"=a" (currticks), "=d" (rem)
+		:"r" (clocks_per_tick), "0" ((unsigned long)clocks), "1" (rem));
 
 	return currticks;
 }
@@ -163,24 +170,25 @@ void udelay(unsigned int usecs)
 {
 	unsigned long long now;
 	rdtscll(now);
-	timer_timeout = now + usecs * ((clocks_per_tick * TICKS_PER_SEC)/(1000*1000));
+	timer_timeout = now + (unsigned long long)usecs * clocks_per_tick;
 	while(__timer_running());
 }
 void ndelay(unsigned int nsecs)
 {
 	unsigned long long now;
 	rdtscll(now);
-	timer_timeout = now + nsecs * ((clocks_per_tick * TICKS_PER_SEC)/(1000*1000*1000));
+	timer_timeout = now + (unsigned long long)(nsecs / 1000) * clocks_per_tick +
+		(nsecs % 1000) * clocks_per_tick / 1000;
 	while(__timer_running());
 }
 
 void load_timer2(unsigned int timer2_ticks)
 {
 	unsigned long long now;
-	unsigned long clocks;
+	unsigned long usecs;
 	rdtscll(now);
-	clocks = timer2_ticks * ((clocks_per_tick * TICKS_PER_SEC)/CLOCK_TICK_RATE);
-	timer_timeout = now + clocks;
+	usecs = (timer2_ticks * 1000) / TICKS_PER_MS;
+	timer_timeout = now + (unsigned long long)usecs * clocks_per_tick;
 }
 
 int timer2_running(void)
@@ -0,0 +1,39 @@
+/*
+ * i386 inner loop of the IP checksum, see ipchksum() in core/misc.c.
+ */
+
+#include "etherboot.h"
+
+/*
+ * Add nwords aligned 32 bit words to a partial ones complement sum.
+ * The carries are chained through adcl, four words per iteration;
+ * leal and decl keep the carry flag intact across the loop control.
+ */
+uint32_t arch_ipchksum_words(const uint32_t *p, unsigned long nwords,
+	uint32_t sum)
+{
+	unsigned long blocks = nwords / 4;
+
+	__asm__ (
+		"testl %2, %2\n\t"	/* also clears the carry */
+		"jz 2f\n"
+		"1:\n\t"
+		"adcl 0(%1), %0\n\t"
+		"adcl 4(%1), %0\n\t"
+		"adcl 8(%1), %0\n\t"
+		"adcl 12(%1), %0\n\t"
+		"leal 16(%1), %1\n\t"
+		"decl %2\n\t"
+		"jnz 1b\n"
+		"2:\n\t"
+		"adcl $0, %0"
+		: "=r" (sum), "=r" (p), "=r" (blocks)
+		: "0" (sum), "1" (p), "2" (blocks)
+		: "memory", "cc");
+	for (nwords &= 3; nwords; nwords--) {
+		uint32_t value = *p++;
+		sum += value;
+		sum += (sum < value);
+	}
+	return sum;
+}
@@ -134,6 +134,15 @@ static void multiboot_peek(unsigned char *data, int len)
 	mbimgoffset += len;
 }
 
+/* Image bytes below this offset must still go through multiboot_peek,
+ * so they can't be loaded out of order.  */
+static unsigned int multiboot_peek_end(void)
+{
+	if ((mboffset == 12) || (mbimgoffset >= 8192))
+		return 0;
+	return 8192;
+}
+
 static inline void multiboot_boot(unsigned long entry)
 {
 	unsigned char cmdline[512], *c;
@@ -97,15 +97,73 @@ static inline os_download_t tagged_probe(unsigned char *data, unsigned int len)
 	return tagged_download;
 
 }
+/* Where the segment described by sh is loaded, given where the one
+ * before it went */
+static unsigned long tagged_seg_addr(struct segheader *sh,
+	unsigned long last0, unsigned long last1)
+{
+	switch (sh->flags & 0x03) {
+	case 0x00:
+		return sh->loadaddr;
+	case 0x01:
+		return last1 + sh->loadaddr;
+	case 0x02:
+		return (Address)(meminfo.memsize * 1024L + 0x100000L)
+			- sh->loadaddr;
+	default:
+		return last0 - sh->loadaddr;
+	}
+}
+
+/* Find what becomes of the file bytes from offset on.  The segments
+ * follow the 512 byte header back to back, in the order of their
+ * descriptors.  The header itself was taken from the first block.
+ */
+static int tagged_place(unsigned long offset, unsigned int len,
+	unsigned long *addr, unsigned int *run)
+{
+	struct segheader *sh;
+	unsigned long segaddr, loc, cur, last0 = 0, last1 = 0;
+
+	if (offset < 512) {
+		*run = (len < 512 - offset) ? len : 512 - offset;
+		return 0;
+	}
+	segaddr = tctx.linlocation + ((tctx.img.length & 0x0F) << 2)
+		+ ((tctx.img.length & 0xF0) >> 2);
+	for (loc = 512; ; loc += sh->imglength) {
+		sh = (struct segheader *)phys_to_virt(segaddr);
+		if (sh->length == 0)
+			break;
+		cur = tagged_seg_addr(sh, last0, last1);
+		last1 = (last0 = cur) + sh->memlength;
+		if (offset - loc < sh->imglength) {
+			*addr = cur + (offset - loc);
+			*run = (len < sh->imglength - (offset - loc)) ?
+				len : sh->imglength - (offset - loc);
+			return 1;
+		}
+		if (sh->flags & 0x04)
+			break;
+		segaddr += ((sh->length & 0x0F) << 2)
+			+ ((sh->length & 0xF0) >> 2);
+	}
+	/* Past the last segment */
+	*run = len;
+	return 0;
+}
+
 static sector_t tagged_download(unsigned char *data, unsigned int len, int eof)
 {
 	int	i;
+	int	wait = load_wait_eof && !eof;
 
 	if (tctx.first) {
 		tctx.first = 0;
 		if (len > 512) {
 			len -= 512;
-			data += 512;
+			if (data)
+				data += 512;
 			/* and fall through to deal with rest of block */
 		} else 
 			return 0;
@@ -116,6 +174,8 @@ static sector_t tagged_download(unsigned char *data, unsigned int len, int eof)
 		while (tctx.seglen == 0) {
 			struct segheader	sh;
 			if (tctx.segflags & 0x04) {
+				if (wait)
+					return 0;
 				done(1);
 				if (LINEAR_EXEC_ADDR) {
 					int result;
@@ -144,16 +204,8 @@ static sector_t tagged_download(unsigned char *data, unsigned int len, int eof)
 			}
 			sh = *((struct segheader *)phys_to_virt(tctx.segaddr));
 			tctx.seglen = sh.imglength;
-			if ((tctx.segflags = sh.flags & 0x03) == 0)
-				tctx.curaddr = sh.loadaddr;
-			else if (tctx.segflags == 0x01)
-				tctx.curaddr = tctx.last1 + sh.loadaddr;
-			else if (tctx.segflags == 0x02)
-				tctx.curaddr = (Address)(meminfo.memsize * 1024L
-						    + 0x100000L)
-					- sh.loadaddr;
-			else
-				tctx.curaddr = tctx.last0 - sh.loadaddr;
+			tctx.curaddr = tagged_seg_addr(&sh, tctx.last0,
+						       tctx.last1);
 			tctx.last1 = (tctx.last0 = tctx.curaddr) + sh.memlength;
 			tctx.segflags = sh.flags;
 			tctx.segaddr += ((sh.length & 0x0F) << 2)
@@ -164,11 +216,14 @@ static sector_t tagged_download(unsigned char *data, unsigned int len, int eof)
 		if ((len <= 0) && !eof)
 			break;
 		i = (tctx.seglen > len) ? len : tctx.seglen;
-		memcpy(phys_to_virt(tctx.curaddr), data, i);
+		/* No data means it was placed ahead of time */
+		if (data) {
+			memcpy(phys_to_virt(tctx.curaddr), data, i);
+			data += i;
+		}
 		tctx.seglen -= i;
 		tctx.curaddr += i;
 		len -= i;
-		data += i;
 	} 
 	return 0;
 }
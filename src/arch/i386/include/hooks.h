@@ -6,4 +6,18 @@ void arch_on_exit(int status);
 #define arch_relocate_to(addr)
 void arch_relocated_from ( uint32_t old_addr );
 
+/* Inner loop of ipchksum(), see arch/i386/core/ipchksum.c */
+#define HAVE_ARCH_IPCHKSUM
+uint32_t arch_ipchksum_words(const uint32_t *p, unsigned long nwords,
+	uint32_t sum);
+
+/* Cycle counter for PACKET_STATS */
+#define HAVE_ARCH_CYCLES
+static inline uint64_t arch_cycles(void)
+{
+	uint64_t cycles;
+	__asm__ __volatile__ ("rdtsc" : "=A" (cycles));
+	return cycles;
+}
+
 #endif /* ETHERBOOT_I386_HOOKS_H */
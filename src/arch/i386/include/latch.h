@@ -1,7 +1,11 @@
 #ifndef LATCH_H
 #define LATCH_H
 
-#define	TICKS_PER_SEC		18
+#ifdef	CONFIG_TSC_CURRTICKS
+#define	TICKS_PER_SEC		1000000	/* currticks() counts microseconds */
+#else
+#define	TICKS_PER_SEC		18	/* BIOS timer interrupts */
+#endif
 
 /* For different calibrators of the TSC move the declaration of
  * sleep_latch and the definitions of it's length here...
@@ -0,0 +1,125 @@
+/* Boot timeline: where the time between power on and starting the image
+ * goes.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ */
+
+#include "etherboot.h"
+
+#ifdef BOOT_TRACE
+
+/* Passed to the loaded image in an EB_BOOT_TRACE note */
+struct boot_trace boot_trace_data;
+
+static int bt_phase;			/* Phase being charged */
+static unsigned long bt_ticks;		/* When it was last charged */
+static uint64_t bt_cycles;
+static unsigned long bt_packets;
+static unsigned long bt_bytes;
+
+static const char *const bt_names[BT_PHASES] = {
+	"init", "probe", "config", "arp", "dns", "download", "copy", "boot",
+};
+
+static inline uint64_t bt_now_cycles(void)
+{
+#ifdef HAVE_ARCH_CYCLES
+	return arch_cycles();
+#else
+	return 0;
+#endif
+}
+
+/**************************************************************************
+BOOT_TRACE_INIT - Start the clock, everything until the first phase
+change is charged to BT_INIT
+**************************************************************************/
+void boot_trace_init(void)
+{
+	memset(&boot_trace_data, 0, sizeof(boot_trace_data));
+	boot_trace_data.ticks_per_sec = TICKS_PER_SEC;
+	bt_phase = BT_INIT;
+	bt_ticks = currticks();
+	bt_cycles = bt_now_cycles();
+	bt_packets = bt_bytes = 0;
+}
+
+/* Charge the time and traffic since the last change to bt_phase */
+static void boot_trace_charge(void)
+{
+	struct boot_trace_phase *ph = &boot_trace_data.phase[bt_phase];
+	unsigned long ticks = currticks();
+	uint64_t cycles = bt_now_cycles();
+
+	ph->ticks += ticks - bt_ticks;
+	ph->cycles += cycles - bt_cycles;
+	ph->rx_packets += boot_trace_data.rx_packets - bt_packets;
+	ph->rx_bytes += boot_trace_data.rx_bytes - bt_bytes;
+	bt_ticks = ticks;
+	bt_cycles = cycles;
+	bt_packets = boot_trace_data.rx_packets;
+	bt_bytes = boot_trace_data.rx_bytes;
+}
+
+/**************************************************************************
+BOOT_TRACE_ENTER - Charge what follows to a phase nested in the current
+one, returns the phase to go back to with boot_trace_leave.  Nested
+phases change too often to be logged in the ring.
+**************************************************************************/
+int boot_trace_enter(int phase)
+{
+	int prev = bt_phase;
+
+	boot_trace_charge();
+	boot_trace_data.phase[phase].entries++;
+	bt_phase = phase;
+	return prev;
+}
+
+void boot_trace_leave(int phase)
+{
+	boot_trace_charge();
+	bt_phase = phase;
+}
+
+/**************************************************************************
+BOOT_TRACE - Move on to the next phase of booting and log it in the ring
+**************************************************************************/
+void boot_trace(int phase)
+{
+	struct boot_trace_event *ev;
+
+	boot_trace_enter(phase);
+	ev = &boot_trace_data.event[boot_trace_data.events++ % BOOT_TRACE_EVENTS];
+	ev->phase = phase;
+	ev->ticks = bt_ticks;
+	ev->cycles = bt_cycles;
+	ev->rx_packets = bt_packets;
+	ev->rx_bytes = bt_bytes;
+}
+
+/**************************************************************************
+BOOT_TRACE_PRINT - Show the time spent in each phase so far
+**************************************************************************/
+void boot_trace_print(void)
+{
+	int i;
+
+	boot_trace_charge();
+	for (i = 0; i < BT_PHASES; i++) {
+		struct boot_trace_phase *ph = &boot_trace_data.phase[i];
+		if (!ph->entries && !ph->ticks)
+			continue;
+		printf("%s: %d times, %d ticks", bt_names[i],
+			ph->entries, ph->ticks);
+#ifdef HAVE_ARCH_CYCLES
+		printf(", %d Kcycles", (unsigned long)(ph->cycles >> 10));
+#endif
+		printf(", rx %d pkts %d bytes\n", ph->rx_packets, ph->rx_bytes);
+	}
+}
+
+#endif	/* BOOT_TRACE */
@@ -33,6 +33,10 @@
 *    2004-05-22 CNAME support first stage finished
 *    2004-05-24 First "stable" release to CVS
 *    2004-08-28 Improve readability, set recursion flag
+*    2026-10-16 Cache answers, query all name servers at once, follow
+*               CNAME chains inside one answer, return binary addresses
+*    2026-10-16 Retransmission timeout from the measured round trip time
+*               of each name server
 ***************************************************************************/
 
 #ifdef DNS_RESOLVER
@@ -40,256 +44,315 @@
 #include "nic.h"
 #include "dns_resolver.h"
 
-#define	MAX_DNS_RETRIES	3
+#define	MAX_DNS_RETRIES	5
 #define	MAX_CNAME_RECURSION 0x30
 #undef DNSDEBUG
 
-int	donameresolution ( char * hostname, int hnlength, char * deststring );
+// State of one resolution, shared with await_dns
+struct dns_query {
+	unsigned char	*query;		// Query payload, name at QINDEX_QUESTION
+	in_addr		addr;		// Address found
+	unsigned long	ttl;		// Smallest TTL along the CNAME chain
+	int		server;		// arptable slot the reply came from
+};
+
+// Recently resolved names
+struct dns_cache_entry {
+	char		name[DNS_CACHE_NAMELEN];	// "" if unused
+	in_addr		addr;
+	unsigned long	expires;			// in currticks()
+};
+static struct dns_cache_entry dns_cache[DNS_CACHE_SIZE];
+
+static unsigned short dns_query_id = QUERYIDENTIFIER;
+
+// Round trip times, one per name server slot
+static struct rtt_estimator dns_rtt[MAX_NAMESERVERS];
+
+int	donameresolution ( const char * hostname, int hnlength,
+			   struct dns_query * dq );
+
+/*
+ *	dns_cache_lookup
+ *	Function: Find a hostname in the cache, ignoring expired entries
+ *	Return:	cache entry or NULL
+ */
+static struct dns_cache_entry * dns_cache_lookup ( const char * hostname,
+						   int hnlength ) {
+	int	i, j;
+	if ( hnlength >= DNS_CACHE_NAMELEN ) return NULL;
+	for ( i = 0; i < DNS_CACHE_SIZE; ++i ) {
+		if ( (long)( dns_cache[i].expires - currticks() ) <= 0 )
+			continue;	// Expired (or never used)
+		for ( j = 0; j < hnlength; ++j ) {
+			if ( tolower ( dns_cache[i].name[j] ) !=
+			     tolower ( hostname[j] ) ) break;
+		}
+		if ( ( j == hnlength ) && ( 0 == dns_cache[i].name[j] ) )
+			return	&dns_cache[i];
+	}
+	return	NULL;
+}
+
+/*
+ *	dns_cache_add
+ *	Function: Remember an answer for its TTL, replacing the entry
+ *		that runs out first
+ */
+static void dns_cache_add ( const char * hostname, int hnlength,
+			    in_addr addr, unsigned long ttl ) {
+	int	i, victim = 0;
+	if ( ( hnlength >= DNS_CACHE_NAMELEN ) || ( 0 == ttl ) ) return;
+	if ( ttl > DNS_CACHE_MAX_TTL ) ttl = DNS_CACHE_MAX_TTL;
+	for ( i = 1; i < DNS_CACHE_SIZE; ++i ) {
+		if ( (long)( dns_cache[i].expires -
+			     dns_cache[victim].expires ) < 0 )
+			victim = i;
+	}
+	memcpy ( dns_cache[victim].name, hostname, hnlength );
+	dns_cache[victim].name[hnlength] = 0;
+	dns_cache[victim].addr = addr;
+	dns_cache[victim].expires = currticks() + ttl * TICKS_PER_SEC;
+}
 
 /*
  *	dns_resolver
  *	Function: Main function for name resolution - will be called by other
  *		parts of etherboot
- *	Param:	string filename (not containing proto prefix like "tftp://")
- *	Return:	string filename, with hostname replaced by IP in dotted quad
- *		or NULL for resolver error
- *		In case no substitution is necessary, return will be = param
- *		The returned string, if not == input, will be temporary and
- *		probably be overwritten during the next call to dns_resolver
- *		The returned string may (or may not) only contain an IP
- *		address, or an IP followed by a ":" or "/", or be NULL(=error)
+ *	Param:	string filename (not containing proto prefix like "tftp://"),
+ *		where to store the address
+ *	Return:	number of characters of hostname that were resolved (the
+ *		rest of filename starts with ":" or "/"),
+ *		0 if there is no hostname (e.g. a dotted quad IP) and
+ *		-1 for resolver error
  */
-char *	dns_resolver ( char * filename ) {
+int	dns_resolver ( const char * filename, in_addr * ip ) {
 	int	i = 0, j, k;
-	static char ipaddr[16] = { 0 };
+	struct dns_cache_entry	*cached;
+	struct dns_query	dq;
+#ifdef	BOOT_TRACE
+	int	phase;
+#endif
 	// Search for "end of hostname" (which might be either ":" or "/")
 	for ( j = i; (filename[j] != ':') && (filename[j] != '/'); ++j ) {
 		// If no hostname delimiter was found, assume no name present
-		if ( filename[j] == 0 )	return	filename;
+		if ( filename[j] == 0 )	return	0;
 	}
 	// Check if the filename is an IP, in which case, leave unchanged
 	k = j - i - 1;
 	while ( ( '.' == filename[i+k] ) ||
 		( ( '0' <= filename[i+k] ) && ( '9' >= filename[i+k] ) ) ) {
 		--k;
-		if ( k < 0 ) return filename; // Only had nums and dots->IP
+		if ( k < 0 ) return 0; // Only had nums and dots->IP
+	}
+	// Names resolved earlier need no network traffic
+	if ( NULL != ( cached = dns_cache_lookup ( filename + i, j - i ) ) ) {
+		ip->s_addr = cached->addr.s_addr;
+		return	j;
 	}
 	// Now that we know it's a full hostname, attempt to resolve
-	if ( donameresolution ( filename + i, j - i, ipaddr ) ) {
-		return	NULL;	// Error in resolving - Fatal.
+#ifdef	BOOT_TRACE
+	phase = boot_trace_enter ( BT_DNS );
+#endif
+	k = donameresolution ( filename + i, j - i, &dq );
+#ifdef	BOOT_TRACE
+	boot_trace_leave ( phase );
+#endif
+	if ( k ) {
+		return	-1;	// Error in resolving - Fatal.
 	}
-	// Return the dotted-quad IP which resulted
-	return	ipaddr;
+	dns_cache_add ( filename + i, j - i, dq.addr, dq.ttl );
+	ip->s_addr = dq.addr.s_addr;
+	return	j;
+}
+
+/*
+ *	dns_skip_name
+ *	Function: Step over a (possibly compressed) name in a DNS packet
+ *	Return:	pointer behind the name, or NULL if it runs past end
+ */
+static unsigned char * dns_skip_name ( unsigned char * p,
+				       unsigned char * end ) {
+	while ( p < end ) {
+		if ( 0xc0 == ( p[0] & 0xc0 ) )
+			return	( p + 2 <= end ) ? p + 2 : NULL;
+		if ( 0 == p[0] )
+			return	p + 1;
+		p += p[0] + 1;
+	}
+	return	NULL;
+}
+
+/*
+ *	dns_match_name
+ *	Function: Compare a (possibly compressed) name in a DNS packet
+ *		with an uncompressed one, ignoring case
+ *	Return:	1 if equal, 0 otherwise
+ */
+static int dns_match_name ( unsigned char * msg, unsigned char * end,
+			    unsigned char * p, unsigned char * name ) {
+	int	i, hops = 0;
+	while ( p < end ) {
+		if ( 0xc0 == ( p[0] & 0xc0 ) ) {
+			// Pointer - also guards against pointer loops
+			if ( ( p + 2 > end ) || ( ++hops > 0x20 ) ) return 0;
+			p = msg + ( ( p[0] & 0x3f ) << 8 ) + p[1];
+			continue;
+		}
+		if ( p[0] != name[0] ) return 0;
+		if ( 0 == p[0] ) return 1;
+		if ( p + p[0] >= end ) return 0;
+		for ( i = 1; i <= p[0]; ++i ) {
+			if ( tolower ( p[i] ) != tolower ( name[i] ) )
+				return	0;
+		}
+		name += name[0] + 1;
+		p += p[0] + 1;
+	}
+	return	0;
+}
+
+/*
+ *	dns_copy_name
+ *	Function: Expand a (possibly compressed) name in a DNS packet
+ *		into an uncompressed one of at most max bytes
+ *	Return:	length of the copy including the end marker, or 0 on error
+ */
+static int dns_copy_name ( unsigned char * msg, unsigned char * end,
+			   unsigned char * p, unsigned char * dest, int max ) {
+	int	len = 0, hops = 0;
+	while ( p < end ) {
+		if ( 0xc0 == ( p[0] & 0xc0 ) ) {
+			if ( ( p + 2 > end ) || ( ++hops > 0x20 ) ) return 0;
+			p = msg + ( ( p[0] & 0x3f ) << 8 ) + p[1];
+			continue;
+		}
+		if ( ( p + p[0] >= end ) || ( len + p[0] + 1 >= max ) )
+			return	0;
+		memcpy ( dest + len, p, p[0] + 1 );
+		len += p[0] + 1;
+		if ( 0 == p[0] ) return len;
+		p += p[0] + 1;
+	}
+	return	0;
 }
 
 /*
  *	await_dns
  *	Shall be called on any incoming packet during the resolution process
  *	(as is the case with all the other await_ functions in etherboot)
- *	Param:	as any await functions
+ *	Param:	as any await functions, ival is the query ID and ptr the
+ *		struct dns_query
  *	Return:	see dns_resolver.h for constant return values + descriptions
  */
 static int await_dns (int ival, void *ptr,
-	unsigned short ptype __unused, struct iphdr *ip __unused,
+	unsigned short ptype __unused, struct iphdr *ip,
 	struct udphdr *udp, struct tcphdr *tcp __unused) {
-	int	i, j, k;
-	unsigned char *p = (unsigned char *)udp + sizeof(struct udphdr);
+	struct dns_query *dq = ptr;
+	unsigned char	name[DNS_MAX_NAME];	// Name the chain has reached
+	unsigned char	*p = (unsigned char *)udp + sizeof(struct udphdr);
 	// p is set to the beginning of the payload
-	unsigned char *q;
-	unsigned int querytype = QUERYTYPE_A;
+	unsigned char	*end, *q, *rr;
+	int	i, n, answers, followed, progress;
+	unsigned long	ttl;
 	if (  0 == udp  )	// Parser couldn't find UDP header
 		return RET_PACK_GARBAG;	// Not a UDP packet
 	if (( UDP_PORT_DNS != ntohs (udp->src )) ||
 	    ( UDP_PORT_DNS != ntohs (udp->dest)) )
 		// Neither source nor destination port is "53"
 		return RET_PACK_GARBAG;	// UDP port wrong
-	if (( p[QINDEX_ID  ] != 0) ||
+	for ( i = ARP_NAMESERVER; i < ARP_NAMESERVER + MAX_NAMESERVERS; ++i ) {
+		if ( arptable[i].ipaddr.s_addr &&
+		     ( arptable[i].ipaddr.s_addr == ip->src.s_addr ) )
+			break;
+	}
+	if ( i == ARP_NAMESERVER + MAX_NAMESERVERS )
+		return RET_PACK_GARBAG;	// Not from one of our name servers
+	if (( p[QINDEX_ID  ] != ((ival & 0xff00) >> 8)) ||
 	    ( p[QINDEX_ID+1] != (ival & 0xff)))
 		// Checking if this packet has set (inside payload)
 		// the sequence identifier that we expect
 		return RET_PACK_GARBAG;	// Not matching our request ID
+	dq->server = i;
 	if (( p[QINDEX_FLAGS  ] & QUERYFLAGS_MASK ) != QUERYFLAGS_WANT )
 		// We only accept responses to the query(ies) we sent
 		return	RET_PACK_GARBAG;	// Is not response=opcode <0>
-	querytype = (ival & 0xff00) >> 8;
-	if (((p[QINDEX_NUMANSW+1] + (p[QINDEX_NUMANSW+1]<<8)) == 0 ) ||
-	     ( ERR_NOSUCHNAME == (p[QINDEX_FLAGS+1] & 0x0f) ) ) {
-		// Answer section has 0 entries, or "no such name" returned
-		if ( QUERYTYPE_A == querytype) {
-			// It was an A type query, so we should try if there's
-			// an alternative "CNAME" record available
-			return	RET_RUN_CNAME_Q; // So try CNAME query next
-		} else if ( QUERYTYPE_CNAME == querytype) {
-			// There's no CNAME either, so give up
-			return	RET_NOSUCHNAME;
-		} else {
-			// Anything else? No idea what. Should not happen.
-			return	RET_NOSUCHNAME; // Bail out with error
-		}
-	}
+	if ( ERR_NOSUCHNAME == (p[QINDEX_FLAGS+1] & 0x0f) )
+		// A reliable "this name does not exist"
+		return	RET_NOSUCHNAME;
 	if ( 0 != ( p[QINDEX_FLAGS+1] & 0x0f ) )
-		// The response packet's flag section tells us:
-		return	RET_NOSUCHNAME;	// Another (unspecific) error occured
-	// Now we have an answer packet in response to our query. Next thing
-	// to do is to search the payload for the "answer section", as there is
-	// a question section first usually that needs to be skipped
-	// If question section was not repeated, that saves a lot of work :
-	if ( 0 >= (i = ((p[QINDEX_NUMQUEST] << 8) + p[QINDEX_NUMQUEST+1]))) {
-		q = p+ QINDEX_QUESTION;	// No question section, just continue;
-	} else if ( i >= 2 ) {		// More than one query section? Error!
-		return	RET_NOSUCHNAME;	// That's invalid for us anyway - 
-					// We only place one query at a time
-	} else {
-		// We have to skip through the question section first to
-		// find the beginning of the answer section
-		q = p + QINDEX_QUESTION;
-		while ( 0 != q[0] )
-			q += q[0] + 1; // Skip through
-		q += 5; // Skip over end-\0 and query type section
-	}
-	// Now our pointer shows the beginning of the answer section
-	// So now move it past the (repeated) query string, we only
-	// want the answer
-	while ( 0 != q[0] ) {
-		if ( 0xc0 == ( q[0] & 0xc0 ) ) { // Pointer
-			++q;
-			break;
-		}
-		q += q[0] + 1;
-	}
-	++q;
-	// Now check wether it's an INET host address (resp. CNAME)?
-	// There seem to be nameservers out there (Bind 9, for example),
-	// that return CNAMEs when no As are there, e.g. in
-	//   testname.test.   IN CNAME othername.test.
-	// case, bind 9 would return the CNAME record on an A query.
-	// Accept this case as it saves a lot of work (an extra query)
-	if (( QUERYTYPE_CNAME == q[1] ) &&
-	    ( QUERYTYPE_A     == querytype )) {
-		// A query, but CNAME response.
-		// Do simulate having done a CNAME query now and just assume
-		// the answer we are working on here is that of a CNAME query
-		// This works for single-depth CNAMEs fine.
-		// For deeper recursion, we won't parse the answer
-		// packet deeper but rely on a separate CNAME query
-		querytype = QUERYTYPE_CNAME;
-	}
-	// Now check wether the answer packet is of the expected type
-	// (remember, we just tweaked CNAME answers to A queries already)
-	if ( (q[0] != 0) ||
-	     (q[1] !=   querytype) ||   // query type matches?
-	     (q[2] != ((QUERYCLASS_INET & 0xff00) >> 8)) ||
-	     (q[3] !=  (QUERYCLASS_INET & 0x00ff))) { // class IN response?
-		return	RET_DNSERROR;	// Should not happen. DNS server bad?
-	}
-	q += 8;	// skip querytype/-class/ttl which are uninteresting now
-	if ( querytype == QUERYTYPE_A ) {
-		// So what we sent was an A query - expect an IPv4 address
-		// Check if datalength looks satisfactory
-		if ( ( 0 != q[0] ) || ( 4 != q[1] ) ) {
-			// Data length is not 4 bytes
+		// Server failure or the like - another server that was
+		// asked in parallel may still come up with an answer
+		return	RET_PACK_GARBAG;
+	end = p + ntohs ( udp->len ) - sizeof(struct udphdr);
+	if ( end > (unsigned char *)nic.packet + nic.packetlen )
+		return	RET_PACK_GARBAG;
+	// Skip the question section
+	q = p + QINDEX_QUESTION;
+	n = (p[QINDEX_NUMQUEST] << 8) + p[QINDEX_NUMQUEST+1];
+	for ( i = 0; i < n; ++i ) {
+		if ( NULL == ( q = dns_skip_name ( q, end ) ) )
 			return	RET_DNSERROR;
-		}
-		// Go to the IP address and copy it to the response buffer
-		p = ptr + QINDEX_STORE_A;
-		for ( i = 0; i < 4; ++i ) {
-			p[i] = q[i+2];
-		}
-		return	RET_GOT_ADDR; // OK! Address RETURNED! VERY FINE!
-	} else if ( querytype == QUERYTYPE_CNAME ) { // CNAME QUERY
-		// The pointer "q" now stands on the "payload length" of the
-		// CNAME data [2 byte field]. We will have to check wether this
-		// name is referenced in a following response, which would save
-		// us further queries, or if it is standalone, which calls for
-		// making a separate query
-		// This statement above probably needs clarification. To help
-		// the reader understand what's going on, imagine the DNS
-		// answer to be 4-section: query(repeating what we sent to the
-		// DNS server), answer(like the CNAME record we wanted),
-		// additional (which might hold the A for the CNAME - esp.
-		// Bind9 seems to provide us with this info when we didn't
-		// query for it yet) and authoritative (the DNS server's info
-		// on who is responsible for that data). For compression's
-		// sake, instead of specifying the full hostname string all
-		// the time, one can instead specify something like "same as on
-		// payload offset 0x123" - if this happens here, we can check
-		// if that payload offset given here by coincidence is that of
-		// an additional "A" record which saves us sending a separate
-		// query.
-		// We will look if there's  a/ two or more answer sections
-		// AND  b/ the next is a reference to us.
-		p = (unsigned char *)udp + sizeof(struct udphdr);
-		i = q + 2 - p;
-		if ( p[7] > 1 ) { // More than one answer section
-			// Check the next if it's a ref
-			// For that, we have to locate the next. Do this with "q".
-			p = q + (q[0] * 0x100) + q[1] + 2;
-			if ( (p[0] == (0xc0 + ((i & 0xf00)/256))) &&
-			     (p[1] == (i & 0xff) ) &&
-			     (p[2] == ((QUERYTYPE_A     & 0xff00) >> 8)) &&
-			     (p[3] ==  (QUERYTYPE_A     & 0x00ff)) &&
-			     (p[4] == ((QUERYCLASS_INET & 0xff00) >> 8 )) &&
-			     (p[5] ==  (QUERYCLASS_INET & 0x00ff)) &&
-			     (p[10]== 0) &&		// Data length expected
-			     (p[11]== 4)) {		// to be <4> (IP-addr)
-				// Behind that sections: TTL, data length(4)
-				for ( i = 0; i < 4; ++i ) {
-				    ((unsigned char*)ptr)[QINDEX_STORE_A+i] =
-					    p[12+i];
+		q += 4;	// query type and class
+	}
+	answers = (p[QINDEX_NUMANSW] << 8) + p[QINDEX_NUMANSW+1];
+	// Walk the answer section for the name we asked for. CNAMEs lead
+	// on to other names, whose records usually follow in the same
+	// answer, so keep walking as long as the chain gets longer.
+	if ( 0 == dns_copy_name ( dq->query, dq->query + DNS_MAX_NAME +
+				  QINDEX_QUESTION, dq->query + QINDEX_QUESTION,
+				  name, sizeof(name) ) )
+		return	RET_DNSERROR;
+	ttl = ~0UL;
+	followed = 0;
+	do {
+		progress = 0;
+		rr = q;
+		for ( i = 0; i < answers; ++i ) {
+			unsigned char	*rdata;
+			unsigned int	type, rdlen;
+			unsigned long	rrttl;
+			if ( NULL == ( rdata = dns_skip_name ( rr, end ) ) ||
+			     ( rdata + 10 > end ) )
+				return	RET_DNSERROR;
+			type  = (rdata[0] << 8) + rdata[1];
+			rrttl = ((unsigned long)rdata[4] << 24) +
+				(rdata[5] << 16) + (rdata[6] << 8) + rdata[7];
+			rdlen = (rdata[8] << 8) + rdata[9];
+			if ( rdata + 10 + rdlen > end )
+				return	RET_DNSERROR;
+			if ( ( QUERYCLASS_INET == (rdata[2] << 8) + rdata[3] ) &&
+			     dns_match_name ( p, end, rr, name ) ) {
+				if ( ( QUERYTYPE_A == type ) && ( 4 == rdlen ) ) {
+					memcpy ( &dq->addr, rdata + 10, 4 );
+					dq->ttl = ( rrttl < ttl ) ? rrttl : ttl;
+					return	RET_GOT_ADDR;
 				}
-				return	RET_GOT_ADDR;
-			}
-		}
-		// Reference not found, next query (A) needed (because CNAME
-		// queries usually return another hostname, not an IP address
-		// as we need it - that's the point in CNAME, anyway :-)
-		p = (unsigned char *)udp + sizeof(struct udphdr);
+				if ( ( QUERYTYPE_CNAME == type ) &&
+				     ( followed < MAX_CNAME_RECURSION ) &&
+				     dns_copy_name ( p, end, rdata + 10, name,
+						     sizeof(name) ) ) {
+					if ( rrttl < ttl ) ttl = rrttl;
+					++followed;
+					progress = 1;
 #ifdef DNSDEBUG
-		printf ( " ->[");
-#endif
-		k = QINDEX_QUESTION;
-		i = (q-p) + 2;
-		// Compose the hostname that needs to be queried for
-		// This looks complicated (and is a little bit) because
-		// we might not be able to copy verbatim, but need to
-		// check wether the CNAME looks like
-		// "servername" "plus what offset 0x123 of the payload says"
-		// (this saves transfer bandwidth, which is why DNS allows
-		// this, but it makes programmers' lives more difficult)
-		while (p[i] != 0) {
-			if ( (((unsigned char *)p)[i] & 0xc0) != 0 ) {
-				i = ((p[i] & 0x3f) * 0x100) + p[i+1];
-				continue;
-			}
-			((unsigned char *)ptr)[k] = p[i];
-			for ( j = i + 1; j <= i + p[i]; ++j ) {
-				((unsigned char *)ptr)[k+j-i] = p[j];
-#ifdef DNSDEBUG
-				printf ( "%c", p[j] );
+					printf ( " ->CNAME" );
 #endif
+				}
 			}
-			k += ((unsigned char *)ptr)[k] + 1;
-			i += p[i] + 1;
-#ifdef DNSDEBUG
-			printf ( (p[i] ? ".": "") );
-#endif
+			rr = rdata + 10 + rdlen;
 		}
-		((unsigned char *)ptr)[k] = 0;
-#ifdef DNSDEBUG
-		printf ( "].." );
-#endif
-		// So we need to run another query, this time try to
-		// get an "A" record for the hostname that the last CNAME
-		// query pointed to
-		return	RET_RUN_NEXT_A;
-	}
-	// We only accept CNAME or A replies from the nameserver, every-
-	// thing else is of no use for us.
-	// Must be an invalid packet that the nameserver sent.
-	return	RET_DNSERROR;
+	} while ( progress );
+	if ( 0 == followed )
+		// Name exists, but has neither A nor CNAME
+		return	RET_NOSUCHNAME;
+	// The chain ends at a name the server did not resolve for us,
+	// so that takes another query
+	memcpy ( dq->query + QINDEX_QUESTION, name, sizeof(name) );
+	return	RET_RUN_NEXT_A;
 }
 
-int	chars_to_next_dot ( char * countfrom, int maxnum ) {
+int	chars_to_next_dot ( const char * countfrom, int maxnum ) {
 	// Count the number of characters of this part of a hostname
 	int i;
 	for ( i = 1; i < maxnum; ++i ) {
@@ -298,27 +361,81 @@ int	chars_to_next_dot ( char * countfrom, int maxnum ) {
 	return	maxnum;
 }
 
+/*
+ *	dns_send_query
+ *	Function: Send the query to every known name server at once, the
+ *		first useful answer wins
+ *	Return:	number of servers asked
+ */
+static int dns_send_query ( unsigned char * querybuf, int len ) {
+	int	i, sent = 0;
+	rx_qdrain();	// Clear NIC packet buffer -
+			// there won't be anything of interest *now*.
+	for ( i = ARP_NAMESERVER; i < ARP_NAMESERVER + MAX_NAMESERVERS; ++i ) {
+		if ( 0 == arptable[i].ipaddr.s_addr ) continue;
+		if ( udp_transmit ( arptable[i].ipaddr.s_addr,
+				    UDP_PORT_DNS, UDP_PORT_DNS,
+				    len, querybuf ) )
+			++sent;
+	}
+	return	sent;
+}
+
+/*
+ *	dns_timeout
+ *	Function: How long to wait for the query dns_send_query sent, the
+ *		fastest name server is expected to answer first
+ *	Return:	timeout in ticks
+ */
+static long dns_timeout ( void ) {
+	long	timeout = 0, t;
+	int	i;
+	for ( i = 0; i < MAX_NAMESERVERS; ++i ) {
+		if ( 0 == arptable[ARP_NAMESERVER+i].ipaddr.s_addr ) continue;
+		rtt_server ( &dns_rtt[i], arptable[ARP_NAMESERVER+i].ipaddr.s_addr,
+			     RTT_INITIAL_TIMEOUT );
+		t = rtt_timeout ( &dns_rtt[i] );
+		if ( 0 == timeout || t < timeout )
+			timeout = t;
+	}
+	return	timeout;
+}
+
+/*
+ *	dns_backoff
+ *	Function: No name server answered, back off all of them
+ */
+static void dns_backoff ( void ) {
+	int	i;
+	for ( i = 0; i < MAX_NAMESERVERS; ++i ) {
+		if ( 0 == arptable[ARP_NAMESERVER+i].ipaddr.s_addr ) continue;
+		rtt_backoff ( &dns_rtt[i] );
+	}
+}
+
 /*
  *	donameresolution
  *	Function: Compose the initial query packet, handle answers until
  *		a/ an IP address is retrieved
- *		b/ too many CNAME references occured (max. MAX_DNS_RETRIES)
+ *		b/ too many CNAME references occured
  *		c/ No matching record for A or CNAME can be found
  *	Param:	string hostname, length (hostname needs no \0-end-marker),
- *		string to which dotted-quad-IP shall be written
+ *		query state to which the IP and its TTL shall be written
  *	Return:	0 for success, >0 for failure
  */
-int	donameresolution ( char * hostname, int hnlength, char * deststring ) {
-	unsigned char	querybuf[260+sizeof(struct iphdr)+sizeof(struct udphdr)];
-		// 256 for the DNS query payload, +4 for the result temporary
+int	donameresolution ( const char * hostname, int hnlength,
+			   struct dns_query * dq ) {
+	unsigned char	querybuf[QINDEX_QUESTION+DNS_MAX_NAME+4+sizeof(struct iphdr)+sizeof(struct udphdr)];
 	unsigned char	*query = &querybuf[sizeof(struct iphdr)+sizeof(struct udphdr)];
 		// Pointer to the payload
 	int	i, h = hnlength;
 	long	timeout;
+	unsigned long	sent;
 	int	retry, recursion;
+	if ( h > DNS_MAX_NAME - 2 ) return 1;	// Name plus length byte and
+						// end marker must fit
+	dq->query = query;
 	// Setup the query data
-	query[QINDEX_ID  ]	= (QUERYIDENTIFIER & 0xff00) >> 8;
-	query[QINDEX_ID+1]	=  QUERYIDENTIFIER & 0xff;
 	query[QINDEX_FLAGS  ]	= (QUERYFLAGS & 0xff00) >> 8;
 	query[QINDEX_FLAGS+1]	=  QUERYFLAGS & 0xff;
 	query[QINDEX_NUMQUEST  ]= 0;
@@ -330,9 +447,6 @@ int	donameresolution ( char * hostname, int hnlength, char * deststring ) {
 	query[QINDEX_NUMADDIT  ]= 0;
 	query[QINDEX_NUMADDIT+1]= 0;
 	query[QINDEX_QUESTION]	= chars_to_next_dot(hostname,h);
-	if ( h > 236 ) return 1;	// Hostnames longer than 236 chars are refused.
-					// This is an arbitrary decision, SHOULD check
-					// what the RFCs say about that
 	for ( i = 0; i < h; ++i ) {
 		// Compose the query section's hostname - replacing dots (and
 		// preceding the string) with one-byte substring-length values
@@ -341,76 +455,60 @@ int	donameresolution ( char * hostname, int hnlength, char * deststring ) {
 		if ( hostname[i] == '.' )
 			query[QINDEX_QUESTION+i+1] = chars_to_next_dot(hostname + i + 1, h - i - 1);
 	}
-	query[QINDEX_QTYPE+h  ]	= (QUERYTYPE_A & 0xff00) >> 8;
-	query[QINDEX_QTYPE+h+1]	=  QUERYTYPE_A & 0xff;
-					// First try an A query, if that
-					// won't work, try CNAME
+	query[QINDEX_QUESTION+h+1] = 0;	// Marks the end of the query string
 	printf ( "Resolving hostname [" );
 	for ( i = 0; i < hnlength; ++i ) { printf ( "%c", hostname[i] ); }
 	printf ("]" );
 	for ( recursion = MAX_CNAME_RECURSION; recursion > 0; --recursion ) {
 		printf ( ".." );
-		// Try MAX_CNAME_RECURSION CNAME queries maximally, if then no
-		// A record is found, assume the hostname to not be resolvable
-		query[QINDEX_QUESTION+h+1] = 0;	// Marks the end of
-						// the query string
+		// Only A records are asked for, a CNAME chain comes along
+		// in the answer anyway
+		query[QINDEX_ID  ] = (dns_query_id & 0xff00) >> 8;
+		query[QINDEX_ID+1] =  dns_query_id & 0xff;
+		query[QINDEX_QTYPE+h  ] = (QUERYTYPE_A & 0xff00) >> 8;
+		query[QINDEX_QTYPE+h+1] =  QUERYTYPE_A & 0xff;
 		query[QINDEX_QCLASS+h  ]= (QUERYCLASS_INET & 0xff00) >> 8;
 		query[QINDEX_QCLASS+h+1]=  QUERYCLASS_INET & 0xff;
-		rx_qdrain();	// Clear NIC packet buffer -
-				// there won't be anything of interest *now*.
-		udp_transmit ( arptable[ARP_NAMESERVER].ipaddr.s_addr,
-				UDP_PORT_DNS, UDP_PORT_DNS,
-				hnlength + 18 + sizeof(struct iphdr) +
-				sizeof(struct udphdr), querybuf );
 		// If no answer comes in in a certain period of time, retry
 		for (retry = 1; retry <= MAX_DNS_RETRIES; retry++) {
-			timeout = rfc2131_sleep_interval(TIMEOUT, retry);
-			i = await_reply ( await_dns,
-				(query[QINDEX_QTYPE+h+1] << 8) +
-				((unsigned char *)query)[QINDEX_ID+1],
-				query, timeout);
-			// The parameters given are
-			//	bits 15...8 of integer = Query type  (low bits)
-			//	bits  7...0 of integer = Query index (low bits)
-			//	query + QINDEX_STORE_A points to the place
-			//	where A records	shall be stored (4 bytes);
-			//	query + 12(QINDEX_QUESTION) points to where
-			//	a CNAME should go in case one is received
-			if (i) break;
+			sent = currticks();
+			if ( 0 == dns_send_query ( querybuf, h + 18 +
+					sizeof(struct iphdr) +
+					sizeof(struct udphdr) ) ) {
+				printf ( "No name server\n" );
+				return	RET_DNS_FAIL;
+			}
+			timeout = dns_timeout();
+			i = await_reply ( await_dns, dns_query_id, dq,
+					  timeout );
+			if (i) {
+				// Only a query sent once times the server
+				// that answered it (Karn)
+				if ( 1 == retry )
+					rtt_sample ( &dns_rtt[dq->server -
+						     ARP_NAMESERVER], sent );
+				break;
+			}
+			dns_backoff();
 		}
+		++dns_query_id;
 		switch ( i ) {
 		  case	RET_GOT_ADDR:	// Address successfully retrieved
-			sprintf( deststring, "%@",
-				  (long)query[QINDEX_STORE_A  ]           +
-				( (long)query[QINDEX_STORE_A+1] * 256 ) +
-				( (long)query[QINDEX_STORE_A+2] * 65536 )+
-				( (long)query[QINDEX_STORE_A+3] * 16777216 ));
-			printf ( " -> IP [%s]\n", deststring );
+			printf ( " -> IP [%@]\n", dq->addr.s_addr );
 			return	RET_DNS_OK;
-		  case	RET_RUN_CNAME_Q: // No A record found, try CNAME
-			query[QINDEX_QTYPE+h  ]=(QUERYTYPE_CNAME & 0xff00)>> 8;
-			query[QINDEX_QTYPE+h+1]= QUERYTYPE_CNAME & 0xff;
-			break;
 		  case	RET_RUN_NEXT_A:
 			// Found a CNAME, now try A for the name it pointed to
 			for ( i = 0; query[QINDEX_QUESTION+i] != 0;
 					i += query[QINDEX_QUESTION+i] + 1 ) {;}
 			h = i - 1;
-			query[QINDEX_QTYPE+h  ]=(QUERYTYPE_A & 0xff00)>> 8;
-			query[QINDEX_QTYPE+h+1]= QUERYTYPE_A & 0xff;
 			break;
-		  case	RET_CNAME_FAIL:
-			// Neither A nor CNAME gave a usable result
+		  case	RET_NOSUCHNAME:
 			printf ("Host name cannot be resolved\n");
 			return	RET_DNS_FAIL;
-		  case	RET_NOSUCHNAME:
 		  default:
 			printf ( "Name resolution failed\n" );
 			return	RET_DNS_FAIL;
 		}
-		query[QINDEX_ID  ] = 0;	// We will probably never have more
-					// than 256 queries in one run
-		query[QINDEX_ID+1]++;
 	}
 	// To deep recursion
 	printf ( "CNAME recursion to deep - abort name resolver\n" );
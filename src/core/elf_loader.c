@@ -278,7 +278,9 @@ static sector_t elf32_download(unsigned char *data, unsigned int len, int eof)
 				if (cplen >= estate.toread) {
 					cplen = estate.toread;
 				}
-				memcpy(phys_to_virt(estate.curaddr), data+offset, cplen);
+				/* No data means it was placed ahead of time */
+				if (data)
+					memcpy(phys_to_virt(estate.curaddr), data+offset, cplen);
 				estate.curaddr += cplen;
 				estate.toread -= cplen;
 				offset += cplen;
@@ -314,6 +316,8 @@ static sector_t elf32_download(unsigned char *data, unsigned int len, int eof)
 			/* No more segments to be loaded, so just start the
 			 * kernel.  This saves a lot of network bandwidth if
 			 * debug info is in the kernel but not loaded.  */
+			if (load_wait_eof)
+				break;
 			goto elf_startkernel;
 			break;
 		}
@@ -389,6 +393,44 @@ elf_startkernel:
 	}
 	return skip_sectors;
 }
+
+#ifndef IMAGE_FREEBSD
+/* Find what becomes of the file bytes from offset on: the file part
+ * of a PT_LOAD segment is loaded at its p_paddr, anything between
+ * segments is not loaded.  The bytes multiboot_peek still has to see
+ * must come in order.
+ */
+static int elf32_place(unsigned long offset, unsigned int len,
+	unsigned long *addr, unsigned int *run)
+{
+	unsigned long end = offset + len;
+	int i;
+
+#ifdef IMAGE_MULTIBOOT
+	if (offset < multiboot_peek_end()) {
+		*run = len;
+		return -1;
+	}
+#endif
+	for(i = 0; i < estate.e.elf32.e_phnum; i++) {
+		unsigned long start, stop;
+		if (estate.p.phdr32[i].p_type != PT_LOAD)
+			continue;
+		start = estate.p.phdr32[i].p_offset;
+		stop = start + estate.p.phdr32[i].p_filesz;
+		if ((offset >= start) && (offset < stop)) {
+			*addr = estate.p.phdr32[i].p_paddr + (offset - start);
+			*run = ((stop < end) ? stop : end) - offset;
+			return 1;
+		}
+		if ((start > offset) && (start < end)) {
+			end = start;	/* the gap ends where this starts */
+		}
+	}
+	*run = end - offset;
+	return 0;
+}
+#endif
 #endif /* ELF_IMAGE */
 
 #ifdef  ELF64_IMAGE
@@ -583,6 +625,8 @@ static sector_t elf64_download(unsigned char *data, unsigned int len, int eof)
 			/* No more segments to be loaded, so just start the
 			 * kernel.  This saves a lot of network bandwidth if
 			 * debug info is in the kernel but not loaded.  */
+			if (load_wait_eof)
+				break;
 			goto elf_startkernel;
 			break;
 		}
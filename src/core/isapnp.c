@@ -42,7 +42,7 @@ static int pnp_card_csn = 0;
 void isapnp_wait(unsigned int nticks)
 {
 	unsigned int to = currticks() + nticks;
-	while (currticks() < to)
+	while ((long)(currticks() - to) < 0)
 		/* Wait */ ;
 }
 
@@ -115,9 +115,9 @@ static int do_isapnp_isolate(void)
 	while (1) {
 		for (i = 1; i <= 64; i++) {
 			c1 = READ_DATA;
-			isapnp_wait(1);
+			isapnp_wait(USECS_TO_TICKS(55000));
 			c2 = READ_DATA;
-			isapnp_wait(1);
+			isapnp_wait(USECS_TO_TICKS(55000));
 			if (c1 == 0x55) {
 				if (c2 == 0xAA) {
 					bit = 0x01;
@@ -100,7 +100,7 @@ static inline unsigned long ask_boot(unsigned *index)
 			unsigned long time;
 			for ( time = currticks() + ASK_BOOT*TICKS_PER_SEC;
 			      !c && !iskey(); ) {
-				if (currticks() > time) c = ANS_DEFAULT;
+				if ((long)(currticks() - time) > 0) c = ANS_DEFAULT;
 			}
 		}
 #endif /* ASK_BOOT > 0 */
@@ -315,6 +315,9 @@ static int main_loop(int state)
 			cleanup();
 			console_init();
 			init_heap();
+#ifdef	BOOT_TRACE
+			boot_trace_init();
+#endif
 #ifdef  CONSOLE_BTEXT
 			//I need to all allot
 		        btext_init(); 
@@ -384,6 +387,9 @@ static int main_loop(int state)
 		break;
 	case 3:
 		state = -1;
+#ifdef	BOOT_TRACE
+		boot_trace(BT_PROBE);
+#endif
 		heap_base = allot(0);
 		dev->how_probe = ops->probe(dev);
 		if (dev->how_probe == PROBE_FAILED) {
@@ -399,11 +405,17 @@ static int main_loop(int state)
 		break;
 	case 2:
 		state = -1;
+#ifdef	BOOT_TRACE
+		boot_trace(BT_CONFIG);
+#endif
 		if (ops->load_configuration(dev) >= 0) {
 			state = 1;
 		}
 		break;
 	case 1:
+#ifdef	BOOT_TRACE
+		boot_trace(BT_DOWNLOAD);
+#endif
 		/* Any return from load is a failure */
 		ops->load(dev);
 		state = -1;
@@ -469,7 +481,7 @@ int loadkernel(const char *fname)
 	int len;
 	const char *name;
 #ifdef	DNS_RESOLVER
-	const char *resolvt;
+	int resolved;
 #endif
 	ip.s_addr = arptable[ARP_SERVER].ipaddr.s_addr;
 	name = fname;
@@ -487,14 +499,10 @@ int loadkernel(const char *fname)
 		name += len + 3;
 		if (name[0] != '/') {
 #ifdef DNS_RESOLVER
-			resolvt = dns_resolver ( name );
-			if ( NULL != resolvt ) {
-				//printf ("Resolved host name [%s] to [%s]\n",
-				//	name, resolvt );
-				inet_aton(resolvt, &ip);
-				while ( ( '/' != name[0] ) && ( 0 != name[0]))
-					++name;
-			} else
+			resolved = dns_resolver ( name, &ip );
+			if ( resolved > 0 )
+				name += resolved;
+			else
 #endif	/* DNS_RESOLVER */
 			name += inet_aton(name, &ip);
 			if (name[0] == ':') {
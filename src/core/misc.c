@@ -11,34 +11,107 @@ MISC Support Routines
 #endif
 
 
+#ifndef HAVE_ARCH_IPCHKSUM
+/**************************************************************************
+ARCH_IPCHKSUM_WORDS - Add nwords aligned 32 bit words to a partial sum
+**************************************************************************/
+static uint32_t arch_ipchksum_words(const uint32_t *p, unsigned long nwords,
+	uint32_t sum)
+{
+	uint64_t acc = sum;
+
+	/* The carries are collected in the upper half of acc and
+	 * folded back in at the end. */
+	for (; nwords >= 4; nwords -= 4, p += 4) {
+		acc += (uint64_t)p[0] + p[1] + p[2] + p[3];
+	}
+	while (nwords--) {
+		acc += *p++;
+	}
+	acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+	acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+	return acc;
+}
+#endif
+
+static inline uint32_t ipchksum_add32(uint32_t sum, uint32_t value)
+{
+	sum += value;
+	/* Wrap around the carry */
+	return sum + (sum < value);
+}
+
+/**************************************************************************
+IPCHKSUM_PARTIAL - Ones complement sum of data, folded to 16 bits
+
+The sum is taken in host byte order, which gives the byte swapped result
+of a network order sum and so needs no conversion before it is stored.
+**************************************************************************/
+static uint16_t ipchksum_partial(const void *data, unsigned long length)
+{
+	const uint8_t *ptr = data;
+	uint32_t sum = 0;
+	int odd;
+
+	if (!length)
+		return 0;
+	/* Starting on an odd address every byte is summed in the wrong half
+	 * of its 16 bit word, which is undone by swapping the result. */
+	odd = (unsigned long)ptr & 1;
+	if (odd) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		sum = *ptr << 8;
+#else
+		sum = *ptr;
+#endif
+		ptr++;
+		length--;
+	}
+	if ((length >= 2) && ((unsigned long)ptr & 2)) {
+		sum += *(const uint16_t *)ptr;
+		ptr += 2;
+		length -= 2;
+	}
+	sum = arch_ipchksum_words((const uint32_t *)ptr, length / 4, sum);
+	ptr += length & ~3UL;
+	if (length & 2) {
+		sum = ipchksum_add32(sum, *(const uint16_t *)ptr);
+		ptr += 2;
+	}
+	if (length & 1) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		sum = ipchksum_add32(sum, *ptr);
+#else
+		sum = ipchksum_add32(sum, *ptr << 8);
+#endif
+	}
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	if (odd) {
+		sum = bswap_16(sum);
+	}
+	return sum;
+}
+
 /**************************************************************************
 IPCHKSUM - Checksum IP Header
 **************************************************************************/
 uint16_t ipchksum(const void *data, unsigned long length)
 {
-	unsigned long sum;
-	unsigned long i;
-	const uint8_t *ptr;
-
-	/* In the most straight forward way possible,
-	 * compute an ip style checksum.
-	 */
-	sum = 0;
-	ptr = data;
-	for(i = 0; i < length; i++) {
-		unsigned long value;
-		value = ptr[i];
-		if (i & 1) {
-			value <<= 8;
-		}
-		/* Add the new value */
-		sum += value;
-		/* Wrap around the carry */
-		if (sum > 0xFFFF) {
-			sum = (sum + (sum >> 16)) & 0xFFFF;
-		}
-	}
-	return (~cpu_to_le16(sum)) & 0xFFFF;
+#ifdef PACKET_STATS
+	uint16_t sum;
+#ifdef HAVE_ARCH_CYCLES
+	uint64_t cycles = arch_cycles();
+#endif
+	sum = ipchksum_partial(data, length);
+#ifdef HAVE_ARCH_CYCLES
+	packet_stats.chksum_cycles += arch_cycles() - cycles;
+#endif
+	packet_stats.chksum_bytes += length;
+	return (~sum) & 0xFFFF;
+#else
+	return (~ipchksum_partial(data, length)) & 0xFFFF;
+#endif
 }
 
 uint16_t add_ipchksums(unsigned long offset, uint16_t sum, uint16_t new)
@@ -109,7 +182,7 @@ void sleep(int secs)
 {
 	unsigned long tmo;
 
-	for (tmo = currticks()+secs*TICKS_PER_SEC; currticks() < tmo; ) {
+	for (tmo = currticks()+secs*TICKS_PER_SEC; (long)(currticks() - tmo) < 0; ) {
 		poll_interruptions();
 	}
 }
@@ -224,7 +297,7 @@ static void empty_8042(void)
 	time = currticks() + TICKS_PER_SEC;	/* max wait of 1 second */
 	while ((((st = inb(K_CMD)) & K_OBUF_FUL) ||
 	       (st & K_IBUF_FUL)) &&
-	       currticks() < time)
+	       (long)(currticks() - time) < 0)
 		inb(K_RDWR);
 }
 #endif	/* IBM_L40 */
@@ -23,11 +23,16 @@
 #define START_OPORT 700		/* mountd usually insists on secure ports */
 #define OPORT_SWEEP 200		/* make sure we don't leave secure range */
 
+/* mountd version matching the NFS version in use */
+#define MOUNT_VERS	(nfs_vers == 3 ? 3 : 1)
+
 static int oport = START_OPORT;
 static int mount_port = -1;
 static int nfs_port = -1;
 static int fs_mounted = 0;
+static int nfs_vers = 2;	/* NFS protocol version spoken to the server */
 static unsigned long rpc_id;
+static struct rtt_estimator rpc_rtt;	/* Round trips to the server */
 
 /**************************************************************************
 RPC_INIT - set up the ID counter to something fairly random
@@ -83,6 +88,30 @@ static int await_rpc(int ival, void *ptr,
 	return 1;
 }
 
+/**************************************************************************
+RPC_CALL - Send a call and wait for the reply, retransmitting as needed
+**************************************************************************/
+static struct rpc_t *rpc_call(int server, int port, void *buf, int len,
+	int sport, unsigned long id)
+{
+	int retries;
+
+	rtt_server(&rpc_rtt, arptable[server].ipaddr.s_addr,
+		RTT_INITIAL_TIMEOUT);
+	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
+		unsigned long sent = currticks();
+		udp_transmit(arptable[server].ipaddr.s_addr, sport, port,
+			len, buf);
+		if (await_reply(await_rpc, sport, &id, rtt_timeout(&rpc_rtt))) {
+			if (!retries)
+				rtt_sample(&rpc_rtt, sent);
+			return (struct rpc_t *)&nic.packet[ETH_HLEN];
+		}
+		rtt_backoff(&rpc_rtt);
+	}
+	return NULL;
+}
+
 /**************************************************************************
 RPC_LOOKUP - Lookup RPC Port numbers
 **************************************************************************/
@@ -90,7 +119,6 @@ static int rpc_lookup(int addr, int prog, int ver, int sport)
 {
 	struct rpc_t buf, *rpc;
 	unsigned long id;
-	int retries;
 	long *p;
 
 	id = rpc_id++;
@@ -107,23 +135,16 @@ static int rpc_lookup(int addr, int prog, int ver, int sport)
 	*p++ = htonl(ver);
 	*p++ = htonl(IP_UDP);
 	*p++ = 0;
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout;
-		udp_transmit(arptable[addr].ipaddr.s_addr, sport, SUNRPC_PORT,
-			(char *)p - (char *)&buf, &buf);
-		timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		if (await_reply(await_rpc, sport, &id, timeout)) {
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus) {
-				rpc_printerror(rpc);
-				return -1;
-			} else {
-				return ntohl(rpc->u.reply.data[0]);
-			}
-		}
+	rpc = rpc_call(addr, SUNRPC_PORT, &buf, (char *)p - (char *)&buf,
+		sport, id);
+	if (!rpc)
+		return -1;
+	if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
+	    rpc->u.reply.astatus) {
+		rpc_printerror(rpc);
+		return -1;
 	}
-	return -1;
+	return ntohl(rpc->u.reply.data[0]);
 }
 
 /**************************************************************************
@@ -198,14 +219,74 @@ static void nfs_printerror(int err)
 	}
 }
 
+/**************************************************************************
+NFS_CALL - Fill in the header of a call to nfsd, including credentials
+**************************************************************************/
+static long *nfs_call(struct rpc_t *buf, unsigned long id, int proc)
+{
+	buf->u.call.id = htonl(id);
+	buf->u.call.type = htonl(MSG_CALL);
+	buf->u.call.rpcvers = htonl(2);	/* use RPC version 2 */
+	buf->u.call.prog = htonl(PROG_NFS);
+	buf->u.call.vers = htonl(nfs_vers);
+	buf->u.call.proc = htonl(proc);
+	return rpc_add_credentials((long *)buf->u.call.data);
+}
+
+/**************************************************************************
+NFS_ADD_FH - Append a file handle to a call
+**************************************************************************/
+static long *nfs_add_fh(long *p, const struct nfs_fh *fh)
+{
+	/* NFSv2 handles are fixed size, NFSv3 ones are counted opaques */
+	if (nfs_vers == 3) {
+		*p++ = htonl(fh->len);
+	}
+	if (fh->len & 3) {
+		*(p + fh->len / 4) = 0;	/* add zero padding */
+	}
+	memcpy(p, fh->data, fh->len);
+	return p + (fh->len + 3) / 4;
+}
+
+/**************************************************************************
+NFS_GET_FH - Extract a file handle from a reply
+**************************************************************************/
+static uint32_t *nfs_get_fh(uint32_t *p, struct nfs_fh *fh)
+{
+	fh->len = NFS_FHSIZE;
+	if (nfs_vers == 3) {
+		fh->len = ntohl(*p++);
+		if (fh->len > NFS3_FHSIZE)
+			fh->len = NFS3_FHSIZE;	/* shouldn't happen...  */
+	}
+	memcpy(fh->data, p, fh->len);
+	return p + (fh->len + 3) / 4;
+}
+
+/**************************************************************************
+NFS3_GET_ATTR - Skip over NFSv3 post_op_attr, picking up the file size
+**************************************************************************/
+static uint32_t *nfs3_get_attr(uint32_t *p, uint64_t *size)
+{
+	if (ntohl(*p++)) {
+		/* attributes_follow, size is the 64 bit word after
+		 * type, mode, nlink, uid and gid */
+		if (size)
+			*size = ((uint64_t)ntohl(p[5]) << 32) | ntohl(p[6]);
+		p += NFS3_FATTR_WORDS;
+	}
+	return p;
+}
+
 /**************************************************************************
 NFS_MOUNT - Mount an NFS Filesystem
 **************************************************************************/
-static int nfs_mount(int server, int port, char *path, char *fh, int sport)
+static int nfs_mount(int server, int port, char *path, struct nfs_fh *fh,
+	int sport)
 {
 	struct rpc_t buf, *rpc;
 	unsigned long id;
-	int retries;
 	long *p;
 	int pathlen = strlen(path);
 
@@ -214,7 +295,7 @@ static int nfs_mount(int server, int port, char *path, char *fh, int sport)
 	buf.u.call.type = htonl(MSG_CALL);
 	buf.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
 	buf.u.call.prog = htonl(PROG_MOUNT);
-	buf.u.call.vers = htonl(1);	/* mountd is version 1 */
+	buf.u.call.vers = htonl(MOUNT_VERS);
 	buf.u.call.proc = htonl(MOUNT_ADDENTRY);
 	p = rpc_add_credentials((long *)buf.u.call.data);
 	*p++ = htonl(pathlen);
@@ -223,33 +304,25 @@ static int nfs_mount(int server, int port, char *path, char *fh, int sport)
 	}
 	memcpy(p, path, pathlen);
 	p += (pathlen + 3) / 4;
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout;
-		udp_transmit(arptable[server].ipaddr.s_addr, sport, port,
-			(char *)p - (char *)&buf, &buf);
-		timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		if (await_reply(await_rpc, sport, &id, timeout)) {
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
-				rpc_printerror(rpc);
-				if (rpc->u.reply.rstatus) {
-					/* RPC failed, no verifier, data[0] */
-					return -9999;
-				}
-				if (rpc->u.reply.astatus) {
-					/* RPC couldn't decode parameters */
-					return -9998;
-				}
-				return -ntohl(rpc->u.reply.data[0]);
-			} else {
-				fs_mounted = 1;
-				memcpy(fh, rpc->u.reply.data + 1, NFS_FHSIZE);
-				return 0;
-			}
+	rpc = rpc_call(server, port, &buf, (char *)p - (char *)&buf, sport, id);
+	if (!rpc)
+		return -1;
+	if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
+	    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
+		rpc_printerror(rpc);
+		if (rpc->u.reply.rstatus) {
+			/* RPC failed, no verifier, data[0] */
+			return -9999;
 		}
+		if (rpc->u.reply.astatus) {
+			/* RPC couldn't decode parameters */
+			return -9998;
+		}
+		return -ntohl(rpc->u.reply.data[0]);
 	}
-	return -1;
+	fs_mounted = 1;
+	nfs_get_fh(rpc->u.reply.data + 1, fh);
+	return 0;
 }
 
 /**************************************************************************
@@ -259,7 +332,6 @@ void nfs_umountall(int server)
 {
 	struct rpc_t buf, *rpc;
 	unsigned long id;
-	int retries;
 	long *p;
 
 	if (!arptable[server].ipaddr.s_addr) {
@@ -275,24 +347,59 @@ void nfs_umountall(int server)
 	buf.u.call.type = htonl(MSG_CALL);
 	buf.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
 	buf.u.call.prog = htonl(PROG_MOUNT);
-	buf.u.call.vers = htonl(1);	/* mountd is version 1 */
+	buf.u.call.vers = htonl(MOUNT_VERS);
 	buf.u.call.proc = htonl(MOUNT_UMOUNTALL);
 	p = rpc_add_credentials((long *)buf.u.call.data);
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		udp_transmit(arptable[server].ipaddr.s_addr, oport, mount_port,
-			(char *)p - (char *)&buf, &buf);
-		if (await_reply(await_rpc, oport, &id, timeout)) {
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus) {
-				rpc_printerror(rpc);
-			}
-			fs_mounted = 0;
-			return;
+	rpc = rpc_call(server, mount_port, &buf, (char *)p - (char *)&buf,
+		oport, id);
+	if (!rpc)
+		return;
+	if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
+	    rpc->u.reply.astatus) {
+		rpc_printerror(rpc);
+	}
+	fs_mounted = 0;
+}
+
+/**************************************************************************
+NFS_REPLY_ERROR - Check a reply from nfsd for errors
+**************************************************************************/
+static int nfs_reply_error(struct rpc_t *rpc)
+{
+	if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
+	    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
+		rpc_printerror(rpc);
+		if (rpc->u.reply.rstatus) {
+			/* RPC failed, no verifier, data[0] */
+			return -9999;
+		}
+		if (rpc->u.reply.astatus) {
+			/* RPC couldn't decode parameters */
+			return -9998;
 		}
+		return -ntohl(rpc->u.reply.data[0]);
+	}
+	return 0;
+}
+
+/**************************************************************************
+NFS_TRANSACT - Send a call to nfsd and wait for a successful reply
+**************************************************************************/
+static struct rpc_t *nfs_transact(int server, int port, struct rpc_t *buf,
+	long *end, int sport, int *err)
+{
+	struct rpc_t *rpc;
+
+	rpc = rpc_call(server, port, buf, (char *)end - (char *)buf, sport,
+		ntohl(buf->u.call.id));
+	if (!rpc) {
+		*err = -1;
+		return NULL;
 	}
+	*err = nfs_reply_error(rpc);
+	return *err ? NULL : rpc;
 }
+
 /***************************************************************************
  * NFS_READLINK (AH 2003-07-14)
  * This procedure is called when read of the first block fails -
@@ -300,186 +407,398 @@ void nfs_umountall(int server)
  * In case of successful readlink(), the dirname is manipulated,
  * so that inside the nfs() function a recursion can be done.
  **************************************************************************/
-static int nfs_readlink(int server, int port, char *fh, char *path, char *nfh,
-	int sport)
+static int nfs_readlink(int server, int port, char *path,
+	const struct nfs_fh *nfh, int sport)
 {
 	struct rpc_t buf, *rpc;
-	unsigned long id;
+	uint32_t *r;
+	char *link;
+	int linklen, err;
 	long *p;
-	int retries;
 	int pathlen = strlen(path);
 
-	(void)fh;
-	id = rpc_id++;
-	buf.u.call.id = htonl(id);
-	buf.u.call.type = htonl(MSG_CALL);
-	buf.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
-	buf.u.call.prog = htonl(PROG_NFS);
-	buf.u.call.vers = htonl(2);	/* nfsd is version 2 */
-	buf.u.call.proc = htonl(NFS_READLINK);
-	p = rpc_add_credentials((long *)buf.u.call.data);
-	memcpy(p, nfh, NFS_FHSIZE);
-	p += (NFS_FHSIZE / 4);
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		udp_transmit(arptable[server].ipaddr.s_addr, sport, port,
-			(char *)p - (char *)&buf, &buf);
-		if (await_reply(await_rpc, sport, &id, timeout)) {
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
-				rpc_printerror(rpc);
-				if (rpc->u.reply.rstatus) {
-					/* RPC failed, no verifier, data[0] */
-					return -9999;
-				}
-				if (rpc->u.reply.astatus) {
-					/* RPC couldn't decode parameters */
-					return -9998;
-				}
-				return -ntohl(rpc->u.reply.data[0]);
-			} else {
-				// It *is* a link.
-				// If it's a relative link, append everything to dirname, filename TOO!
-				retries = strlen ( (char *)(&(rpc->u.reply.data[2]) ));
-				if ( *((char *)(&(rpc->u.reply.data[2]))) != '/' ) {
-					path[pathlen++] = '/';
-					while ( ( retries + pathlen ) > 298 ) {
-						retries--;
-					}
-					if ( retries > 0 ) {
-						memcpy(path + pathlen, &(rpc->u.reply.data[2]), retries + 1);
-					} else { retries = 0; }
-					path[pathlen + retries] = 0;
-				} else {
-					// Else make it the only path.
-					if ( retries > 298 ) { retries = 298; }
-					memcpy ( path, &(rpc->u.reply.data[2]), retries + 1 );
-					path[retries] = 0;
-				}
-				return 0;
-			}
+	p = nfs_call(&buf, rpc_id++, NFS_READLINK);
+	p = nfs_add_fh(p, nfh);
+	rpc = nfs_transact(server, port, &buf, p, sport, &err);
+	if (!rpc)
+		return err;
+
+	// It *is* a link.
+	r = rpc->u.reply.data + 1;
+	if (nfs_vers == 3)
+		r = nfs3_get_attr(r, NULL);
+	linklen = ntohl(*r++);
+	link = (char *)r;
+	// If it's a relative link, append everything to dirname, filename TOO!
+	if ( *link != '/' ) {
+		path[pathlen++] = '/';
+		if ( linklen + pathlen > 298 ) {
+			linklen = 298 - pathlen;
 		}
+		if ( linklen < 0 ) { linklen = 0; }
+		memcpy(path + pathlen, link, linklen);
+		path[pathlen + linklen] = 0;
+	} else {
+		// Else make it the only path.
+		if ( linklen > 298 ) { linklen = 298; }
+		memcpy ( path, link, linklen );
+		path[linklen] = 0;
 	}
-	return -1;
+	return 0;
 }
+
 /**************************************************************************
 NFS_LOOKUP - Lookup Pathname
 **************************************************************************/
-static int nfs_lookup(int server, int port, char *fh, char *path, char *nfh,
-	int sport)
+static int nfs_lookup(int server, int port, const struct nfs_fh *fh,
+	char *path, struct nfs_fh *nfh, uint64_t *size, int sport)
 {
 	struct rpc_t buf, *rpc;
-	unsigned long id;
+	uint32_t *r;
 	long *p;
-	int retries;
+	int err;
 	int pathlen = strlen(path);
 
-	id = rpc_id++;
-	buf.u.call.id = htonl(id);
-	buf.u.call.type = htonl(MSG_CALL);
-	buf.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
-	buf.u.call.prog = htonl(PROG_NFS);
-	buf.u.call.vers = htonl(2);	/* nfsd is version 2 */
-	buf.u.call.proc = htonl(NFS_LOOKUP);
-	p = rpc_add_credentials((long *)buf.u.call.data);
-	memcpy(p, fh, NFS_FHSIZE);
-	p += (NFS_FHSIZE / 4);
+	p = nfs_call(&buf, rpc_id++,
+		nfs_vers == 3 ? NFS3_LOOKUP : NFS_LOOKUP);
+	p = nfs_add_fh(p, fh);
 	*p++ = htonl(pathlen);
 	if (pathlen & 3) {
 		*(p + pathlen / 4) = 0;	/* add zero padding */
 	}
 	memcpy(p, path, pathlen);
 	p += (pathlen + 3) / 4;
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		udp_transmit(arptable[server].ipaddr.s_addr, sport, port,
-			(char *)p - (char *)&buf, &buf);
-		if (await_reply(await_rpc, sport, &id, timeout)) {
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
-				rpc_printerror(rpc);
-				if (rpc->u.reply.rstatus) {
-					/* RPC failed, no verifier, data[0] */
-					return -9999;
-				}
-				if (rpc->u.reply.astatus) {
-					/* RPC couldn't decode parameters */
-					return -9998;
-				}
-				return -ntohl(rpc->u.reply.data[0]);
-			} else {
-				memcpy(nfh, rpc->u.reply.data + 1, NFS_FHSIZE);
-				return 0;
-			}
-		}
+	rpc = nfs_transact(server, port, &buf, p, sport, &err);
+	if (!rpc)
+		return err;
+	r = nfs_get_fh(rpc->u.reply.data + 1, nfh);
+	if (nfs_vers == 3)
+		nfs3_get_attr(r, size);
+	else
+		*size = ntohl(r[5]);
+	return 0;
+}
+
+/**************************************************************************
+NFS3_FSINFO - Find out the read size the server prefers
+**************************************************************************/
+static int nfs3_fsinfo(int server, int port, const struct nfs_fh *fh,
+	int sport)
+{
+	struct rpc_t buf, *rpc;
+	uint32_t *r;
+	long *p;
+	int err, rsize;
+	unsigned long rtmax, rtmult;
+
+	p = nfs_call(&buf, rpc_id++, NFS3_FSINFO);
+	p = nfs_add_fh(p, fh);
+	rpc = nfs_transact(server, port, &buf, p, sport, &err);
+	if (!rpc)
+		return NFS_READ_SIZE;
+	r = nfs3_get_attr(rpc->u.reply.data + 1, NULL);
+	rtmax = ntohl(r[0]);
+	rtmult = ntohl(r[2]);
+	/* A reply must still fit into a single frame */
+	rsize = NFS3_READ_SIZE;
+	if (rtmax && rtmax < (unsigned long)rsize)
+		rsize = rtmax;
+	if (rtmult && rtmult <= (unsigned long)rsize)
+		rsize -= rsize % rtmult;
+	return rsize;
+}
+
+/**************************************************************************
+NFS_READ_CALL - Build the RPC call for a READ of len bytes at offset
+**************************************************************************/
+static long *nfs_read_call(struct rpc_t *buf, unsigned long id,
+	const struct nfs_fh *fh, uint64_t offset, int len)
+{
+	long *p;
+
+	p = nfs_call(buf, id, NFS_READ);
+	p = nfs_add_fh(p, fh);
+	if (nfs_vers == 3) {
+		*p++ = htonl(offset >> 32);
+		*p++ = htonl(offset);
+		*p++ = htonl(len);
+	} else {
+		*p++ = htonl(offset);
+		*p++ = htonl(len);
+		*p++ = 0;		/* unused parameter */
 	}
-	return -1;
+	return p;
+}
+
+/**************************************************************************
+NFS_READ_DATA - Locate the data in a READ reply
+**************************************************************************/
+static unsigned char *nfs_read_data(struct rpc_t *rpc, int *rlen,
+	uint64_t *size)
+{
+	uint32_t *r = rpc->u.reply.data + 1;
+
+	if (nfs_vers == 3) {
+		r = nfs3_get_attr(r, size);
+		r += 2;			/* count, eof */
+	} else {
+		if (size)
+			*size = ntohl(r[5]);
+		r += NFS_FATTR_WORDS;
+	}
+	*rlen = ntohl(*r++);
+	return (unsigned char *)r;
 }
 
 /**************************************************************************
 NFS_READ - Read File on NFS Server
 **************************************************************************/
-static int nfs_read(int server, int port, char *fh, int offset, int len,
-		    int sport)
+static int nfs_read(int server, int port, const struct nfs_fh *fh,
+	uint64_t offset, int len, int sport)
 {
-	struct rpc_t buf, *rpc;
+	struct rpc_t buf;
+	long *p;
+	int err;
+
+	p = nfs_read_call(&buf, rpc_id++, fh, offset, len);
+	nfs_transact(server, port, &buf, p, sport, &err);
+	return err;
+}
+
+/* State of the pipelined reader.  Requests occupy a ring of slots in
+ * file order; head is the oldest request whose data has not yet been
+ * handed to the loader.  Replies that arrive ahead of the head go
+ * straight to their load address if the loader can say where that is,
+ * or are kept in the slot's buffer until everything in front of them
+ * has arrived.  */
+struct nfs_read_slot {
 	unsigned long id;
+	uint64_t offs;
+	int len;
+	int rlen;		/* -1 while the request is outstanding */
+	int placed;		/* data already went through load_at() */
 	int retries;
+	unsigned long sent;
+	unsigned long deadline;
+};
+
+struct nfs_pipe {
+	int server, port, sport;
+	const struct nfs_fh *fh;
+	uint64_t size;		/* file size */
+	uint64_t next_offs;	/* offset of the next request to send */
+	int rsize;		/* bytes per READ */
+	int head, used;		/* ring of outstanding/buffered slots */
+	int window, max_window, replies;
+	int hit;		/* slot matched by await_rpc_read() */
+	unsigned int block;
+	int (*fnc)(unsigned char *, unsigned int, unsigned int, int);
+	unsigned char *data;	/* max_window buffers of rsize bytes */
+	struct nfs_read_slot slot[NFS_READ_WINDOW];
+};
+/**************************************************************************
+AWAIT_RPC_READ - Wait for the reply to any outstanding READ request
+**************************************************************************/
+static int await_rpc_read(int ival, void *ptr,
+	unsigned short ptype, struct iphdr *ip, struct udphdr *udp, struct tcphdr *tcp)
+{
+	struct nfs_pipe *pipe = ptr;
+	struct rpc_t *rpc;
+	unsigned long id;
+	int i;
+
+	(void)ptype;
+	(void)tcp;
+
+	if (!udp)
+		return 0;
+	if (arptable[ARP_CLIENT].ipaddr.s_addr != ip->dest.s_addr)
+		return 0;
+	if (ntohs(udp->dest) != ival)
+		return 0;
+	if (nic.packetlen < ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr) + 8)
+		return 0;
+	rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
+	if (MSG_REPLY != ntohl(rpc->u.reply.type))
+		return 0;
+	id = ntohl(rpc->u.reply.id);
+	for (i = 0; i < pipe->used; i++) {
+		int n = (pipe->head + i) % pipe->max_window;
+		if (pipe->slot[n].rlen < 0 && pipe->slot[n].id == id) {
+			pipe->hit = n;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**************************************************************************
+NFS_PIPE_SEND - (Re)transmit the READ request held in a slot
+**************************************************************************/
+static void nfs_pipe_send(struct nfs_pipe *pipe, struct nfs_read_slot *s)
+{
+	struct rpc_t buf;
 	long *p;
 
-	static int tokens=0;
-	/*
-	 * Try to implement something similar to a window protocol in
-	 * terms of response to losses. On successful receive, increment
-	 * the number of tokens by 1 (cap at 256). On failure, halve it.
-	 * When the number of tokens is >= 2, use a very short timeout.
-	 */
+	p = nfs_read_call(&buf, s->id, pipe->fh, s->offs, s->len);
+	udp_transmit(arptable[pipe->server].ipaddr.s_addr, pipe->sport,
+		pipe->port, (char *)p - (char *)&buf, &buf);
+	s->sent = currticks();
+	s->deadline = s->sent + rtt_timeout(&rpc_rtt);
+}
 
-	id = rpc_id++;
-	buf.u.call.id = htonl(id);
-	buf.u.call.type = htonl(MSG_CALL);
-	buf.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
-	buf.u.call.prog = htonl(PROG_NFS);
-	buf.u.call.vers = htonl(2);	/* nfsd is version 2 */
-	buf.u.call.proc = htonl(NFS_READ);
-	p = rpc_add_credentials((long *)buf.u.call.data);
-	memcpy(p, fh, NFS_FHSIZE);
-	p += NFS_FHSIZE / 4;
-	*p++ = htonl(offset);
-	*p++ = htonl(len);
-	*p++ = 0;		/* unused parameter */
-	for (retries = 0; retries < MAX_RPC_RETRIES; retries++) {
-		long timeout = rfc2131_sleep_interval(TIMEOUT, retries);
-		if (tokens >= 2)
-			timeout = TICKS_PER_SEC/2;
+/**************************************************************************
+NFS_PIPE_QUEUE - Put a new READ request for offs/len into a slot
+**************************************************************************/
+static void nfs_pipe_queue(struct nfs_pipe *pipe, struct nfs_read_slot *s,
+	uint64_t offs, int len)
+{
+	s->id = rpc_id++;
+	s->offs = offs;
+	s->len = len;
+	s->rlen = -1;
+	s->placed = 0;
+	s->retries = 0;
+	nfs_pipe_send(pipe, s);
+}
 
-		udp_transmit(arptable[server].ipaddr.s_addr, sport, port,
-			(char *)p - (char *)&buf, &buf);
-		if (await_reply(await_rpc, sport, &id, timeout)) {
-			if (tokens < 256)
-				tokens++;
-			rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
-			if (rpc->u.reply.rstatus || rpc->u.reply.verifier ||
-			    rpc->u.reply.astatus || rpc->u.reply.data[0]) {
-				rpc_printerror(rpc);
-				if (rpc->u.reply.rstatus) {
-					/* RPC failed, no verifier, data[0] */
-					return -9999;
-				}
-				if (rpc->u.reply.astatus) {
-					/* RPC couldn't decode parameters */
-					return -9998;
+/**************************************************************************
+NFS_PIPE_DRAIN - Pass the data at the head of the ring to the loader
+**************************************************************************/
+static int nfs_pipe_drain(struct nfs_pipe *pipe, unsigned char *data)
+{
+	int err;
+
+	while (pipe->used) {
+		struct nfs_read_slot *s = &pipe->slot[pipe->head];
+		uint64_t end;
+
+		if (s->rlen < 0)
+			break;
+		if (!data && !s->placed)
+			data = pipe->data + pipe->head * pipe->rsize;
+		end = s->offs + s->rlen;
+		if (s->rlen == 0 && end != pipe->size) {
+			printf("\nUnexpected end of file at offset %#x%x\n",
+				(unsigned int)(end >> 32), (unsigned int)end);
+			return 0;
+		}
+		err = pipe->fnc(data, ++pipe->block, s->rlen,
+			(end == pipe->size));
+		if (err <= 0)
+			return err;
+		data = NULL;
+		if (s->rlen < s->len) {
+			/* Short read, ask again for the rest */
+			nfs_pipe_queue(pipe, s, end, s->len - s->rlen);
+			break;
+		}
+		pipe->head = (pipe->head + 1) % pipe->max_window;
+		pipe->used--;
+	}
+	return 1;
+}
+
+/**************************************************************************
+NFS_PIPE_READ - Read the rest of a file with several requests in flight
+**************************************************************************/
+static int nfs_pipe_read(struct nfs_pipe *pipe)
+{
+	struct rpc_t *rpc;
+	struct nfs_read_slot *s;
+	unsigned char *data;
+	int err, i;
+
+	for (;;) {
+		long timeout;
+		unsigned long now;
+
+		/* Fill the window */
+		while (pipe->used < pipe->window && pipe->next_offs < pipe->size) {
+			int len = pipe->rsize;
+			if (pipe->size - pipe->next_offs < (uint64_t)len)
+				len = pipe->size - pipe->next_offs;
+			s = &pipe->slot[(pipe->head + pipe->used) % pipe->max_window];
+			nfs_pipe_queue(pipe, s, pipe->next_offs, len);
+			pipe->next_offs += len;
+			pipe->used++;
+		}
+		if (!pipe->used)
+			return 1;
+
+		/* Wait no longer than the earliest retransmission deadline */
+		now = currticks();
+		timeout = 0;
+		for (i = 0; i < pipe->used; i++) {
+			s = &pipe->slot[(pipe->head + i) % pipe->max_window];
+			if (s->rlen < 0 &&
+			    (!timeout || (long)(s->deadline - now) < timeout))
+				timeout = s->deadline - now;
+		}
+		if (timeout < 1)
+			timeout = 1;
+
+		if (!await_reply(await_rpc_read, pipe->sport, pipe, timeout)) {
+			/* Loss: shrink the window, back off once for the
+			 * whole window and resend what is overdue */
+			pipe->window = (pipe->window + 1) / 2;
+			pipe->replies = 0;
+			rtt_backoff(&rpc_rtt);
+			now = currticks();
+			for (i = 0; i < pipe->used; i++) {
+				s = &pipe->slot[(pipe->head + i) % pipe->max_window];
+				if (s->rlen >= 0 || (long)(s->deadline - now) > 0)
+					continue;
+				if (++s->retries >= MAX_RPC_RETRIES) {
+					printf("\nError reading at offset %#x%x: ",
+						(unsigned int)(s->offs >> 32),
+						(unsigned int)s->offs);
+					nfs_printerror(-1);
+					return 0;
 				}
-				return -ntohl(rpc->u.reply.data[0]);
-			} else {
-				return 0;
+				nfs_pipe_send(pipe, s);
 			}
-		} else
-			tokens >>= 1;
+			continue;
+		}
+
+		rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
+		s = &pipe->slot[pipe->hit];
+		err = nfs_reply_error(rpc);
+		if (err) {
+			printf("\nError reading at offset %#x%x: ",
+				(unsigned int)(s->offs >> 32),
+				(unsigned int)s->offs);
+			nfs_printerror(err);
+			return 0;
+		}
+		if (!s->retries)
+			rtt_sample(&rpc_rtt, s->sent);
+		data = nfs_read_data(rpc, &s->rlen, NULL);
+		if (s->rlen > s->len)
+			s->rlen = s->len;	/* shouldn't happen...  */
+
+		if (++pipe->replies >= pipe->window &&
+		    pipe->window < pipe->max_window) {
+			pipe->window++;
+			pipe->replies = 0;
+		}
+
+		if (pipe->hit == pipe->head) {
+			/* In order: hand it over straight from the packet */
+			err = nfs_pipe_drain(pipe, data);
+		} else if ((pipe->fnc == load_block) &&
+			   (s->offs < ULONG_MAX) &&
+			   (load_at(s->offs, data, s->rlen) > 0)) {
+			s->placed = 1;
+			err = 1;
+		} else {
+			memcpy(pipe->data + pipe->hit * pipe->rsize,
+				data, s->rlen);
+			err = 1;
+		}
+		if (err <= 0)
+			return err;
 	}
-	return -1;
 }
 
 /**************************************************************************
@@ -491,11 +810,12 @@ int nfs(const char *name, int (*fnc)(unsigned char *, unsigned int, unsigned int
 	int sport;
 	int err, namelen = strlen(name);
 	char dirname[300], *fname;
-	char dirfh[NFS_FHSIZE];		/* file handle of directory */
-	char filefh[NFS_FHSIZE];	/* file handle of kernel image */
-	unsigned int block;
-	int rlen, size, offs, len;
-	struct rpc_t *rpc;
+	struct nfs_fh dirfh;		/* file handle of directory */
+	struct nfs_fh filefh;		/* file handle of kernel image */
+	int rlen, len;
+	uint64_t size;
+	unsigned char *data;
+	struct nfs_pipe pipe;
 
 	rx_qdrain();
 
@@ -527,19 +847,27 @@ nfssymlink:
 		return 0;
 	}
 
-	if (mount_port == -1) {
-		mount_port = rpc_lookup(ARP_SERVER, PROG_MOUNT, 1, sport);
-	}
-	if (nfs_port == -1) {
-		nfs_port = rpc_lookup(ARP_SERVER, PROG_NFS, 2, sport);
+	if (mount_port <= 0 || nfs_port <= 0) {
+		/* Prefer NFSv3, fall back to NFSv2 if the server lacks it.
+		 * The portmapper answers port 0 for unregistered versions. */
+		nfs_vers = 3;
+		mount_port = rpc_lookup(ARP_SERVER, PROG_MOUNT, 3, sport);
+		if (mount_port != -1)
+			nfs_port = rpc_lookup(ARP_SERVER, PROG_NFS, 3, sport);
+		if (mount_port == 0 || nfs_port == 0) {
+			nfs_vers = 2;
+			mount_port = rpc_lookup(ARP_SERVER, PROG_MOUNT, 1, sport);
+			nfs_port = rpc_lookup(ARP_SERVER, PROG_NFS, 2, sport);
+		}
 	}
-	if (nfs_port == -1 || mount_port == -1) {
+	if (nfs_port <= 0 || mount_port <= 0) {
 		printf("\nError: can't get nfs/mount ports from portmapper\n");
+		mount_port = nfs_port = -1;
 		return 0;
 	}
 
 
-	err = nfs_mount(ARP_SERVER, mount_port, dirname, dirfh, sport);
+	err = nfs_mount(ARP_SERVER, mount_port, dirname, &dirfh, sport);
 	if (err) {
 		printf("\nError mounting %s: ", dirname);
 		nfs_printerror(err);
@@ -548,7 +876,9 @@ nfssymlink:
 		return 0;
 	}
 
-	err = nfs_lookup(ARP_SERVER, nfs_port, dirfh, fname, filefh, sport);
+	size = 0;
+	err = nfs_lookup(ARP_SERVER, nfs_port, &dirfh, fname, &filefh, &size,
+		sport);
 	if (err) {
 		printf("\nError looking up %s: ", fname);
 		nfs_printerror(err);
@@ -556,60 +886,82 @@ nfssymlink:
 		return 0;
 	}
 
-	offs = 0;
-	block = 1;	/* blocks are numbered starting from 1 */
-	size = -1;	/* will be set properly with the first reply */
-	len = NFS_READ_SIZE;	/* first request is always full size */
-	do {
-		err = nfs_read(ARP_SERVER, nfs_port, filefh, offs, len, sport);
-                if ((err <= -NFSERR_ISDIR)&&(err >= -NFSERR_INVAL) && (offs == 0)) {
-			// An error occured. NFS servers tend to sending
-			// errors 21 / 22 when symlink instead of real file
-			// is requested. So check if it's a symlink!
-			block = nfs_readlink(ARP_SERVER, nfs_port, dirfh, dirname,
-			                filefh, sport);
-			if ( 0 == block ) {
-				printf("\nLoading symlink:%s ..",dirname);
-				goto nfssymlink;
-			}
-			nfs_printerror(err);
-			nfs_umountall(ARP_SERVER);
-			return 0;
-		}
-		if (err) {
-			printf("\nError reading at offset %d: ", offs);
-			nfs_printerror(err);
-			nfs_umountall(ARP_SERVER);
-			return 0;
-		}
-
-		rpc = (struct rpc_t *)&nic.packet[ETH_HLEN];
+	len = NFS_READ_SIZE;
+	if (nfs_vers == 3) {
+		len = nfs3_fsinfo(ARP_SERVER, nfs_port, &dirfh, sport);
+	}
 
-		/* size must be found out early to allow EOF detection */
-		if (size == -1) {
-			size = ntohl(rpc->u.reply.data[6]);
-		}
-		rlen = ntohl(rpc->u.reply.data[18]);
-		if (rlen > len) {
-			rlen = len;	/* shouldn't happen...  */
+	/* The first block is read on its own: it tells us the file size,
+	 * and a failure here may mean that the name is a symlink. */
+	err = nfs_read(ARP_SERVER, nfs_port, &filefh, 0, len, sport);
+	if ((err <= -NFSERR_ISDIR)&&(err >= -NFSERR_INVAL)) {
+		// An error occured. NFS servers tend to sending
+		// errors 21 / 22 when symlink instead of real file
+		// is requested. So check if it's a symlink!
+		err = nfs_readlink(ARP_SERVER, nfs_port, dirname, &filefh,
+			sport);
+		if ( 0 == err ) {
+			printf("\nLoading symlink:%s ..",dirname);
+			goto nfssymlink;
 		}
+		nfs_printerror(err);
+		nfs_umountall(ARP_SERVER);
+		return 0;
+	}
+	if (err) {
+		printf("\nError reading at offset 0: ");
+		nfs_printerror(err);
+		nfs_umountall(ARP_SERVER);
+		return 0;
+	}
 
-		err = fnc((char *)&rpc->u.reply.data[19], block, rlen,
-			(offs+rlen == size));
-		if (err <= 0) {
-			nfs_umountall(ARP_SERVER);
-			return err;
-		}
+	/* size must be found out early to allow EOF detection */
+	data = nfs_read_data((struct rpc_t *)&nic.packet[ETH_HLEN], &rlen,
+		&size);
+	if (rlen > len) {
+		rlen = len;	/* shouldn't happen...  */
+	}
+	/* The window buffers come off the heap, so take them before the
+	 * loader sees the first block and places segments around it */
+	pipe.data = NULL;
+	if ((uint64_t)rlen != size) {
+		pipe.data = allot(NFS_READ_WINDOW * len);
+	}
+	err = fnc(data, 1, rlen, ((uint64_t)rlen == size));
+	if (err <= 0) {
+		forget(pipe.data);
+		nfs_umountall(ARP_SERVER);
+		return err;
+	}
+	if ((uint64_t)rlen == size) {
+		return 1;
+	}
 
-		block++;
-		offs += rlen;
-		/* last request is done with matching requested read size */
-		if (size-offs < NFS_READ_SIZE) {
-			len = size-offs;
-		}
-	} while (len != 0);
-	/* len == 0 means that all the file has been read */
-	return 1;
+	/* Fetch the rest with several READs outstanding */
+	pipe.server = ARP_SERVER;
+	pipe.port = nfs_port;
+	pipe.sport = sport;
+	pipe.fh = &filefh;
+	pipe.size = size;
+	pipe.next_offs = rlen;
+	pipe.rsize = len;
+	pipe.head = pipe.used = 0;
+	pipe.hit = 0;
+	pipe.replies = 0;
+	pipe.block = 1;
+	pipe.fnc = fnc;
+	pipe.max_window = NFS_READ_WINDOW;
+	if (!pipe.data) {
+		/* Without buffers replies must arrive in order */
+		pipe.max_window = 1;
+	}
+	pipe.window = pipe.max_window < 2 ? pipe.max_window : 2;
+	err = nfs_pipe_read(&pipe);
+	forget(pipe.data);
+	if (err <= 0) {
+		nfs_umountall(ARP_SERVER);
+	}
+	return err;
 }
 
 #endif	/* DOWNLOAD_PROTO_NFS */
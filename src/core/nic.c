@@ -6,9 +6,11 @@ Literature dealing with the network protocols:
 	RARP - RFC903
 	IP - RFC791
 	UDP - RFC768
+	TCP - RFC793, RFC1122, RFC1323 (window scale), RFC2581 (delayed ACK)
 	BOOTP - RFC951, RFC2132 (vendor extensions)
 	DHCP - RFC2131, RFC2132, RFC3004 (options)
-	TFTP - RFC1350, RFC2347 (options), RFC2348 (blocksize), RFC2349 (tsize)
+	TFTP - RFC1350, RFC2347 (options), RFC2348 (blocksize), RFC2349 (tsize),
+		RFC7440 (windowsize)
 	RPC - RFC1831, RFC1832 (XDR), RFC1833 (rpcbind/portmapper)
 	NFS - RFC1094, RFC1813 (v3, useful for clarifications, not implemented)
 	IGMP - RFC1112, RFC2113, RFC2365, RFC2236, RFC3171
@@ -26,6 +28,9 @@ struct igmptable_t	igmptable[MAX_IGMP];
 /* Put rom_info in .nocompress section so romprefix.S can write to it */
 struct rom_info	rom __attribute__ ((section (".text16.nocompress"))) = {0,0};
 static unsigned long	netmask;
+#ifdef	NO_DHCP_SUPPORT
+#undef	DHCP_SELECT	/* There are no offers to choose from */
+#endif
 /* Used by nfs.c */
 char *hostname = "";
 int hostnamelen = 0;
@@ -118,9 +123,15 @@ static const unsigned char dhcpdiscover[] = {
 #else
 #define DHCPDISCOVER_PARAMS_DNS		0
 #endif /* DNS_RESOLVER */
+#ifdef	DHCP_SELECT
+#define DHCPDISCOVER_PARAMS_SELECT	1
+#else
+#define DHCPDISCOVER_PARAMS_SELECT	0
+#endif /* DHCP_SELECT */
 	( DHCPDISCOVER_PARAMS_BASE +
 	  DHCPDISCOVER_PARAMS_PXE+
-	  DHCPDISCOVER_PARAMS_DNS ),
+	  DHCPDISCOVER_PARAMS_DNS +
+	  DHCPDISCOVER_PARAMS_SELECT ),
 	RFC1533_NETMASK,
 	RFC1533_GATEWAY,
 	RFC1533_HOSTNAME,
@@ -139,6 +150,9 @@ static const unsigned char dhcpdiscover[] = {
 #ifdef	DNS_RESOLVER
 	,RFC1533_DNS
 #endif
+#ifdef	DHCP_SELECT
+	,RFC1533_VENDOR_ETHERBOOT_ENCAP	/* for the server load hint */
+#endif
 };
 static const unsigned char dhcprequest [] = {
 	RFC2132_MSG_TYPE,1,DHCPREQUEST,
@@ -300,8 +314,57 @@ struct nic	nic =
 	0,					/* ioaddr */
 	0,					/* irqno */
 	0,					/* priv_data */
+	0,					/* rx_release */
+	0,					/* tx_queue */
+	0,					/* tx_kick */
+	0,					/* tx_reap */
 };
 
+/* Copy buffer saved while nic.packet points into the driver's ring */
+static unsigned char *rx_held;
+
+#ifdef PACKET_STATS
+struct packet_stats packet_stats;
+
+void packet_stats_reset(void)
+{
+	memset(&packet_stats, 0, sizeof(packet_stats));
+	packet_stats.start = currticks();
+}
+
+/* Per second rate of count over ticks, without overflowing 32 bits */
+static unsigned long packet_stats_rate(unsigned long count,
+	unsigned long ticks)
+{
+	if (count < ULONG_MAX / TICKS_PER_SEC)
+		return count * TICKS_PER_SEC / ticks;
+	return count / ticks * TICKS_PER_SEC;
+}
+
+void packet_stats_print(void)
+{
+	unsigned long ticks = currticks() - packet_stats.start;
+
+	if (!ticks)
+		ticks = 1;
+	printf("\nrx %d pkts %d bytes, tx %d pkts %d bytes in %d ticks\n",
+		packet_stats.rx_packets, packet_stats.rx_bytes,
+		packet_stats.tx_packets, packet_stats.tx_bytes, ticks);
+	printf("%d pkts/s %d bytes/s, %d bytes copied\n",
+		packet_stats_rate(packet_stats.rx_packets + packet_stats.tx_packets,
+			ticks),
+		packet_stats_rate(packet_stats.rx_bytes, ticks),
+		packet_stats.copied);
+#ifdef HAVE_ARCH_CYCLES
+	printf("checksummed %d bytes in %d Kcycles\n",
+		packet_stats.chksum_bytes,
+		(unsigned long)(packet_stats.chksum_cycles >> 10));
+#else
+	printf("checksummed %d bytes\n", packet_stats.chksum_bytes);
+#endif
+}
+#endif	/* PACKET_STATS */
+
 #ifdef RARP_NOT_BOOTP
 static int rarp(void);
 #else
@@ -316,20 +379,131 @@ static unsigned short tcpudpchksum(struct iphdr *ip);
 
 int eth_probe(struct dev *dev)
 {
+	eth_rx_release();
+	nic.rx_release = 0;
+	nic.tx_queue = 0;
+	nic.tx_kick = 0;
+	nic.tx_reap = 0;
 	return probe(dev);
 }
 
 int eth_poll(int retrieve)
 {
-	return ((*nic.poll)(&nic, retrieve));
+	unsigned char *buf;
+	int result;
+
+	/* The previous frame is done with once we look for the next one */
+	eth_rx_release();
+	if (nic.tx_reap) {
+		(*nic.tx_reap)(&nic);
+	}
+	buf = nic.packet;
+	result = (*nic.poll)(&nic, retrieve);
+	if (nic.packet != buf) {
+		rx_held = buf;
+	}
+#ifdef BOOT_TRACE
+	if (result && retrieve) {
+		boot_trace_data.rx_packets++;
+		boot_trace_data.rx_bytes += nic.packetlen;
+	}
+#endif
+#ifdef PACKET_STATS
+	if (result && retrieve) {
+		packet_stats.rx_packets++;
+		packet_stats.rx_bytes += nic.packetlen;
+		if (!rx_held)
+			packet_stats.copied += nic.packetlen;
+	}
+#endif
+	return result;
+}
+
+void eth_rx_release(void)
+{
+	if (rx_held) {
+		(*nic.rx_release)(&nic);
+		nic.packet = rx_held;
+		rx_held = 0;
+	}
+}
+
+/*
+ * Wait for frames in flight on an asynchronous transmit ring, until at
+ * most left remain.  A card that makes no progress for TX_TIMEOUT is
+ * given up on.
+ */
+#define TX_TIMEOUT	(5*TICKS_PER_SEC)
+static int eth_tx_wait(int left)
+{
+	unsigned long timeout = currticks() + TX_TIMEOUT;
+	int pending, last;
+
+	if (left < 0)
+		left = 0;
+	last = -1;
+	while ((pending = (*nic.tx_reap)(&nic)) > left) {
+		if (pending != last) {
+			last = pending;
+			timeout = currticks() + TX_TIMEOUT;
+		} else if ((long)(currticks() - timeout) > 0) {
+			printf("transmit timed out\n");
+			return 0;
+		}
+		poll_interruptions();
+	}
+	return 1;
 }
 
 void eth_transmit(const char *d, unsigned int t, unsigned int s, const void *p)
 {
+	if (nic.tx_queue) {
+		eth_transmit_queue(d, t, s, p);
+		eth_transmit_flush();
+		return;
+	}
+#ifdef PACKET_STATS
+	/* Nearly all drivers copy the frame into a transmit buffer */
+	packet_stats.tx_packets++;
+	packet_stats.tx_bytes += s;
+	packet_stats.copied += s;
+#endif
 	(*nic.transmit)(&nic, d, t, s, p);
 	if (t == ETH_P_IP) twiddle();
 }
 
+/*
+ * Queue a frame without waiting for the card, eth_transmit_flush() sends
+ * everything queued.  As the frame is copied, p may be reused at once.
+ * Drivers without a transmit ring send the frame straight away.
+ */
+void eth_transmit_queue(const char *d, unsigned int t, unsigned int s, const void *p)
+{
+#ifdef PACKET_STATS
+	packet_stats.tx_packets++;
+	packet_stats.tx_bytes += s;
+	packet_stats.copied += s;
+#endif
+	if (!nic.tx_queue) {
+		(*nic.transmit)(&nic, d, t, s, p);
+	} else {
+		while (!(*nic.tx_queue)(&nic, d, t, s, p)) {
+			/* Ring full, push out what we have and make room */
+			(*nic.tx_kick)(&nic);
+			if (!eth_tx_wait((*nic.tx_reap)(&nic) - 1))
+				return;
+		}
+	}
+	if (t == ETH_P_IP) twiddle();
+}
+
+void eth_transmit_flush(void)
+{
+	if (nic.tx_kick) {
+		(*nic.tx_kick)(&nic);
+	}
+}
+
 void eth_disable(void)
 {
 #ifdef MULTICAST_LEVEL2
@@ -338,6 +512,12 @@ void eth_disable(void)
 		leave_group(i);
 	}
 #endif
+	eth_rx_release();
+	if (nic.tx_queue) {
+		/* Let the last frames, like a DHCP release, go out */
+		eth_transmit_flush();
+		eth_tx_wait(0);
+	}
 	disable(&nic.dev);
 }
 
@@ -390,6 +570,9 @@ LOAD - Try to get booted
 int eth_load(struct dev *dev __unused)
 {
 	char	*kernel;
+#ifdef PACKET_STATS
+	packet_stats_reset();
+#endif
 	printf("\nMe: %@", arptable[ARP_CLIENT].ipaddr.s_addr );
 #ifndef USE_STATIC_BOOT_INFO
 #ifndef NO_DHCP_SUPPORT
@@ -511,6 +694,9 @@ int ip_transmit(int len, const void *buf)
 	struct arprequest arpreq;
 	int arpentry, i;
 	int retry;
+#ifdef BOOT_TRACE
+	int phase;
+#endif
 
 	ip = (struct iphdr *)buf;
 	destip = ip->dest.s_addr;
@@ -553,17 +739,23 @@ int ip_transmit(int len, const void *buf)
 			memcpy(arpreq.sipaddr, &arptable[ARP_CLIENT].ipaddr, sizeof(in_addr));
 			memset(arpreq.thwaddr, 0, ETH_ALEN);
 			memcpy(arpreq.tipaddr, &destip, sizeof(in_addr));
+#ifdef BOOT_TRACE
+			phase = boot_trace_enter(BT_ARP);
+#endif
 			for (retry = 1; retry <= MAX_ARP_RETRIES; retry++) {
 				long timeout;
 				eth_transmit(broadcast, ETH_P_ARP, sizeof(arpreq),
 					&arpreq);
 				timeout = rfc2131_sleep_interval(TIMEOUT, retry);
 				if (await_reply(await_arp, arpentry,
-					arpreq.tipaddr, timeout)) goto xmit;
+					arpreq.tipaddr, timeout)) break;
 			}
-			return(0);
+#ifdef BOOT_TRACE
+			boot_trace_leave(phase);
+#endif
+			if (retry > MAX_ARP_RETRIES)
+				return(0);
 		}
-xmit:
 		eth_transmit(arptable[arpentry].node, ETH_P_IP, len, buf);
 	}
 	return 1;
@@ -608,7 +800,8 @@ void build_udp_hdr(unsigned long destip,
 #ifdef DOWNLOAD_PROTO_HTTP
 void build_tcp_hdr(unsigned long destip, unsigned int srcsock,
 		  unsigned int destsock, long send_seq, long recv_seq,
-		  int window, int flags, int ttl, int len, const void *buf)
+		  int window, int flags, int ttl, int option_len, int len,
+		  const void *buf)
 {
 	struct iphdr *ip;
 	struct tcphdr *tcp;
@@ -619,7 +812,8 @@ void build_tcp_hdr(unsigned long destip, unsigned int srcsock,
 	tcp->dst = htons(destsock);
 	tcp->seq = htonl(send_seq);
 	tcp->ack = htonl(recv_seq);
-	tcp->ctrl = htons(flags + (5 << 12)); /* No TCP options */
+	/* Any options must already follow the header in buf */
+	tcp->ctrl = htons(flags + ((5 + option_len/4) << 12));
 	tcp->window = htons(window);
 	tcp->chksum = 0;
 	if ((tcp->chksum = tcpudpchksum(ip)) == 0)
@@ -648,7 +842,7 @@ int tcp_transmit(unsigned long destip, unsigned int srcsock,
 		int window, int flags, int len, const void *buf)
 {
 	build_tcp_hdr(destip, srcsock, destsock, send_seq, recv_seq,
-		      window, flags, 60, len, buf);
+		      window, flags, 60, 0, len, buf);
 	return ip_transmit(len, buf);
 }
 
@@ -716,7 +910,7 @@ int tftp ( const char *name,
 	   int (*fnc)(unsigned char *, unsigned int, unsigned int, int) )
 {
 	struct tftpreq_info_t request_data =
-		{ name, TFTP_PORT, TFTP_MAX_PACKET };
+		{ name, TFTP_PORT, TFTP_MAX_PACKET, TFTP_WINDOWSIZE };
 	struct tftpreq_info_t *request = &request_data;
 	struct tftpblk_info_t block;
 	int rc;
@@ -742,9 +936,16 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 	static struct tftpreq_t xmit;
 	static unsigned short xmitlen = 0;
 	static unsigned short blockidx = 0; /* Last block received */
+	static unsigned short lastack = 0; /* Last block acknowledged */
 	static unsigned short retry = 0; /* Retry attempts on last block */
 	static int blksize = 0;
+	static int windowsize = 1;
+	static int gap_acked = 0; /* Already asked for a resend */
+	static struct rtt_estimator rtt;
+	static unsigned long sent; /* When the last packet was sent... */
+	static int timing = 0; /* ...if it was sent only once */
 	unsigned short recvlen = 0;
+	int send_ack;
 
 	/* If this is a new request (i.e. if name is set), fill in
 	 * transmit block with RRQ and send it.
@@ -752,15 +953,27 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 	if ( request ) {
 		rx_qdrain(); /* Flush receive queue */
 		xmit.opcode = htons(TFTP_RRQ);
-		xmitlen = (void*)&xmit.u.rrq - (void*)&xmit +
-			sprintf((char*)xmit.u.rrq, "%s%coctet%cblksize%c%d",
-				request->name, 0, 0, 0, request->blksize)
+		xmitlen = sprintf((char*)xmit.u.rrq, "%s%coctet%cblksize%c%d",
+				  request->name, 0, 0, 0, request->blksize);
+		if ( request->windowsize > 1 ) {
+			xmitlen += 1 + sprintf((char*)xmit.u.rrq + xmitlen + 1,
+					       "windowsize%c%d",
+					       0, request->windowsize);
+		}
+		xmitlen += (void*)&xmit.u.rrq - (void*)&xmit
 			+ 1; /* null terminator */
 		blockidx = 0; /* Reset counters */
+		lastack = 0;
 		retry = 0;
 		blksize = TFTP_DEFAULTSIZE_PACKET;
+		windowsize = 1;
+		gap_acked = 0;
 		lport++; /* Use new local port */
 		rport = request->port;
+		rtt_server ( &rtt, arptable[ARP_SERVER].ipaddr.s_addr,
+			     RTT_INITIAL_TIMEOUT );
+		sent = currticks();
+		timing = 1;
 		if ( !udp_transmit(arptable[ARP_SERVER].ipaddr.s_addr, lport,
 				   rport, xmitlen, &xmit) )
 			return (0);
@@ -770,12 +983,19 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 	/* Loop to wait until we get a packet we're interested in */
 	block->data = NULL; /* Used as flag */
 	while ( block->data == NULL ) {
-		long timeout = rfc2131_sleep_interval ( blockidx ? TFTP_REXMT :
-							TIMEOUT, retry );
+		long timeout = rtt_timeout ( &rtt );
 		if ( !await_reply(await_tftp, lport, NULL, timeout) ) {
 			/* No packet received */
 			if ( retry++ > MAX_TFTP_RETRIES ) break;
-			/* Retransmit last packet */
+			rtt_backoff ( &rtt );
+			timing = 0; /* A reply could be to either copy */
+			/* Retransmit last packet.  If the tail of a window
+			 * was lost, acknowledge what we do have so that the
+			 * server resumes from there. */
+			if ( xmit.opcode == htons(TFTP_ACK) ) {
+				xmit.u.ack.block = htons(blockidx);
+				lastack = blockidx;
+			}
 			if ( !blockidx ) lport++; /* New lport if new RRQ */
 			if ( !udp_transmit(arptable[ARP_SERVER].ipaddr.s_addr,
 					   lport, rport, xmitlen, &xmit) )
@@ -788,6 +1008,7 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 			- sizeof(rcvd->opcode);
 		rport = ntohs(rcvd->udp.src);
 		retry = 0; /* Reset retry counter */
+		send_ack = 1;
 		switch ( htons(rcvd->opcode) ) {
 		case TFTP_ERROR : {
 			printf ( "TFTP error %d (%s)\n",
@@ -801,19 +1022,27 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 
 			*((char*)(p+recvlen-1)) = '\0'; /* Force final 0 */
 			if ( blockidx || !request ) break; /* Too late */
+			if ( timing ) rtt_sample ( &rtt, sent );
+			timing = 0;
 			if ( recvlen <= TFTP_MAX_PACKET ) /* sanity */ {
-				/* Check for blksize option honoured */
+				/* Check for blksize and windowsize honoured */
 				while ( p < e ) {
 					if ( strcasecmp("blksize",p) == 0 &&
 					     p[7] == '\0' ) {
 						blksize = strtoul(p+8,&p,10);
 						p++; /* skip null */
+					} else if ( strcasecmp("windowsize",p) == 0 &&
+						    p[10] == '\0' ) {
+						windowsize = strtoul(p+11,&p,10);
+						p++; /* skip null */
 					}
 					while ( *(p++) ) {};
 				}
 			}
-			if ( blksize < TFTP_DEFAULTSIZE_PACKET || blksize > request->blksize ) {
-				/* Incorrect blksize - error and abort */
+			if ( blksize < TFTP_DEFAULTSIZE_PACKET || blksize > request->blksize ||
+			     windowsize < 1 || ( windowsize > 1 &&
+						 windowsize > request->windowsize ) ) {
+				/* Incorrect option - error and abort */
 				xmit.opcode = htons(TFTP_ERROR);
 				xmit.u.err.errcode = 8;
 				xmitlen = (void*)&xmit.u.err.errmsg
@@ -828,28 +1057,50 @@ int tftp_block ( struct tftpreq_info_t *request, struct tftpblk_info_t *block )
 			}
 		} break;
 		case TFTP_DATA :
-			if ( ntohs(rcvd->u.data.block) != (unsigned short)( blockidx + 1 ) )
-				break; /* Re-ACK last block sent */
+			if ( ntohs(rcvd->u.data.block) != (unsigned short)( blockidx + 1 ) ) {
+				/* Duplicate or out of order block.  Re-ACK
+				 * the last block received in sequence, but
+				 * only once per gap so that the remainder of
+				 * the window does not cause an ACK storm. */
+				send_ack = !gap_acked;
+				gap_acked = 1;
+				break;
+			}
 			if ( recvlen > ( blksize+sizeof(rcvd->u.data.block) ) )
 				break; /* Too large; ignore */
+			/* Only the first block after an ACK times the
+			 * round trip, the rest of the window follows it */
+			if ( timing ) rtt_sample ( &rtt, sent );
+			timing = 0;
 			block->data = rcvd->u.data.download;
 			block->block = ++blockidx;
 			block->len = recvlen - sizeof(rcvd->u.data.block);
 			block->eof = ( (unsigned short)block->len < blksize );
+			gap_acked = 0;
+			/* Only the last block of a window is acknowledged */
+			send_ack = block->eof ||
+				( (unsigned short)( blockidx - lastack ) >= windowsize );
 			/* If EOF, zero blksize to indicate transfer done */
 			if ( block->eof ) blksize = 0;
 			break;
 		default: break;	/* Do nothing */
 		}
+		if ( !send_ack )
+			continue;
 		/* Send ACK */
 		xmit.opcode = htons(TFTP_ACK);
 		xmit.u.ack.block = htons(blockidx);
 		xmitlen = TFTP_MIN_PACKET;
+		lastack = blockidx;
+		sent = currticks();
+		timing = 1;
 		udp_transmit ( arptable[ARP_SERVER].ipaddr.s_addr,
 			       lport, rport, xmitlen, &xmit );
 	}
-	if ( request && blksize )
+	if ( request && blksize ) {
 		request->blksize = blksize;
+		request->windowsize = windowsize;
+	}
 	return ( block->data ? 1 : 0 );
 }
 #endif	/* DOWNLOAD_PROTO_TFTP */
@@ -960,6 +1211,106 @@ static int find_vci_pxeclient(unsigned char*p)
 #endif
 
 #ifndef USE_STATIC_BOOT_INFO
+#ifdef	DHCP_SELECT
+static int dhcp_collecting;		/* Choosing between offers */
+static long offer_score;		/* Score of the offer taken, or -1 */
+static unsigned long offer_time;	/* When the first offer came in */
+static unsigned long discover_time;	/* When the DHCPDISCOVER went out */
+static int arp_ahead = -1;		/* Entry with an ARP outstanding */
+
+/* Find an option, returns NULL if it is not there */
+static unsigned char *dhcp_find_option(unsigned char *p, unsigned char *end,
+	int tag)
+{
+	while (p < end && *p != RFC1533_END) {
+		if (*p == RFC1533_PAD) {
+			p++;
+			continue;
+		}
+		if (p + 2 > end || p + 2 + TAG_LEN(p) > end)
+			break;
+		if (*p == tag)
+			return p;
+		p += TAG_LEN(p) + 2;
+	}
+	return NULL;
+}
+
+/**************************************************************************
+DHCP_OFFER_SCORE - Rate an offer, the higher the better
+
+An offer with a boot file beats one without, then one with PXE vendor
+options, then the one from the least loaded server, then the one that
+came back first.
+**************************************************************************/
+static long dhcp_offer_score(struct bootp_t *bootpreply)
+{
+	unsigned char *p = bootpreply->bp_vend + sizeof rfc1533_cookie;
+	unsigned char *end = &nic.packet[nic.packetlen];
+	unsigned char *q;
+	int load = 128;		/* A server that does not say is half busy */
+	long score = 0;
+	unsigned long rtt;
+
+	if (bootpreply->bp_file[0])
+		score += 0x20000;
+	if (memcmp(bootpreply->bp_vend, rfc1533_cookie, 4) == 0) {
+		if (dhcp_find_option(p, end, RFC1533_VENDOR))
+			score += 0x10000;
+		q = dhcp_find_option(p, end, RFC1533_VENDOR_ETHERBOOT_ENCAP);
+		if (q)
+			q = dhcp_find_option(q + 2, q + 2 + TAG_LEN(q),
+					     RFC1533_VENDOR_SERVER_LOAD);
+		if (q && TAG_LEN(q) >= 1)
+			load = q[2];
+	}
+	score += (255 - load) << 8;
+	/* Credit for answering fast, in milliseconds */
+#if TICKS_PER_SEC >= 1000
+	rtt = (currticks() - discover_time) / (TICKS_PER_SEC / 1000);
+#else
+	rtt = (currticks() - discover_time) * 1000 / TICKS_PER_SEC;
+#endif
+	if (rtt < 255)
+		score += 255 - rtt;
+	return score;
+}
+
+/**************************************************************************
+DHCP_ARP_AHEAD - Look up the boot server, or the gateway to it, while
+the DHCPREQUEST is on its way, so that the first download need not wait
+for it.  The answer is picked up by await_bootp.
+**************************************************************************/
+static void dhcp_arp_ahead(void)
+{
+	struct arprequest arpreq;
+	unsigned long destip = arptable[ARP_SERVER].ipaddr.s_addr;
+	int entry = ARP_SERVER;
+
+	if (((destip & netmask) !=
+		(arptable[ARP_CLIENT].ipaddr.s_addr & netmask)) &&
+		arptable[ARP_GATEWAY].ipaddr.s_addr) {
+		entry = ARP_GATEWAY;
+		destip = arptable[ARP_GATEWAY].ipaddr.s_addr;
+	}
+	if (!destip)
+		return;
+	arpreq.hwtype = htons(1);
+	arpreq.protocol = htons(IP);
+	arpreq.hwlen = ETH_ALEN;
+	arpreq.protolen = 4;
+	arpreq.opcode = htons(ARP_REQUEST);
+	memcpy(arpreq.shwaddr, arptable[ARP_CLIENT].node, ETH_ALEN);
+	/* The address is not ours until the DHCPACK, so ask the way an
+	 * RFC 5227 probe does, without a sender address */
+	memset(arpreq.sipaddr, 0, sizeof(in_addr));
+	memset(arpreq.thwaddr, 0, ETH_ALEN);
+	memcpy(arpreq.tipaddr, &destip, sizeof(in_addr));
+	eth_transmit(broadcast, ETH_P_ARP, sizeof(arpreq), &arpreq);
+	arp_ahead = entry;
+}
+#endif	/* DHCP_SELECT */
+
 /**************************************************************************
 BOOTP - Get my IP address and load information
 **************************************************************************/
@@ -968,6 +1319,14 @@ static int await_bootp(int ival __unused, void *ptr __unused,
 	struct udphdr *udp, struct tcphdr *tcp __unused)
 {
 	struct	bootp_t *bootpreply;
+#ifdef	DHCP_SELECT
+	if (arp_ahead >= 0 && ptype == ETH_P_ARP) {
+		if (await_arp(arp_ahead, &arptable[arp_ahead].ipaddr,
+			      ptype, ip, udp, tcp))
+			arp_ahead = -1;
+		return 0;
+	}
+#endif	/* DHCP_SELECT */
 	if (!udp) {
 		return 0;
 	}
@@ -1013,11 +1372,40 @@ static int await_bootp(int ival __unused, void *ptr __unused,
 		(memcmp(arptable[ARP_CLIENT].node, bootpreply->bp_hwaddr, ETH_ALEN) != 0)) {
 		return 0;
 	}
+#ifdef	DHCP_SELECT
+	if (dhcp_collecting && bootpreply->bp_yiaddr.s_addr) {
+		/* Only take an offer that beats the ones before it */
+		long score = dhcp_offer_score(bootpreply);
+		int i;
+		if (score <= offer_score)
+			return 0;
+		if (offer_score < 0)
+			offer_time = currticks();
+		offer_score = score;
+		/* Forget what the previous offer told us */
+		for (i = ARP_SERVER; i < MAX_ARP; i++) {
+#ifdef PXE_EXPORT
+			if (i == ARP_PROXYDHCP)
+				continue;
+#endif
+			memset(&arptable[i], 0, sizeof(arptable[i]));
+		}
+	}
+	/* Keep an address found by dhcp_arp_ahead */
+	if ( bootpreply->bp_siaddr.s_addr &&
+	     bootpreply->bp_siaddr.s_addr != arptable[ARP_SERVER].ipaddr.s_addr ) {
+#else
 	if ( bootpreply->bp_siaddr.s_addr ) {
+#endif	/* DHCP_SELECT */
 		arptable[ARP_SERVER].ipaddr.s_addr = bootpreply->bp_siaddr.s_addr;
 		memset(arptable[ARP_SERVER].node, 0, ETH_ALEN);	/* Kill arp */
 	}
+#ifdef	DHCP_SELECT
+	if ( bootpreply->bp_giaddr.s_addr &&
+	     bootpreply->bp_giaddr.s_addr != arptable[ARP_GATEWAY].ipaddr.s_addr ) {
+#else
 	if ( bootpreply->bp_giaddr.s_addr ) {
+#endif	/* DHCP_SELECT */
 		arptable[ARP_GATEWAY].ipaddr.s_addr = bootpreply->bp_giaddr.s_addr;
 		memset(arptable[ARP_GATEWAY].node, 0, ETH_ALEN);	/* Kill arp */
 	}
@@ -1106,6 +1494,11 @@ static int bootp(void)
 
 		udp_transmit(IP_BROADCAST, BOOTP_CLIENT, BOOTP_SERVER,
 			sizeof(struct bootpip_t), &ip);
+#ifdef	DHCP_SELECT
+		discover_time = currticks();
+		offer_score = -1;
+		arp_ahead = -1;
+#endif	/* DHCP_SELECT */
 		remaining_time = rfc2131_sleep_interval(BOOTP_TIMEOUT, retry++);
 		stop_time = currticks() + remaining_time;
 #ifdef PXE_DHCP_STRICT
@@ -1115,6 +1508,9 @@ static int bootp(void)
 		if (await_reply(await_bootp, 0, NULL, remaining_time))
 			return(1);
 #else
+#ifdef	DHCP_SELECT
+		dhcp_collecting = 1;
+#endif	/* DHCP_SELECT */
 		while ( remaining_time > 0 ) {
 			/* Collect all DHCP OFFER packets that arrive within
 			 * the timeout period. This is essential for DHCP
@@ -1122,8 +1518,18 @@ static int bootp(void)
 			 * as Microsoft RIS), as otherwise the additional
 			 * DHCP OFFER is ignored. */
 			(void)await_reply(await_bootp, 0, NULL, remaining_time);
+#ifdef	DHCP_SELECT
+			/* Once there is an offer, the other servers only
+			 * get a short while to better it */
+			if (offer_score >= 0 &&
+			    (long)(offer_time + DHCP_OFFER_WINDOW - stop_time) < 0)
+				stop_time = offer_time + DHCP_OFFER_WINDOW;
+#endif	/* DHCP_SELECT */
 			remaining_time = stop_time - currticks();
 		}
+#ifdef	DHCP_SELECT
+		dhcp_collecting = 0;
+#endif	/* DHCP_SELECT */
 		if ( ! arptable[ARP_CLIENT].ipaddr.s_addr ) {
 			printf("No IP address\n");
 			continue;
@@ -1150,6 +1556,10 @@ static int bootp(void)
 
 			udp_transmit(IP_BROADCAST, BOOTP_CLIENT, BOOTP_SERVER,
 				     sizeof(struct bootpip_t), &ip);
+#ifdef	DHCP_SELECT
+			if (reqretry == 0)
+				dhcp_arp_ahead();
+#endif	/* DHCP_SELECT */
 			dhcp_reply=0;
 			timeout = rfc2131_sleep_interval(TIMEOUT, reqretry++);
 			if (!await_reply(await_bootp, 0, NULL, timeout))
@@ -1245,7 +1655,7 @@ static void send_igmp_reports(unsigned long now)
 {
 	int i;
 	for(i = 0; i < MAX_IGMP; i++) {
-		if (igmptable[i].time && (now >= igmptable[i].time)) {
+		if (igmptable[i].time && ((long)(now - igmptable[i].time) >= 0)) {
 			struct igmp_ip_t igmp;
 			igmp.router_alert[0] = 0x94;
 			igmp.router_alert[1] = 0x04;
@@ -1255,7 +1665,7 @@ static void send_igmp_reports(unsigned long now)
 				1, IP_IGMP, sizeof(igmp.router_alert), sizeof(igmp), &igmp);
 			igmp.igmp.type = IGMPv2_REPORT;
 			if (last_igmpv1 &&
-				(now < last_igmpv1 + IGMPv1_ROUTER_PRESENT_TIMEOUT)) {
+				((long)(now - last_igmpv1 - IGMPv1_ROUTER_PRESENT_TIMEOUT) < 0)) {
 				igmp.igmp.type = IGMPv1_REPORT;
 			}
 			igmp.igmp.response_time = 0;
@@ -1302,7 +1712,7 @@ static void process_igmp(struct iphdr *ip, unsigned long now)
 			if ((group == 0) || (group == igmp->group.s_addr)) {
 				unsigned long time;
 				time = currticks() + rfc1112_sleep_interval(interval, 0);
-				if (time < igmptable[i].time) {
+				if ((long)(time - igmptable[i].time) < 0) {
 					igmptable[i].time = time;
 				}
 			}
@@ -1379,12 +1789,23 @@ void join_group(int slot, unsigned long group)
 
 /**************************************************************************
 TCP - Simple-minded TCP stack. Can only send data once and then
-      receive the response. The algorithm for computing window
-      sizes and delaying ack's is currently broken, and thus
-      disabled. Performance would probably improve a little, if
-      this gets fixed. FIXME
+      receive the response.  Data is handed to recv() as soon as it is
+      in sequence; segments arriving beyond a hole are kept in a small
+      reassembly queue until the hole is filled.  ACKs are delayed and
+      coalesced (RFC1122, RFC2581), and the SYN advertises our MSS and a
+      scaled receive window (RFC1323), so that the sender is not held
+      to a few small segments per round trip.
 **************************************************************************/
 #ifdef DOWNLOAD_PROTO_HTTP
+struct tcp_segment {
+	long		seq;
+	int		len;		/* 0 if the slot is free */
+	int		fin;
+	unsigned char	data[TCP_MSS];
+};
+
+static struct tcp_segment *tcp_ooo;	/* Out of order segments */
+
 static int await_tcp(int ival, void *ptr, unsigned short ptype __unused,
 		    struct iphdr *ip, struct udphdr *udp __unused,
 		    struct tcphdr *tcp)
@@ -1402,7 +1823,95 @@ static int await_tcp(int ival, void *ptr, unsigned short ptype __unused,
 	return 1;
 }
 
-int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
+/* Returns the window scale offered by the peer, or -1 if none */
+static int tcp_wscale(struct tcphdr *tcp)
+{
+	unsigned char *opt = (unsigned char *)(tcp + 1);
+	unsigned char *end = (unsigned char *)tcp +
+		((ntohs(tcp->ctrl) >> 10) & 0x3C);
+
+	while (opt < end && *opt != TCPOPT_EOL) {
+		if (*opt == TCPOPT_NOP) {
+			opt++;
+			continue;
+		}
+		if (opt + 1 >= end || opt[1] < 2)
+			break;
+		if (*opt == TCPOPT_WINDOW && opt[1] == TCPOLEN_WINDOW)
+			return opt[2];
+		opt += opt[1];
+	}
+	return -1;
+}
+
+static void tcp_queue(long recv_seq, long seq, const unsigned char *data,
+		      int len, int fin)
+{
+	struct tcp_segment *seg, *slot = NULL;
+
+	if (!tcp_ooo || len <= 0 || seq - recv_seq >= TCP_RCV_WINDOW)
+		return;
+	if (len > TCP_MSS) {
+		len = TCP_MSS;
+		fin = 0;
+	}
+	for (seg = tcp_ooo; seg < tcp_ooo + TCP_OOO_SEGMENTS; seg++) {
+		if (!seg->len) {
+			if (!slot)
+				slot = seg;
+		} else if (seg->seq == seq) {
+			if (seg->len >= len)
+				return;	/* Seen this one before */
+			slot = seg;
+			break;
+		}
+	}
+	if (!slot)
+		return;		/* Queue full, the peer will retransmit */
+	slot->seq = seq;
+	slot->len = len;
+	slot->fin = fin;
+	memcpy(slot->data, data, len);
+}
+
+/* Deliver queued segments that have become in sequence.  Returns the
+ * number of segments delivered, or -1 if recv() asked us to stop.
+ */
+static int tcp_drain(long *recv_seq, int *fin,
+		     int (*recv)(int len, const void *buf, void *ptr),
+		     void *ptr)
+{
+	struct tcp_segment *seg;
+	int delivered = 0;
+	int progress;
+
+	if (!tcp_ooo)
+		return 0;
+	do {
+		progress = 0;
+		for (seg = tcp_ooo; seg < tcp_ooo + TCP_OOO_SEGMENTS; seg++) {
+			long skip = *recv_seq - seg->seq;
+			int len = seg->len;
+
+			if (!len || skip < 0)
+				continue;
+			seg->len = 0;
+			progress = 1;
+			if (skip >= len)
+				continue;	/* Already delivered */
+			delivered++;
+			*recv_seq += len - skip;
+			if (seg->fin)
+				*fin = 1;
+			if (!recv(len - skip, seg->data + skip, ptr))
+				return -1;
+		}
+	} while (progress);
+	return delivered;
+}
+
+static int tcp_connection(unsigned long destip, unsigned int destsock,
+		   void *ptr,
 		   int (*send)(int len, void *buf, void *ptr),
 		   int (*recv)(int len, const void *buf, void *ptr))
 {
@@ -1418,8 +1927,12 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 	char		buf[128]; /* Small outgoing buffer */
 	long		payload;
 	int		header_size;
-	int		window = 3*TCP_MIN_WINDOW;
-	long		last_ack = 0;
+	int		option_len;
+	int		window = TCP_RCV_WINDOW > TCP_MAX_WINDOW ?
+				 TCP_MAX_WINDOW : TCP_RCV_WINDOW;
+	int		ack_pending = 0;
+	unsigned long	ack_deadline = 0;
+	long		timeout;
 	long		last_sent = 0;
 	long		rtt = 0;
 	long		srtt = 0;
@@ -1437,20 +1950,50 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 	await_reply(await_qdrain, 0, NULL, 0);
 
  send_data:
-	if (ctrl & ACK)
-		last_ack = recv_seq;
-	if (!tcp_transmit(destip, srcsock, destsock, send_seq,
-			 recv_seq, window, ctrl,
-			 sizeof(struct iphdr) + sizeof(struct tcphdr)+
-			 can_send, buf)) {
+	if (ctrl & ACK) {
+		ack_pending = 0;
+		ack_deadline = 0;
+	}
+	option_len = 0;
+	if (ctrl & SYN) {
+		/* Announce our MSS and window scale.  Nothing is
+		 * queued for sending before the connection is set up,
+		 * so the options can live in the data area.
+		 */
+		unsigned char *opt = (unsigned char *)buf +
+			sizeof(struct iphdr) + sizeof(struct tcphdr);
+		opt[0] = TCPOPT_MAXSEG;
+		opt[1] = TCPOLEN_MAXSEG;
+		opt[2] = TCP_MSS >> 8;
+		opt[3] = TCP_MSS & 0xff;
+		opt[4] = TCPOPT_NOP;
+		opt[5] = TCPOPT_WINDOW;
+		opt[6] = TCPOLEN_WINDOW;
+		opt[7] = TCP_WSCALE;
+		option_len = 8;
+	}
+	build_tcp_hdr(destip, srcsock, destsock, send_seq, recv_seq,
+		      window, ctrl, 60, option_len,
+		      sizeof(struct iphdr) + sizeof(struct tcphdr) +
+		      option_len + can_send, buf);
+	if (!ip_transmit(sizeof(struct iphdr) + sizeof(struct tcphdr) +
+			 option_len + can_send, buf)) {
 		return (0);
 	}
 	last_sent = currticks();
 
  recv_data:
-	if (!await_reply(await_tcp, srcsock, &tcp,
-			(state == ESTABLISHED && !can_send)
-			? TCP_MAX_TIMEOUT : rto)) {
+	timeout = (state == ESTABLISHED && !can_send) ? TCP_MAX_TIMEOUT : rto;
+	if (ack_pending) {
+		long left = ack_deadline - currticks();
+		if (left < timeout)
+			timeout = left > 0 ? left : 0;
+	}
+	if (!await_reply(await_tcp, srcsock, &tcp, timeout)) {
+		if (ack_pending) {
+			/* Delayed ACK timer expired */
+			goto send_data;
+		}
 		if (state == ESTABLISHED) {
  close:
 			ctrl = FIN|ACK;
@@ -1475,7 +2018,6 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 		/* retransmit */
 		goto send_data;
 	}
- got_data:
 	retry = TCP_MAX_RETRY;
 
 	if (tcp->ctrl & htons(ACK) ) {
@@ -1535,46 +2077,64 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 	ip = (struct iphdr *)&nic.packet[ETH_HLEN];
 	header_size = sizeof(struct iphdr) + ((ntohs(tcp->ctrl)>>10)&0x3C);
 	payload = ntohs(ip->len) - header_size;
-	if (payload > 0 && state == ESTABLISHED) {
-		int old_bytes = recv_seq - (long)ntohl(tcp->seq);
-		if (old_bytes >= 0 && payload - old_bytes > 0) {
+	if (state == ESTABLISHED) {
+		long old_bytes = recv_seq - (long)ntohl(tcp->seq);
+		int fin = 0;
+		int drained;
+
+		if (payload <= 0 && !(tcp->ctrl & htons(FIN)))
+			goto check_send;
+		ctrl = can_send ? PSH|ACK : ACK;
+		if (old_bytes < 0) {
+			/* Beyond a hole.  Keep it, and send a duplicate
+			 * ACK at once to trigger a fast retransmit. */
+			tcp_queue(recv_seq, ntohl(tcp->seq),
+				  &nic.packet[ETH_HLEN+header_size], payload,
+				  tcp->ctrl & htons(FIN));
+			goto send_data;
+		}
+		if (payload - old_bytes > 0) {
 			recv_seq += payload - old_bytes;
-			if (state != FIN_WAIT_1 && state != FIN_WAIT_2 &&
-			    !recv(payload - old_bytes,
+			if (!recv(payload - old_bytes,
 				  &nic.packet[ETH_HLEN+header_size+old_bytes],
 				  ptr)) {
 				goto close;
 			}
-			if ((state == ESTABLISHED || state == SYN_RCVD) &&
-			    !(tcp->ctrl & htons(FIN))) {
-				int in_window = window - 2*TCP_MIN_WINDOW >
-						recv_seq - last_ack;
-				ctrl = can_send ? PSH|ACK : ACK;
-				if (!can_send && in_window) {
-/* Window scaling is broken right now, just fall back to acknowledging every */
-/* packet immediately and unconditionally. FIXME */ /***/
-/*					if (await_reply(await_tcp, srcsock,
-							&tcp, rto))
-						goto got_data;
-					else */
-						goto send_data;
-				}
-				if (!in_window) {
-					window += TCP_MIN_WINDOW;
-					if (window > TCP_MAX_WINDOW)
-						window = TCP_MAX_WINDOW;
-				}
-				goto send_data;
-			}
-		} else {
-			/* saw old data again, must have lost packets */
-			window /= 2;
-			if (window < 2*TCP_MIN_WINDOW)
-				window = 2*TCP_MIN_WINDOW;
+		} else if (payload > 0 && !(tcp->ctrl & htons(FIN))) {
+			/* Saw old data again, our ACK must have been
+			 * lost.  Repeat it without delay. */
+			goto send_data;
+		}
+		if (tcp->ctrl & htons(FIN))
+			fin = old_bytes <= payload;
+		drained = tcp_drain(&recv_seq, &fin, recv, ptr);
+		if (drained < 0)
+			goto close;
+		if (fin)
+			goto got_fin;
+		if (sent_all && !can_send) {
+			/* The reply may have been answered with another
+			 * request on this connection */
+			can_send = send(sizeof(buf) - sizeof(struct iphdr) -
+					sizeof(struct tcphdr),
+					buf + sizeof(struct iphdr) +
+					sizeof(struct tcphdr), ptr);
+			sent_all = !can_send;
+			if (can_send)
+				ctrl = PSH|ACK;
 		}
+		/* ACK at least every second segment, or at once when a
+		 * hole has just been filled or we have data to send */
+		if (drained || can_send ||
+		    ++ack_pending >= TCP_DELACK_SEGMENTS)
+			goto send_data;
+		if (!ack_deadline)
+			ack_deadline = currticks() + TCP_DELACK_TIMEOUT;
+		goto recv_data;
 	}
 
 	if (tcp->ctrl & htons(FIN)) {
+ got_fin:
 		if (state == ESTABLISHED) {
 			ctrl = FIN|ACK;
 		} else if (state == FIN_WAIT_1 || state == FIN_WAIT_2) {
@@ -1593,6 +2153,10 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 
 	if (state == CLOSED) {
 		if (tcp->ctrl & htons(SYN)) {
+			/* The window is scaled only if both sides
+			 * offered it */
+			if (tcp_wscale(tcp) >= 0)
+				window = TCP_RCV_WINDOW >> TCP_WSCALE;
 			recv_seq = ntohl(tcp->seq) + 1;
 			if (!(tcp->ctrl & htons(ACK))) {
 				state = SYN_RCVD;
@@ -1605,11 +2169,29 @@ int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
 		}
 	}
 
+ check_send:
 	if (can_send || payload) {
 		goto send_data;
 	}
 	goto recv_data;
 }
+
+int tcp_transaction(unsigned long destip, unsigned int destsock, void *ptr,
+		   int (*send)(int len, void *buf, void *ptr),
+		   int (*recv)(int len, const void *buf, void *ptr))
+{
+	int rc;
+
+	tcp_ooo = allot(TCP_OOO_SEGMENTS * sizeof(struct tcp_segment));
+	if (tcp_ooo) {
+		memset(tcp_ooo, 0,
+		       TCP_OOO_SEGMENTS * sizeof(struct tcp_segment));
+	}
+	rc = tcp_connection(destip, destsock, ptr, send, recv);
+	forget(tcp_ooo);
+	tcp_ooo = NULL;
+	return rc;
+}
 #endif
 
 /**************************************************************************
@@ -1644,7 +2226,7 @@ int await_reply(reply_t reply, int ival, void *ptr, long timeout)
 			 * we have no processing time left between packets.  */
 			poll_interruptions();
 			/* Do the timeout after at least a full queue walk.  */
-			if ((timeout == 0) || (currticks() > time)) {
+			if ((timeout == 0) || ((long)(currticks() - time) > 0)) {
 				break;
 			}
 			continue;
@@ -2004,9 +2586,15 @@ int decode_rfc1533(unsigned char *p, unsigned int block, unsigned int len, int e
 #endif
 #ifdef	DNS_RESOLVER
 		else if (NON_ENCAP_OPT c == RFC1533_DNS) {
-			// TODO: Copy the DNS IP somewhere reasonable
-			if (TAG_LEN(p) >= sizeof(in_addr))
-				memcpy(&arptable[ARP_NAMESERVER].ipaddr, p+2, sizeof(in_addr));
+			/* Keep as many servers as there are slots, they
+			 * are all asked at once */
+			int i;
+			for (i = 0; i < MAX_NAMESERVERS; i++) {
+				arptable[ARP_NAMESERVER + i].ipaddr.s_addr = 0;
+				if ((unsigned)TAG_LEN(p) >= (i + 1) * sizeof(in_addr))
+					memcpy(&arptable[ARP_NAMESERVER + i].ipaddr,
+						p + 2 + i * sizeof(in_addr), sizeof(in_addr));
+			}
 		}
 #endif
 		else {
@@ -2044,6 +2632,9 @@ long rfc2131_sleep_interval(long base, int exp)
 	if (exp > BACKOFF_LIMIT)
 		exp = BACKOFF_LIMIT;
 #endif
+	/* With fine grained ticks base << exp may not fit */
+	while (exp > 0 && base > (LONG_MAX / 2) >> exp)
+		exp--;
 	tmo = (base << exp) + (TICKS_PER_SEC - (random()/TWO_SECOND_DIVISOR));
 	return tmo;
 }
@@ -2059,6 +2650,8 @@ long rfc1112_sleep_interval(long base, int exp)
 	if (exp > BACKOFF_LIMIT)
 		exp = BACKOFF_LIMIT;
 #endif
+	while (exp > 0 && base > LONG_MAX >> exp)
+		exp--;
 	divisor = RAND_MAX/(base << exp);
 	tmo = random()/divisor;
 	return tmo;
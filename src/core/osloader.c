@@ -121,6 +121,10 @@ static void done(int do_cleanup)
 	printf("K ");
 #endif
 	printf("done\n");
+#ifdef	BOOT_TRACE
+	boot_trace(BT_BOOT);
+	boot_trace_print();
+#endif
 	/* We may not want to do the cleanup: when booting a PXE
 	 * image, for example, we need to leave the network card
 	 * enabled, and it helps debugging if the serial console
@@ -290,6 +294,83 @@ os_download_t probe_image(unsigned char *data, unsigned int len)
 	return os_download;
 }
 
+/* Set by loaders that can take file data out of order.  Works out
+ * what becomes of the file bytes from offset on: *run of them (at most
+ * len) go to *addr if 1 is returned, are not loaded at all if 0 is
+ * returned, and must be passed to load_block with their data if -1 is.
+ */
+static int (*os_place) P((unsigned long offset, unsigned int len,
+	unsigned long *addr, unsigned int *run));
+
+/* Set by download protocols that pass blocks to load_block while the
+ * transfer is still going on and have to wrap it up themselves.  The
+ * loaders then start the image only on the block with eof set, rather
+ * than as soon as the last byte they need is in.
+ */
+int load_wait_eof;
+
+/**************************************************************************
+LOAD_BLOCK_PLACE - Find where file data will be loaded
+
+Returns 1 and the physical address for file bytes [offset, offset+len)
+once the image headers have been seen.  The caller may then copy the
+bytes there and later pass a NULL data pointer to load_block for them.
+Returns 0 if the bytes don't go to a single place, and -1 if the
+current loader needs all data passed in order.
+**************************************************************************/
+int load_block_place(unsigned long offset, unsigned int len, unsigned long *addr)
+{
+	unsigned int run;
+
+	if (!os_place)
+		return -1;
+	if (!len)
+		return 0;
+	return (os_place(offset, len, addr, &run) > 0) && (run == len);
+}
+
+/**************************************************************************
+LOAD_AT - Load file bytes [offset, offset+len) that arrived out of order
+
+Once the first block has gone through load_block, the image headers
+tell where every byte goes, so they are copied straight there and the
+bytes that aren't loaded at all are dropped.  Returns 1 if that was
+done, 0 if the bytes must be passed to load_block with their data
+instead, and -1 if the current loader needs all data passed in order.
+load_block must still be called for every block in order, with a NULL
+data pointer for the ones load_at took.
+**************************************************************************/
+int load_at(unsigned long offset, unsigned char *data, unsigned int len)
+{
+	unsigned long addr;
+	unsigned int pos, run;
+#ifdef	BOOT_TRACE
+	int phase;
+#endif
+
+	if (!os_place)
+		return -1;
+	/* Check everything before copying anything */
+	for (pos = 0; pos < len; pos += run) {
+		if (os_place(offset + pos, len - pos, &addr, &run) < 0)
+			return 0;
+	}
+#ifdef	BOOT_TRACE
+	phase = boot_trace_enter(BT_COPY);
+#endif
+	while (len) {
+		if (os_place(offset, len, &addr, &run) > 0)
+			memcpy(phys_to_virt(addr), data, run);
+		offset += run;
+		data += run;
+		len -= run;
+	}
+#ifdef	BOOT_TRACE
+	boot_trace_leave(phase);
+#endif
+	return 1;
+}
+
 /**************************************************************************
 LOAD_BLOCK - Try to load file
 **************************************************************************/
@@ -299,16 +380,18 @@ int load_block(unsigned char *data, unsigned int block, unsigned int len, int eo
 	static sector_t skip_sectors;
 	static unsigned int skip_bytes;
 #ifdef	SIZEINDICATOR
-	static int rlen = 0;
+	/* Count bytes, blocks need not all be the same size */
+	static unsigned long rbytes = 0;
 
 	if (block == 1)
 	{
-		rlen=len;
+		rbytes = 0;
 		printf("XXXX");
 	}
+	rbytes += len;
 	if (!(block % 4) || eof) {
 		int size;
-		size = ((block-1) * rlen + len) / 1024;
+		size = rbytes / 1024;
 
 		putchar('\b');
 		putchar('\b');
@@ -320,11 +403,17 @@ int load_block(unsigned char *data, unsigned int block, unsigned int len, int eo
 		putchar('0' + (size/10)%10);
 		putchar('0' + (size/1)%10);
 	}
+#endif
+#ifdef	PACKET_STATS
+	if (eof) {
+		packet_stats_print();
+	}
 #endif
 	if (block == 1)
 	{
 		skip_sectors = 0;
 		skip_bytes = 0;
+		os_place = 0;
 		os_download = probe_image(data, len);
 		if (!os_download) {
 			printf("error: not a valid image\n");
@@ -336,10 +425,20 @@ int load_block(unsigned char *data, unsigned int block, unsigned int len, int eo
 #endif
 			return 0;
 		}
+#if defined(ELF_IMAGE) && !defined(IMAGE_FREEBSD)
+		if (os_download == elf32_download) {
+			os_place = elf32_place;
+		}
+#endif
+#ifdef TAGGED_IMAGE
+		if (os_download == tagged_download) {
+			os_place = tagged_place;
+		}
+#endif
 	} /* end of block zero processing */
 
 #if defined(ELF_IMAGE) && defined(IMAGE_MULTIBOOT)
-	if (os_download == elf32_download) {
+	if ((os_download == elf32_download) && data) {
 		multiboot_peek(data, len);
 	}
 #endif /* defined(ELF_IMAGE) && defined(IMAGE_MULTIBOOT) */
@@ -355,9 +454,23 @@ int load_block(unsigned char *data, unsigned int block, unsigned int len, int eo
 		skip_bytes -= len;
 	}
 	else {
-		len -= (skip_sectors << 9) + skip_bytes;
-		data += (skip_sectors << 9) + skip_bytes;
+		sector_t skip = (skip_sectors << 9) + skip_bytes;
+		/* A short (possibly empty) last block may end inside
+		 * the area to be skipped */
+		if (skip > len)
+			skip = len;
+		len -= skip;
+		if (data)
+			data += skip;
+#ifdef	BOOT_TRACE
+		{
+			int phase = boot_trace_enter(BT_COPY);
+			skip_sectors = os_download(data, len, eof);
+			boot_trace_leave(phase);
+		}
+#else
 		skip_sectors = os_download(data, len, eof);
+#endif
 		skip_bytes = 0;
 	}
 	
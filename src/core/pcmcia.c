@@ -49,7 +49,7 @@ struct	driver_interact_t driver[] = {
 
 void	sleepticks(int numticks ) {
 	u_int	tmo;
-	for (tmo = currticks()+numticks; currticks() < tmo; ) {
+	for (tmo = currticks()+numticks; (long)(currticks() - tmo) < 0; ) {
                 poll_interruptions();
         }
 	return;
@@ -289,7 +289,7 @@ static inline void lacp_record_pdu(struct slow_lacp *pkt)
 
 static inline int lacp_timer_expired(unsigned long now, unsigned long when)
 {
-	return when && (now > when);
+	return when && ((long)(now - when) > 0);
 }
 
 static inline void lacp_start_periodic_timer(unsigned long now)
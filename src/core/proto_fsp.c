@@ -100,7 +100,9 @@ static int proto_fsp(struct fsp_info *info)
 {
     uint32_t filepos;
     uint32_t filelength=0;
-    int i,retry;
+    int i;
+    static struct rtt_estimator rtt;
+    unsigned long sent;
     uint16_t reqlen;
     struct fsp_reply *reply;
     int block=1;
@@ -119,7 +121,7 @@ static int proto_fsp(struct fsp_info *info)
     reqlen=i+3+12;
 
     rx_qdrain();
-    retry=0;
+    rtt_server(&rtt, info->server_ip.s_addr, RTT_INITIAL_TIMEOUT);
 
     /* main loop */
     for(;;) {
@@ -140,20 +142,18 @@ static int proto_fsp(struct fsp_info *info)
         }
 	request.fsp.sum= sum + (sum >> 8);
 	/* send request */
+	sent = currticks();
         if (!udp_transmit(info->server_ip.s_addr, info->local_port,
 	                 info->server_port, sizeof(request.ip) +
 			 sizeof(request.udp) + reqlen, &request))
 	                    return (0);
 	/* wait for retry */		    
-#ifdef  CONGESTED
-        timeout =
-            rfc2131_sleep_interval(filepos ? TFTP_REXMT : TIMEOUT, retry);
-#else
-	timeout = rfc2131_sleep_interval(TIMEOUT, retry);
-#endif
-	retry++;
+	timeout = rtt_timeout(&rtt);
         if (!await_reply(await_fsp, info->local_port, NULL, timeout))
+	{
+	    rtt_backoff(&rtt);
 	    continue;
+	}
 	reply=(struct fsp_reply *) &nic.packet[ETH_HLEN];    
 	/* check received packet */
 	if (reply->fsp.seq != request.fsp.seq)
@@ -172,6 +172,9 @@ static int proto_fsp(struct fsp_info *info)
 	    printf("FSP checksum failed. computed %d, but packet has %d.\n",sum,reply->fsp.sum);
 	    continue;
 	}
+	/* Each transmission has its own seq, so even the reply to a
+	 * retransmitted request times the round trip */
+	rtt_sample(&rtt, sent);
 	if(reply->fsp.cmd == CC_ERR)
 	{
 	    printf("\nFSP error: %s",info->filename);
@@ -197,7 +200,6 @@ static int proto_fsp(struct fsp_info *info)
 	    }
 	    request.fsp.cmd = CC_GET_FILE;
 	    request.fsp.key = reply->fsp.key;
-	    retry=0;
 	    continue;
 	}
 
@@ -206,7 +208,6 @@ static int proto_fsp(struct fsp_info *info)
 	    if(ntohl(reply->fsp.pos) != filepos)
 		continue;
 	    request.fsp.key = reply->fsp.key;
-	    retry=0;
 	    i=ntohs(reply->fsp.len);
 	    if(i == 1)
 	    {
@@ -3,31 +3,60 @@
 
 #ifdef DOWNLOAD_PROTO_HTTP
 
-/* The block size is currently chosen to be 512 bytes. This means, we can
-   allocate the receive buffer on the stack, but it results in a noticeable
-   performance penalty.
-   This is what needs to be done in order to increase the block size:
-     - size negotiation needs to be implemented in TCP
-     - the buffer needs to be allocated on the heap
-     - path MTU discovery needs to be implemented
-*/ /***/ /* FIXME */
-#define BLOCKSIZE TFTP_DEFAULTSIZE_PACKET
+/* The loaders expect to find the image headers in the first block, so the
+   first block is collected into a buffer of one full TCP segment.  After
+   that, payload is handed to the callback straight out of the receive
+   packet, one block per segment, without being copied or split up.
+*/
+#define FIRST_BLOCKSIZE TCP_MSS
+
+/* Requests go out as HTTP/1.1, and the end of the body is found from
+   Content-Length or the chunked transfer coding, falling back to the
+   server closing the connection for responses that have neither.  That
+   keeps the connection open after a redirect, and one that points back
+   at the same server is followed without a new handshake.
+
+   If the connection breaks in the middle of a file, the rest of it is
+   asked for with a Range header, and the loader carries on from the
+   block where it stopped.  A server that ignores the Range header sends
+   the whole file again, and the part we already have is dropped.
+*/
+static const char GET[] = "GET /%s HTTP/1.1\r\nHost: %@";
+static const char PORT[] = ":%d";
+static const char RANGE[] = "\r\nRange: bytes=%ld-";
+static const char END[] = "\r\n\r\n";
+
+/* Attempts to resume without getting any further before giving up */
+#define MAX_HTTP_RESUME 3
 
 /**************************************************************************
 SEND_TCP_CALLBACK - Send data using TCP
 **************************************************************************/
 struct send_recv_state {
-	int (*fnc)(unsigned char *data, int block, int len, int eof);
-	char *send_buffer;
-	char *recv_buffer;
+	int (*fnc)(unsigned char *, unsigned int, unsigned int, int);
+	in_addr server;
+	int port;
+	unsigned char *recv_buffer;
 	int send_length;
 	int recv_length;
 	int bytes_sent;
 	int block;
-	int bytes_received;
-	enum { RESULT_CODE, HEADER, DATA, ERROR, MOVED } recv_state;
+	long bytes_received;		/* Body bytes of the file so far */
+	long range_start;		/* First byte in this response */
+	long skip;			/* Bytes we already have */
+	enum { RESULT_CODE, HEADER, DATA, CHUNK_SIZE, CHUNK_DATA,
+	       CHUNK_END, TRAILER, DONE, ERROR } recv_state;
 	int rc;
+	long content_length;		/* -1 if not given */
+	long body_left;			/* -1 if it runs until close */
+	int chunked;
+	int keep_alive;
+	int line_len;			/* Length of the current line */
+	char line[128];			/* Header line being collected */
 	char location[MAX_URL+1];
+	char path[MAX_URL+1];		/* File being asked for */
+	char send_buffer[sizeof(GET) + sizeof(PORT) + sizeof(RANGE) +
+			 sizeof(END) + MAX_URL + 30];
 };
 
 static int send_tcp_request(int length, void *buffer, void *ptr) {
@@ -40,167 +69,415 @@ static int send_tcp_request(int length, void *buffer, void *ptr) {
 	return (length);
 }
 
+/* Length of name if the header line starts with it, case ignored */
+static int http_header(const char *p, int length, const char *name) {
+	int i;
+
+	for (i = 0; name[i]; i++) {
+		if (i >= length || tolower(p[i]) != name[i])
+			return 0;
+	}
+	while (i < length && p[i] == ' ')
+		i++;
+	return i;
+}
+
+/* Check if the rest of the line contains a word, case ignored */
+static int http_has_word(const char *p, int length, const char *word) {
+	for (; length > 0 && *p != '\n'; p++, length--) {
+		if (http_header(p, length, word))
+			return 1;
+	}
+	return 0;
+}
+
+/* Start on the next response */
+static void http_next_response(struct send_recv_state *state) {
+	state->rc = -1;
+	state->range_start = 0;
+	state->skip = 0;
+	state->content_length = -1;
+	state->chunked = 0;
+	state->keep_alive = 1;
+	state->line_len = 0;
+	state->recv_state = RESULT_CODE;
+}
+
+/* Ask for the part of state->path that we do not have yet */
+static void http_request(struct send_recv_state *state) {
+	char *buf = state->send_buffer;
+	int n;
+
+	n = sprintf(buf, GET, state->path, state->server.s_addr);
+	if (state->port != 80)
+		n += sprintf(buf + n, PORT, state->port);
+	if (state->bytes_received)
+		n += sprintf(buf + n, RANGE, state->bytes_received);
+	n += sprintf(buf + n, END);
+	state->send_length = n;
+	state->bytes_sent = 0;
+	http_next_response(state);
+}
+
+/* Find the server, port and path of a redirect, NULL if unusable.  As
+ * we do not have support for DNS, assume that a host name is the same
+ * machine. */
+static const char *http_location(const char *url, in_addr *server,
+				 int *port) {
+	int length;
+
+	if (*url == '/')
+		return url + 1;
+	if (memcmp("http://", url, 7))
+		return 0;
+	url += 7;
+	length = inet_aton(url, server);
+	if (!length) {
+		while (*url && *url != ':' && *url != '/')
+			url++;
+	}
+	if (*(url += length) == ':') {
+		url++;
+		*port = strtoul(url, &url, 10);
+	} else {
+		*port = 80;
+	}
+	if (!*url)
+		return "";
+	if (*url != '/')
+		return 0;
+	return url + 1;
+}
+
+/* Hand body data of the response to the callback */
+static int http_body(struct send_recv_state *state,
+		     const char *p, int length) {
+	if (state->rc != 200)
+		return 1;	/* Body of an error or redirect, drop it */
+	if (state->skip) {
+		/* Resent part of a file, we have it already */
+		int n = length < state->skip ? length : state->skip;
+		state->skip -= n;
+		p += n;
+		length -= n;
+	}
+	state->bytes_received += length;
+	if (!state->block) {
+		/* Still collecting the first block */
+		int copy_length = FIRST_BLOCKSIZE - state->recv_length;
+		if (copy_length > length)
+			copy_length = length;
+		memcpy(state->recv_buffer + state->recv_length,
+		       p, copy_length);
+		state->recv_length += copy_length;
+		length -= copy_length;
+		p += copy_length;
+		if (state->recv_length < FIRST_BLOCKSIZE)
+			return 1;
+		if (!state->fnc(state->recv_buffer,
+				++state->block, state->recv_length, 0))
+			goto refused;
+		state->recv_length = 0;
+	}
+	if (length > 0 &&
+	    !state->fnc((unsigned char *)p, ++state->block, length, 0))
+		goto refused;
+	return 1;
+ refused:
+	/* The loader gave up, so there is no point in resuming */
+	state->recv_state = ERROR;
+	return 0;
+}
+
+/* The response is complete.  Returns 0 to end the connection; the eof
+ * is only passed on after it is closed, since it may start the image
+ * just loaded. */
+static int http_response_done(struct send_recv_state *state) {
+	in_addr server = state->server;
+	int port = state->port;
+	const char *path;
+
+	if (state->rc >= 300 && state->rc < 400 && state->keep_alive &&
+	    (path = http_location(state->location, &server, &port)) &&
+	    server.s_addr == state->server.s_addr && port == state->port) {
+		/* Same server, ask again on this connection */
+		memcpy(state->path, path, strlen(path) + 1);
+		state->location[0] = '\000';
+		http_request(state);
+		return 1;
+	}
+	state->recv_state = DONE;
+	return 0;
+}
+
+/* Act on a status or header line.  Returns 0 to end the connection. */
+static int http_line(struct send_recv_state *state) {
+	const char *p = state->line;
+	int length = state->line_len;
+	int n;
+
+	if (state->recv_state == RESULT_CODE) {
+		/* Status line, "HTTP/1.1 200 OK" */
+		if (length < 12 || memcmp(p, "HTTP/", 5)) {
+			state->recv_state = ERROR;
+			return 0;
+		}
+		{
+			const char *ptr = p + 9;
+			state->rc = strtoul(ptr, &ptr, 10);
+		}
+		/* HTTP/1.0 servers close after each response */
+		if (!memcmp(p + 5, "1.0", 3))
+			state->keep_alive = 0;
+		state->recv_state = HEADER;
+		return 1;
+	}
+	if (*p == '\r' || *p == '\n') {
+		/* End of header */
+		if (state->rc >= 100 && state->rc < 200) {
+			/* 100 Continue, the real one follows */
+			http_next_response(state);
+			return 1;
+		}
+		if (state->rc == 206) {
+			/* The rest of a file we started on before */
+			if (state->range_start > state->bytes_received) {
+				state->recv_state = ERROR;
+				return 0;
+			}
+			state->rc = 200;
+		}
+		state->skip = state->bytes_received - state->range_start;
+		if (state->chunked) {
+			state->recv_state = CHUNK_SIZE;
+			state->body_left = 0;
+			return 1;
+		}
+		/* Without a length it runs until the server closes */
+		state->body_left = state->content_length;
+		if (state->body_left < 0)
+			state->keep_alive = 0;
+		state->recv_state = DATA;
+		if (!state->body_left)
+			return http_response_done(state);
+	} else if (state->rc >= 300 && state->rc < 400 &&
+		   (n = http_header(p, length, "location:"))) {
+		/* HTTP redirect */
+		char *ptr = state->location;
+		int i;
+		memcpy(ptr, p + n, MAX_URL);
+		for (i = 0; i < MAX_URL && *ptr > ' ';
+		     i++, ptr++);
+		*ptr = '\000';
+	} else if ((n = http_header(p, length, "content-length:"))) {
+		const char *ptr = p + n;
+		state->content_length = strtoul(ptr, &ptr, 10);
+	} else if ((n = http_header(p, length, "content-range:"))) {
+		/* "Content-Range: bytes 1000-1999/2000" */
+		const char *ptr = p + n;
+		if (http_header(ptr, length - n, "bytes"))
+			ptr += 5;
+		while (*ptr == ' ')
+			ptr++;
+		state->range_start = strtoul(ptr, &ptr, 10);
+	} else if (http_header(p, length, "transfer-encoding:")) {
+		state->chunked = http_has_word(p, length, "chunked");
+	} else if (http_header(p, length, "connection:")) {
+		if (http_has_word(p, length, "close"))
+			state->keep_alive = 0;
+	}
+	return 1;
+}
+
 /**************************************************************************
 RECV_TCP_CALLBACK - Receive data using TCP
 **************************************************************************/
 static int recv_tcp_request(int length, const void *buffer, void *ptr) {
 	struct send_recv_state *state = (struct send_recv_state *)ptr;
+	const char *p = buffer;
+	int eol, n;
 
-	/* Assume that the lines in an HTTP header do not straddle a packet */
-	/* boundary. This is probably a reasonable assumption */
-	if (state->recv_state == RESULT_CODE) {
-		while (length > 0) {
-			/* Find HTTP result code */
-			if (*(const char *)buffer == ' ') {
-				const char *ptr = ((const char *)buffer) + 1;
-				int rc = strtoul(ptr, &ptr, 10);
-				if (ptr >= (const char *)buffer + length) {
-					state->recv_state = ERROR;
-					return 0;
-				}
-				state->rc = rc;
-				state->recv_state = HEADER;
-				goto header;
+	while (length > 0) {
+		switch (state->recv_state) {
+		case RESULT_CODE:
+		case HEADER:
+			/* Collect a whole line, it may straddle packets */
+			eol = 0;
+			while (length > 0 && !eol) {
+				if (state->line_len < (int)sizeof(state->line) - 1)
+					state->line[state->line_len++] = *p;
+				eol = *p++ == '\n';
+				length--;
 			}
-			++(const char *)buffer;
-			length--;
-		}
-		state->recv_state = ERROR;
-		return 0;
-	}
-	if (state->recv_state == HEADER) {
-	header: while (length > 0) {
-			/* Check for HTTP redirect */
-			if (state->rc >= 300 && state->rc < 400 &&
-			    !memcmp(buffer, "Location: ", 10)) {
-				char *ptr = state->location;
-				int i;
-				memcpy(ptr, buffer + 10, MAX_URL);
-				for (i = 0; i < MAX_URL && *ptr > ' ';
-				     i++, ptr++);
-				*ptr = '\000';
-				state->recv_state = MOVED;
+			if (!eol)
 				return 1;
+			state->line[state->line_len] = '\000';
+			n = http_line(state);
+			state->line_len = 0;
+			if (n <= 0)
+				return 0;
+			break;
+		case DATA:
+			n = length;
+			if (state->body_left >= 0 && n > state->body_left)
+				n = state->body_left;
+			if (!http_body(state, p, n))
+				return 0;
+			p += n;
+			length -= n;
+			if (state->body_left >= 0) {
+				state->body_left -= n;
+				if (!state->body_left &&
+				    !http_response_done(state))
+					return 0;
 			}
-			/* Find beginning of line */
-			while (length > 0) {
-				length--;
-				if (*((const char *)buffer)++ == '\n')
-					break;
+			break;
+		case CHUNK_SIZE:
+			/* Hex size, then maybe extensions, then CRLF */
+			if (*p == '\n') {
+				state->recv_state = state->body_left ?
+					CHUNK_DATA : TRAILER;
+				state->line_len = 0;
+			} else if (state->line_len >= 0 &&
+				   ((*p >= '0' && *p <= '9') ||
+				    (tolower(*p) >= 'a' && tolower(*p) <= 'f'))) {
+				state->body_left = state->body_left * 16 +
+					(*p <= '9' ? *p - '0' :
+					 tolower(*p) - 'a' + 10);
+			} else {
+				state->line_len = -1;	/* extension */
 			}
-			/* Check for end of header */
-			if (length >= 2 && !memcmp(buffer, "\r\n", 2)) {
-				state->recv_state = DATA;
-				buffer += 2;
-				length -= 2;
-				break;
+			p++;
+			length--;
+			break;
+		case CHUNK_DATA:
+			n = length;
+			if (n > state->body_left)
+				n = state->body_left;
+			if (!http_body(state, p, n))
+				return 0;
+			p += n;
+			length -= n;
+			state->body_left -= n;
+			if (!state->body_left)
+				state->recv_state = CHUNK_END;
+			break;
+		case CHUNK_END:
+			/* CRLF after the chunk data */
+			if (*p == '\n') {
+				state->recv_state = CHUNK_SIZE;
+				state->line_len = 0;
 			}
-		}
-	}
-	if (state->recv_state == DATA) {
-		state->bytes_received += length;
-		while (length > 0) {
-			int copy_length = BLOCKSIZE - state->recv_length;
-			if (copy_length > length)
-				copy_length = length;
-			memcpy(state->recv_buffer + state->recv_length,
-			       buffer, copy_length);
-			if ((state->recv_length += copy_length) == BLOCKSIZE) {
-				if (!state->fnc(state->recv_buffer,
-						++state->block, BLOCKSIZE, 0))
-					return 0;
-				state->recv_length = 0;
+			p++;
+			length--;
+			break;
+		case TRAILER:
+			/* Header lines after the last chunk, up to an
+			 * empty one */
+			if (*p == '\n') {
+				if (!state->line_len) {
+					p++;
+					length--;
+					if (!http_response_done(state))
+						return 0;
+					continue;
+				}
+				state->line_len = 0;
+			} else if (*p != '\r') {
+				state->line_len++;
 			}
-			length -= copy_length;
-			buffer += copy_length;
+			p++;
+			length--;
+			break;
+		case DONE:
+		case ERROR:
+			return 0;
 		}
 	}
 	return 1;
 }
 
 /**************************************************************************
-HTTP_GET - Get data using HTTP
+HTTP_GET - Get one file from a server
+
+The file goes to fnc, with blocks numbered from 1.  *rc is the HTTP
+result code, -1 if there was none, and location is filled in for a
+redirect that could not be followed on the same connection.
+**************************************************************************/
+static int http_get(in_addr server, int port, const char *path,
+		    int (*fnc)(unsigned char *, unsigned int, unsigned int, int),
+		    int *rc, char *location) {
+	static unsigned char recv_buffer[FIRST_BLOCKSIZE];
+	static struct send_recv_state state;
+	long resume;
+	int tries = 0;
+
+	*rc = -1;
+	state.fnc = fnc;
+	state.server = server;
+	state.port = port;
+	memcpy(state.path, path, strlen(path) + 1);
+	state.recv_buffer = recv_buffer;
+	state.location[0] = '\000';
+	state.block = 0;
+	state.recv_length = 0;
+	state.bytes_received = 0;
+	for (;;) {
+		resume = state.bytes_received;
+		http_request(&state);
+		if (tcp_transaction(server.s_addr, port, &state,
+				    send_tcp_request, recv_tcp_request) &&
+		    state.recv_state == DATA && state.body_left < 0) {
+			/* The server closed to end the body */
+			http_response_done(&state);
+		}
+		if (state.recv_state == DONE) {
+			*rc = state.rc;
+			break;
+		}
+		/* Carry on where the connection broke, unless the loader
+		 * gave up */
+		if (state.recv_state == ERROR)
+			break;
+		if (state.bytes_received != resume)
+			tries = 0;
+		if (++tries > MAX_HTTP_RESUME)
+			break;
+		if (state.bytes_received)
+			printf("Resuming at byte %ld\n", state.bytes_received);
+	}
+	memcpy(location, state.location, MAX_URL + 1);
+	if (*rc != 200)
+		return 0;
+	return fnc(recv_buffer, ++state.block, state.recv_length, 1);
+}
+
+/**************************************************************************
+HTTP - Get data using HTTP
 **************************************************************************/
 int http(const char *url,
 		int (*fnc)(unsigned char *, unsigned int, unsigned int, int)) {
-	static const char GET[] = "GET /%s HTTP/1.0\r\n\r\n";
-	static char recv_buffer[BLOCKSIZE];
+	const char *name = url;
+	char location[MAX_URL+1];
 	in_addr destip;
 	int port;
-	int length;
-	struct send_recv_state state;
+	int rc = -1;
 
-	state.fnc = fnc;
-	state.rc = -1;
-	state.block = 0;
-	state.recv_buffer = recv_buffer;
-	length = strlen(url);
-	if (length <= MAX_URL) {
-		memcpy(state.location, url, length+1);
+	if (strlen(url) <= MAX_URL) {
 		destip = arptable[ARP_SERVER].ipaddr;
 		port = url_port;
 		if (port == -1)
 		  port = 80;
-		goto first_time;
-
 		do {
-			state.rc = -1;
-			state.block = 0;
-			url = state.location;
-			if (memcmp("http://", url, 7))
-				break;
-			url += 7;
-			length = inet_aton(url, &destip);
-			if (!length) {
-				/* As we do not have support for DNS, assume*/
-				/* that HTTP redirects always point to the */
-				/* same machine */
-				if (state.recv_state == MOVED) {
-					while (*url &&
-					*url != ':' && *url != '/') url++;
-				} else {
-					break;
-				}
-			}
-			if (*(url += length) == ':') {
-				port = strtoul(url, &url, 10);
-			} else {
-				port = 80;
-			}
-			if (!*url)
-				url = "/";
-			if (*url != '/')
-				break;
-			url++;
-
-		first_time:
-			length = strlen(url);
-			state.send_length = sizeof(GET) - 3 + length;
-			
-			{ char buf[state.send_length + 1];
-			sprintf(state.send_buffer = buf, GET, url);
-			state.bytes_sent = 0;
-			
-			state.bytes_received = 0;
-			state.recv_state = RESULT_CODE;
-			
-			state.recv_length = 0;
-			tcp_transaction(destip.s_addr, 80, &state,
-					send_tcp_request, recv_tcp_request);
-			}
-		} while (state.recv_state == MOVED);
-	} else {
-		memcpy(state.location, url, MAX_URL);
-		state.location[MAX_URL] = '\000';
+			if (http_get(destip, port, url, fnc, &rc, location))
+				return 1;
+			/* A redirect to another server */
+		} while (rc >= 300 && rc < 400 && location[0] &&
+			 (url = http_location(location, &destip, &port)));
 	}
 
-	if (state.rc == 200) {
-		return fnc(recv_buffer, ++state.block, state.recv_length, 1);
-	} else {
-		printf("Failed to download %s (rc = %d)\n",
-		       state.location, state.rc);
-		return 0;
-	}
+	printf("Failed to download %s (rc = %d)\n", name, rc);
+	return 0;
 }
 
 #endif /* DOWNLOAD_PROTO_HTTP */
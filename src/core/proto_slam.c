@@ -56,6 +56,14 @@
  *   received packets
  *   requested packtes
  *   0
+ *
+ * Parity Packet (SLAM_FEC, sent to the multicast port + 1)
+ *   transaction
+ *   total bytes
+ *   block size
+ *   group size
+ *   group #
+ *   data, the xor of the group's packets padded to the block size
  */
 
 #define MAX_HDR (7 + 7 + 7) /* transaction, total size, block size */
@@ -65,6 +73,7 @@
 #define MIN_SLAM_REQUEST MIN_HDR
 
 #define MIN_SLAM_DATA (MIN_HDR + 1)
+#define MIN_SLAM_PARITY (MIN_HDR + 1 + 1)
 
 static struct slam_nack {
 	struct iphdr ip;
@@ -84,8 +93,16 @@ struct slam_state {
 
 	unsigned char *image;
 	unsigned char *bitmap;
+#ifdef SLAM_DIRECT
+	unsigned long next;	/* next packet to pass on in sequence */
+#endif
 } state;
 
+#ifdef SLAM_DIRECT
+/* The last packet, the loader starts the image when it gets it */
+static unsigned char slam_tail[ETH_MAX_MTU];
+#endif
+
 
 static void init_slam_state(void)
 {
@@ -98,6 +115,9 @@ static void init_slam_state(void)
 
 	state.image = 0;
 	state.bitmap = 0;
+#ifdef SLAM_DIRECT
+	state.next = 0;
+#endif
 }
 
 struct slam_info {
@@ -114,6 +134,7 @@ struct slam_info {
 #define SLAM_TIMEOUT 0
 #define SLAM_REQUEST 1
 #define SLAM_DATA    2
+#define SLAM_PARITY  3
 static int await_slam(int ival __unused, void *ptr,
 	unsigned short ptype __unused, struct iphdr *ip, struct udphdr *udp)
 {
@@ -144,6 +165,18 @@ static int await_slam(int ival __unused, void *ptr,
 			MIN_SLAM_DATA)) {
 		return SLAM_DATA;
 	}
+#ifdef SLAM_FEC
+	/* Check for a multicast parity packet */
+	if ((ip->dest.s_addr == info->multicast_ip.s_addr) &&
+		(ntohs(udp->dest) == info->multicast_port + 1) &&
+		(nic.packetlen >= 
+			ETH_HLEN + 
+			sizeof(struct iphdr) + 
+			sizeof(struct udphdr) +
+			MIN_SLAM_PARITY)) {
+		return SLAM_PARITY;
+	}
+#endif
 #if 0
 	printf("#");
 	printf("dest: %@ port: %d len: %d\n", 
@@ -308,17 +341,132 @@ static unsigned char *reinit_slam_state(
 	}
 	bitmap_len   = (state.total_packets + 1 + 7)/8;
 	state.bitmap = allot(bitmap_len);
+#ifdef SLAM_DIRECT
+	/* The image is only buffered if the loader can't place it */
+	state.image  = 0;
+	state.next   = 0;
+	if (!state.bitmap) {
+		printf("ALERT: slam filesize to large for available memory\n");
+		return 0;
+	}
+#else
 	state.image  = allot(total_bytes);
 	if ((unsigned long)state.image < 1024*1024) {
 		printf("ALERT: slam filesize to large for available memory\n");
 		return 0;
 	}
+#endif
 	memset(state.bitmap, 0, bitmap_len);
 
 	return header + state.hdr_len;
 }
 
-static int slam_recv_data(unsigned char *data)
+#ifdef SLAM_DIRECT
+/* Length of a packet, only the last one is short */
+static unsigned long slam_packet_len(unsigned long packet)
+{
+	if (packet == state.total_packets -1) {
+		return state.total_bytes - packet*state.block_size;
+	}
+	return state.block_size;
+}
+
+/* Find where the data of a packet is kept, or goes when it is rebuilt */
+static unsigned char *slam_block(unsigned long packet)
+{
+	unsigned long addr;
+	if (packet == state.total_packets -1) {
+		return slam_tail;
+	}
+	if (state.next == 0) {
+		/* Nothing has a place before the headers are in */
+		return 0;
+	}
+	if (state.image) {
+		/* Packet 0 went into the copy when it was passed on */
+		return state.image + (packet*state.block_size);
+	}
+	if (load_block_place(packet*state.block_size, state.block_size, &addr) <= 0) {
+		return 0;
+	}
+	return phys_to_virt(addr);
+}
+
+/* Pass the packets that are now in sequence to fnc.  Packets that
+ * were written to their load address go through as NULL.  The last
+ * packet is only passed on when eof is set, after the transfer has
+ * been wrapped up.
+ */
+static int slam_deliver(struct slam_info *info, int eof)
+{
+	unsigned long last = state.total_packets -1;
+	unsigned char *data;
+
+	while ((state.next < last) &&
+		((state.bitmap[state.next >> 3] >> (state.next & 7)) & 1)) {
+		data = 0;
+		if (state.image) {
+			data = state.image + (state.next*state.block_size);
+		}
+		if (!info->fnc(data, state.next + 1, state.block_size, 0)) {
+			return 0;
+		}
+		state.next++;
+	}
+	if (eof && (state.next == last)) {
+		return info->fnc(slam_tail, last + 1, slam_packet_len(last), 1);
+	}
+	return 1;
+}
+
+/* Take a new data packet.  Packets in sequence go straight to fnc,
+ * later ones are copied to where the loader will put them, or into a
+ * copy of the image if fnc isn't the loader.  A packet that can't be
+ * kept yet, which is every later one for a loader that can't place
+ * them, is left unmarked, so it is asked for again.
+ */
+static int slam_store(struct slam_info *info, unsigned long packet,
+	unsigned char *data, unsigned long len)
+{
+	if (packet == state.total_packets -1) {
+		memcpy(slam_tail, data, len);
+	}
+	else if (packet == state.next) {
+		if ((packet == 0) && (info->fnc != load_block)) {
+			/* Take the copy off the heap before fnc sees any
+			 * data and decides where things go */
+			state.image = allot(state.total_bytes);
+			if (!state.image) {
+				printf("ALERT: slam filesize to large for available memory\n");
+				return 0;
+			}
+		}
+		if (!info->fnc(data, packet + 1, len, 0)) {
+			return 0;
+		}
+		state.next++;
+		if (state.image) {
+			/* Keep it for rebuilding packets from parity */
+			memcpy(state.image + (packet*state.block_size), data, len);
+		}
+	}
+	else if (state.next == 0) {
+		/* Destinations are unknown until the headers are in */
+		return 1;
+	}
+	else if (state.image) {
+		memcpy(state.image + (packet*state.block_size), data, len);
+	}
+	else if (load_at(packet*state.block_size, data, len) <= 0) {
+		return 1;
+	}
+	state.bitmap[packet >> 3] |= (1 << (packet & 7));
+	state.received_packets++;
+	return slam_deliver(info, 0);
+}
+#endif
+
+static int slam_recv_data(struct slam_info *info __unused, unsigned char *data)
 {
 	unsigned long packet;
 	unsigned long data_len;
@@ -327,7 +475,7 @@ static int slam_recv_data(unsigned char *data)
 	udp = (struct udphdr *)&nic.packet[ETH_HLEN + sizeof(struct iphdr)];
 	err = 0;
 	packet = slam_decode(&data, &nic.packet[nic.packetlen], &err);
-	if (err || (packet > state.total_packets)) {
+	if (err || (packet >= state.total_packets)) {
 		printf("ALERT: Invalid packet number\n");
 		return 0;
 	}
@@ -335,7 +483,7 @@ static int slam_recv_data(unsigned char *data)
 	if (packet != state.total_packets -1) {
 		data_len = state.block_size;
 	} else {
-		data_len = state.total_bytes % state.block_size;
+		data_len = state.total_bytes - packet*state.block_size;
 	}
 	/* If the packet size is wrong drop the packet and then continue */
 	if (ntohs(udp->len) != (data_len + (data - (unsigned char*)udp))) {
@@ -351,9 +499,13 @@ static int slam_recv_data(unsigned char *data)
 	}
 	if (((state.bitmap[packet >> 3] >> (packet & 7)) & 1) == 0) {
 		/* Non duplicate packet */
+#ifdef SLAM_DIRECT
+		return slam_store(info, packet, data, data_len);
+#else
 		state.bitmap[packet >> 3] |= (1 << (packet & 7));
 		memcpy(state.image + (packet*state.block_size), data, data_len);
 		state.received_packets++;
+#endif
 	} else {
 #ifdef MDEBUG
 		printf("<DUP>\n");
@@ -362,6 +514,93 @@ static int slam_recv_data(unsigned char *data)
 	return 1;
 }
 
+#ifdef SLAM_FEC
+static int slam_recv_parity(struct slam_info *info __unused, unsigned char *data)
+{
+	unsigned long group_size, group;
+	unsigned long first, last, packet, missing, len, i;
+	unsigned char *block;
+	int err;
+	struct udphdr *udp;
+	udp = (struct udphdr *)&nic.packet[ETH_HLEN + sizeof(struct iphdr)];
+	err = 0;
+	group_size = slam_decode(&data, &nic.packet[nic.packetlen], &err);
+	group = slam_decode(&data, &nic.packet[nic.packetlen], &err);
+	if (err || (group_size == 0) ||
+		(group >= (state.total_packets + group_size - 1)/group_size)) {
+		/* Ignore it, the data packets are enough */
+		return 1;
+	}
+	if ((ntohs(udp->len) != (state.block_size + (data - (unsigned char*)udp))) ||
+		(nic.packetlen < state.block_size + (data - nic.packet))) {
+		printf("ALERT: slam parity packet is not the correct size\n");
+		return 1;
+	}
+	first = group * group_size;
+	last = first + group_size;
+	if (last > state.total_packets) {
+		last = state.total_packets;
+	}
+	/* The parity only helps if exactly one packet is missing */
+	missing = last;
+	for(packet = first; packet < last; packet++) {
+		if ((state.bitmap[packet >> 3] >> (packet & 7)) & 1)
+			continue;
+		if (missing != last)
+			return 1;
+		missing = packet;
+	}
+	if (missing == last) {
+		return 1;
+	}
+	len = state.block_size;
+	if (missing == state.total_packets -1) {
+		len = state.total_bytes - missing*state.block_size;
+	}
+#ifdef SLAM_DIRECT
+	/* Every other packet of the group must still be at hand */
+	for(packet = first; packet < last; packet++) {
+		if ((packet != missing) && !slam_block(packet))
+			return 1;
+	}
+	block = slam_block(missing);
+	if (!block)
+		return 1;
+#else
+	block = state.image + (missing*state.block_size);
+#endif
+	memcpy(block, data, len);
+	for(packet = first; packet < last; packet++) {
+		unsigned char *src;
+		unsigned long src_len;
+		if (packet == missing)
+			continue;
+#ifdef SLAM_DIRECT
+		src = slam_block(packet);
+		if (!src)
+			return 1;
+#else
+		src = state.image + (packet*state.block_size);
+#endif
+		/* Only the last packet is short, past its end it is zero */
+		src_len = state.block_size;
+		if (packet == state.total_packets -1) {
+			src_len = state.total_bytes - packet*state.block_size;
+		}
+		for(i = 0; (i < len) && (i < src_len); i++) {
+			block[i] ^= src[i];
+		}
+	}
+	state.bitmap[missing >> 3] |= (1 << (missing & 7));
+	state.received_packets++;
+#ifdef SLAM_DIRECT
+	return slam_deliver(info, 0);
+#else
+	return 1;
+#endif
+}
+#endif
+
 static void transmit_nack(unsigned char *ptr, struct slam_info *info)
 {
 	int nack_len;
@@ -466,6 +705,22 @@ static int proto_slam(struct slam_info *info)
 		} else {
 			retry = 0;
 		}
+#ifdef SLAM_FEC
+		if ((type == SLAM_PARITY) && state.bitmap) {
+			header = &nic.packet[ETH_HLEN + 
+				sizeof(struct iphdr) + sizeof(struct udphdr)];
+			/* Parity for another transaction is no use */
+			if (memcmp(state.hdr, header, state.hdr_len) == 0) {
+				if (!slam_recv_parity(info, header + state.hdr_len)) {
+					return 0;
+				}
+				if (state.received_packets == state.total_packets) {
+					break;
+				}
+			}
+			continue;
+		}
+#endif
 		if ((type == SLAM_DATA) || (type == SLAM_REQUEST)) {
 			/* Check the incomming packet and reinit the data 
 			 * structures if necessary.
@@ -482,7 +737,7 @@ static int proto_slam(struct slam_info *info)
 			}
 		}
 		if (type == SLAM_DATA) {
-			if (!slam_recv_data(data)) {
+			if (!slam_recv_data(info, data)) {
 				return 0;
 			}
 			if (state.received_packets == state.total_packets) {
@@ -501,15 +756,22 @@ static int proto_slam(struct slam_info *info)
 
 	/* Leave the multicast group */
 	leave_group(IGMP_SERVER);
+#ifdef SLAM_DIRECT
+	return slam_deliver(info, 1);
+#else
 	/* FIXME don't overwrite myself */
 	/* load file to correct location */
 	return info->fnc(state.image, 1, state.total_bytes, 1);
+#endif
 }
 
 
 int url_slam(const char *name, int (*fnc)(unsigned char *, unsigned int, unsigned int, int))
 {
 	struct slam_info info;
+#ifdef SLAM_DIRECT
+	int ret;
+#endif
 	/* Set the defaults */
 	info.server_ip.s_addr    = arptable[ARP_SERVER].ipaddr.s_addr;
 	info.server_port         = SLAM_PORT;
@@ -535,7 +797,15 @@ int url_slam(const char *name, int (*fnc)(unsigned char *, unsigned int, unsigne
 		printf("\nBad url\n");
 		return 0;
 	}
+#ifdef SLAM_DIRECT
+	/* The image must not start before the disconnect is out */
+	load_wait_eof = 1;
+	ret = proto_slam(&info);
+	load_wait_eof = 0;
+	return ret;
+#else
 	return proto_slam(&info);
+#endif
 }
 
 #endif /* DOWNLOAD_PROTO_SLAM */
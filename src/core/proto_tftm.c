@@ -66,11 +66,91 @@ struct tftm_state {
 	unsigned char *image;
 	unsigned char *bitmap;
 	char recvd_oack;
+#ifdef TFTM_DIRECT
+	unsigned long next;	/* next block to pass on in sequence */
+#endif
 } state;
 
 #define TFTM_PORT 1758
 #define TFTM_MIN_PACKET 1024
 
+#ifdef TFTM_DIRECT
+/* The last block, the loader starts the image when it gets it */
+static unsigned char tftm_tail[TFTM_MIN_PACKET];
+
+/**************************************************************************
+TFTM_DELIVER - Pass the blocks that are now in sequence to fnc
+
+Blocks that were written to their load address go through as NULL.
+The last block is only passed on when eof is set, after the transfer
+has been wrapped up.
+**************************************************************************/
+static int tftm_deliver(struct tftm_info *info, unsigned long filesize,
+			int eof)
+{
+	unsigned char *data;
+
+	while ((state.next < state.total_packets) &&
+	       ((state.bitmap[state.next >> 3] >> (state.next & 7)) & 1)) {
+		data = 0;
+		if (state.image)
+			data = state.image +
+			    ((state.next - 1) * state.block_size);
+		if (!info->fnc(data, state.next, state.block_size, 0))
+			return 0;
+		state.next++;
+	}
+	if (eof && (state.next == state.total_packets))
+		return info->fnc(tftm_tail, state.next,
+				 filesize % state.block_size, 1);
+	return 1;
+}
+
+/**************************************************************************
+TFTM_STORE - Take a new data block
+
+Blocks in sequence go straight to fnc.  Blocks ahead of the sequence
+are copied to where the loader will put them, or into a copy of the
+image if fnc isn't the loader.  A block that can't be kept yet, which
+is every one ahead of the sequence for a loader that can't place them,
+is left unmarked, so it is asked for again.  Returns 0 to abandon the
+transfer.
+**************************************************************************/
+static int tftm_store(struct tftm_info *info, unsigned long block,
+		      unsigned char *data, unsigned long len,
+		      unsigned long filesize)
+{
+	if (block == state.total_packets) {
+		memcpy(tftm_tail, data, len);
+	} else if (block == state.next) {
+		if ((block == 1) && (info->fnc != load_block)) {
+			/* Take the copy off the heap before fnc sees
+			 * any data and decides where things go */
+			state.image = allot(filesize);
+			if (!state.image) {
+				printf
+				    ("ALERT: tftp filesize to large for available memory\n");
+				return 0;
+			}
+		}
+		if (!info->fnc(data, block, len, 0))
+			return 0;
+		state.next++;
+	} else if (state.next == 1) {
+		/* Destinations are unknown until the headers are in */
+		return 1;
+	} else if (state.image) {
+		memcpy(state.image + ((block - 1) * state.block_size),
+		       data, len);
+	} else if (load_at((block - 1) * state.block_size, data, len) <= 0) {
+		return 1;
+	}
+	state.bitmap[block >> 3] |= (1 << (block & 7));
+	state.received_packets++;
+	return tftm_deliver(info, filesize, 0);
+}
+#endif
+
 
 int opt_get_multicast(struct tftp_t *tr, unsigned short *len,
 		      unsigned long *filesize, struct tftm_info *info);
@@ -112,6 +192,8 @@ int proto_tftm(struct tftm_info *info)
 	struct tftp_t *tr;
 	struct tftpreq_t tp;
 	unsigned long filesize = 0;
+	static struct rtt_estimator rtt;
+	unsigned long sent;
 
 	state.image = 0;
 	state.bitmap = 0;
@@ -129,6 +211,9 @@ int proto_tftm(struct tftm_info *info)
 		    "%s%coctet%cmulticast%c%cblksize%c%d%ctsize%c",
 		    info->name, 0, 0, 0, 0, 0, TFTM_MIN_PACKET, 0, 0) + 1;
 
+	rtt_server(&rtt, arptable[ARP_SERVER].ipaddr.s_addr,
+		   RTT_INITIAL_TIMEOUT);
+	sent = currticks();
 	if (!udp_transmit(arptable[ARP_SERVER].ipaddr.s_addr, ++iport,
 			  TFTM_PORT, len, &tp))
 		return (0);
@@ -136,17 +221,14 @@ int proto_tftm(struct tftm_info *info)
 	/* loop to listen for packets and to receive the file */
 	for (;;) {
 		long timeout;
-#ifdef	CONGESTED
-		timeout =
-		    rfc2131_sleep_interval(block ? TFTP_REXMT : TIMEOUT,
-					   retry);
-#else
-		timeout = rfc2131_sleep_interval(TIMEOUT, retry);
-#endif
+		/* Once data flows it comes at the pace of the master
+		 * client, which is not a round trip of ours */
+		timeout = block ? TFTP_REXMT : rtt_timeout(&rtt);
 		/* Calls the await_reply function in nic.c which in turn calls
 		   await_tftm (1st parameter) as above */
 		if (!await_reply(await_tftm, iport, info, timeout)) {
 			if (!block && retry++ < MAX_TFTP_RETRIES) {	/* maybe initial request was lost */
+				rtt_backoff(&rtt);
 				if (!udp_transmit
 				    (arptable[ARP_SERVER].ipaddr.s_addr,
 				     ++iport, TFTM_PORT, len, &tp))
@@ -188,6 +270,9 @@ int proto_tftm(struct tftm_info *info)
 			int i =
 			    opt_get_multicast(tr, &len, &filesize, info);
 
+			if (!retry && !state.recvd_oack)	/* Karn */
+				rtt_sample(&rtt, sent);
+
 			if (i == 0 || (i != 7 && !state.recvd_oack)) {	/* Multicast unsupported */
 				/* Transmit an error message to the server to end the transmission */
 				printf
@@ -226,8 +311,23 @@ int proto_tftm(struct tftm_info *info)
 						 (filesize %
 						  state.block_size)) /
 					    state.block_size;
+					/* Room for the trailer bit past the last block */
 					bitmap_len =
-					    (state.total_packets + 7) / 8;
+					    (state.total_packets + 2 + 7) / 8;
+#ifdef TFTM_DIRECT
+					if (!state.bitmap) {
+						state.bitmap =
+						    allot(bitmap_len);
+						if (!state.bitmap) {
+							printf
+							    ("ALERT: tftp filesize to large for available memory\n");
+							return 0;
+						}
+						memset(state.bitmap, 0,
+						       bitmap_len);
+						state.next = 1;
+					}
+#else
 					if (!state.image) {
 						state.bitmap =
 						    allot(bitmap_len);
@@ -243,6 +343,7 @@ int proto_tftm(struct tftm_info *info)
 						memset(state.bitmap, 0,
 						       bitmap_len);
 					}
+#endif
 					/* If I'm running over multicast join the multicast group */
 					join_group(IGMP_SERVER,
 						   info->multicast_ip.
@@ -305,12 +406,18 @@ int proto_tftm(struct tftm_info *info)
 			      bitmap[block >> 3] >> (block & 7)) & 1) ==
 			    0) {
 				/* Non duplicate packet */
+#ifdef TFTM_DIRECT
+				if (!tftm_store(info, block, data, data_len,
+						filesize))
+					return 0;
+#else
 				state.bitmap[block >> 3] |=
 				    (1 << (block & 7));
 				memcpy(state.image +
 				       ((block - 1) * state.block_size),
 				       data, data_len);
 				state.received_packets++;
+#endif
 			} else {
 
 /*				printf("<DUP>\n"); */
@@ -366,7 +473,9 @@ int proto_tftm(struct tftm_info *info)
 				udp_transmit(arptable[ARP_SERVER].ipaddr.s_addr, iport, oport, TFTP_MIN_PACKET, &tp);	/* ack */
 			}
 			/* We are done get out */
+#ifndef TFTM_DIRECT
 			forget(state.bitmap);
+#endif
 			break;
 		}
 
@@ -382,7 +491,16 @@ int proto_tftm(struct tftm_info *info)
 	}
 	/* Leave the multicast group */
 	leave_group(IGMP_SERVER);
+#ifdef TFTM_DIRECT
+	if (state.received_packets == state.total_packets)
+		retry = tftm_deliver(info, filesize, 1);
+	else
+		retry = 0;
+	forget(state.bitmap);
+	return retry;
+#else
 	return info->fnc(state.image, 1, filesize, 1);
+#endif
 }
 
 int url_tftm(const char *name,
@@ -421,7 +539,14 @@ int url_tftm(const char *name,
 		return 0;
 	}
 
+#ifdef TFTM_DIRECT
+	/* The image must not start before the last ACK is out */
+	load_wait_eof = 1;
+#endif
 	ret = proto_tftm(&info);
+#ifdef TFTM_DIRECT
+	load_wait_eof = 0;
+#endif
 
 	return ret;
 }
@@ -622,7 +622,7 @@ PXENV_EXIT_t pxenv_undi_get_iface_info ( t_PXENV_UNDI_GET_IFACE_INFO
  * Status: working
  */
 PXENV_EXIT_t pxenv_undi_isr ( t_PXENV_UNDI_ISR *undi_isr ) {
-	media_header_t *media_header = (media_header_t*)nic.packet;
+	media_header_t *media_header;
 
 	DBG ( "PXENV_UNDI_ISR" );
 	/* We can't call ENSURE_READY, because this could be being
@@ -681,6 +681,8 @@ PXENV_EXIT_t pxenv_undi_isr ( t_PXENV_UNDI_ISR *undi_isr ) {
 			undi_isr->FrameLength = nic.packetlen;
 			undi_isr->FrameHeaderLength = ETH_HLEN;
 			memcpy ( pxe_stack->packet, nic.packet, nic.packetlen);
+			/* A lending driver moves nic.packet in poll() */
+			media_header = (media_header_t*)nic.packet;
 			PTR_TO_SEGOFF16 ( pxe_stack->packet, undi_isr->Frame );
 			switch ( ntohs(media_header->nstype) ) {
 			case IP :	undi_isr->ProtType = P_IP;	break;
@@ -770,6 +772,8 @@ PXENV_EXIT_t pxenv_tftp_open ( t_PXENV_TFTP_OPEN *tftp_open ) {
 	DBG ( " %@:%d/%s (%d)", tftp_open->ServerIPAddress,
 	      request.port, request.name, request.blksize );
 	if ( !request.blksize ) request.blksize = TFTP_DEFAULTSIZE_PACKET;
+	/* Let TFTP_READ benefit from windowed transfers as well */
+	request.windowsize = TFTP_WINDOWSIZE;
 	/* Make request and get first packet */
 	if ( !tftp_block ( &request, &block ) ) {
 		tftp_open->Status = PXENV_STATUS_TFTP_FILE_NOT_FOUND;
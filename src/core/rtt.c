@@ -0,0 +1,82 @@
+/* Round trip time estimation for the UDP protocols, so that a lost packet
+ * is noticed after a few round trips rather than after seconds.  This is
+ * the estimator of Jacobson and Karels, "Congestion Avoidance and Control",
+ * with the rules of RFC 2988 for backoff and for Karn's algorithm.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ */
+
+#include "etherboot.h"
+
+/**************************************************************************
+RTT_SERVER - Make rtt track server.  The estimate is kept for as long as
+the server stays the same, another server starts afresh from initial.
+**************************************************************************/
+void rtt_server(struct rtt_estimator *rtt, unsigned long server, long initial)
+{
+	if (rtt->rto && rtt->server == server)
+		return;
+	rtt->server = server;
+	rtt->srtt = 0;
+	rtt->rttvar = 0;
+	rtt->rto = initial;
+}
+
+/**************************************************************************
+RTT_TIMEOUT - How long to wait for a reply before retransmitting
+**************************************************************************/
+long rtt_timeout(struct rtt_estimator *rtt)
+{
+	/* A little jitter keeps clients that were powered on together from
+	 * retransmitting in step */
+	return rtt->rto + random() % (rtt->rto / 8 + 1);
+}
+
+/**************************************************************************
+RTT_SAMPLE - Update the estimate with the reply to a request sent when
+currticks() was sent.  Replies to retransmitted requests are ambiguous
+and must not be passed in (Karn).
+**************************************************************************/
+void rtt_sample(struct rtt_estimator *rtt, unsigned long sent)
+{
+	long m = currticks() - sent;
+	long rto;
+
+	if (m <= 0)
+		m = 1;
+	if (!rtt->srtt) {
+		/* First measurement: srtt = m, rttvar = m/2 */
+		rtt->srtt = m << 3;
+		rtt->rttvar = m << 1;
+	} else {
+		/* srtt += (m - srtt)/8, rttvar += (|m - srtt| - rttvar)/4,
+		 * both kept scaled so that no precision is lost */
+		m -= rtt->srtt >> 3;
+		rtt->srtt += m;
+		if (m < 0)
+			m = -m;
+		m -= rtt->rttvar >> 2;
+		rtt->rttvar += m;
+	}
+	rto = (rtt->srtt >> 3) + rtt->rttvar;
+	if (rto < RTT_MIN_TIMEOUT)
+		rto = RTT_MIN_TIMEOUT;
+	else if (rto > RTT_MAX_TIMEOUT)
+		rto = RTT_MAX_TIMEOUT;
+	rtt->rto = rto;
+}
+
+/**************************************************************************
+RTT_BACKOFF - A request went unanswered, double the timeout.  It stays
+doubled until a reply to a request sent only once gives a new sample.
+**************************************************************************/
+void rtt_backoff(struct rtt_estimator *rtt)
+{
+	if (rtt->rto > RTT_MAX_TIMEOUT / 2)
+		rtt->rto = RTT_MAX_TIMEOUT;
+	else
+		rtt->rto <<= 1;
+}
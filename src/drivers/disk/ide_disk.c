@@ -29,6 +29,7 @@
 struct controller {
 	uint16_t cmd_base;
 	uint16_t ctrl_base;
+	uint16_t bm_base;	/* bus master DMA registers, 0 if none */
 };
 
 struct harddisk_info {
@@ -46,10 +47,16 @@ struct harddisk_info {
 	int drive_exists;
 	int slave_absent;
 	int basedrive;
+	int multiple;		/* sectors per READ MULTIPLE block, 0 if off */
+	int dma;
 };
 
 
 #define IDE_SECTOR_SIZE 0x200
+/* Sectors read by each call of ide_read, must fit in DISK_BUFFER_SIZE */
+#define IDE_SECTORS_PER_READ 16
+/* Largest READ MULTIPLE block asked for */
+#define IDE_MULTIPLE_MAX 16
 
 #define IDE_BASE0             (0x1F0u) /* primary controller */
 #define IDE_BASE1             (0x170u) /* secondary */
@@ -76,6 +83,32 @@ struct harddisk_info {
 #define IDE_REG_ALTSTATUS(base)      ((ctrl)->ctrl_base + 2u)
 #define IDE_REG_DEVICE_CONTROL(base) ((ctrl)->ctrl_base + 2u)
 
+/* PCI bus master IDE (SFF-8038i) */
+#define IDE_BM_COMMAND(ctrl)         ((ctrl)->bm_base + 0u)
+#define IDE_BM_STATUS(ctrl)          ((ctrl)->bm_base + 2u)
+#define IDE_BM_PRD(ctrl)             ((ctrl)->bm_base + 4u)
+
+#define IDE_BM_CMD_START	0x01
+#define IDE_BM_CMD_READ		0x08	/* the bus master writes memory */
+#define IDE_BM_STAT_ACTIVE	0x01
+#define IDE_BM_STAT_ERROR	0x02
+#define IDE_BM_STAT_INTR	0x04
+#define IDE_BM_STAT_DMA_CAP	0x60	/* drive 0/1 DMA capable, set by BIOS */
+
+/* Physical region descriptor, no region may cross 64K */
+struct ide_prd {
+	uint32_t addr;
+	uint16_t count;		/* 0 is 64K */
+	uint16_t flags;
+#define IDE_PRD_EOT 0x8000
+};
+#define IDE_PRD_MAX 4
+
+/* Aligned to its size the table can't cross 64K.  It is not taken off
+ * the heap, where a segment being loaded may end. */
+static struct ide_prd ide_prd_table[IDE_PRD_MAX]
+	__attribute__ ((aligned(IDE_PRD_MAX * sizeof(struct ide_prd))));
+
 struct ide_pio_command
 {
 	uint8_t feature;
@@ -151,8 +184,10 @@ struct ide_pio_command
 #define IDE_CMD_PACKET                       0xA0
 #define IDE_CMD_READ_BUFFER                  0xE4
 #define IDE_CMD_READ_DMA                     0xC8
+#define IDE_CMD_READ_DMA_EXT                 0x25
 #define IDE_CMD_READ_DMA_QUEUED              0xC7
 #define IDE_CMD_READ_MULTIPLE                0xC4
+#define IDE_CMD_READ_MULTIPLE_EXT            0x29
 #define IDE_CMD_READ_SECTORS                 0x20
 #define IDE_CMD_READ_SECTORS_EXT             0x24
 #define IDE_CMD_READ_VERIFY_SECTORS          0x40
@@ -215,7 +250,7 @@ static int await_ide(int (*done)(struct controller *ctrl),
 			return 0;
 		}
 		poll_interruptions();
-		if ((timeout == 0) || (currticks() > timeout)) {
+		if ((timeout == 0) || ((long)(currticks() - timeout) > 0)) {
 			break;
 		}
 	}
@@ -310,11 +345,12 @@ static int pio_non_data(struct controller *ctrl, const struct ide_pio_command *c
 }
 
 static int pio_data_in(struct controller *ctrl, const struct ide_pio_command *cmd,
-	void *buffer, size_t bytes)
+	void *buffer, size_t bytes, size_t block)
 {
 	unsigned int status;
+	uint8_t *buf = buffer;
+	size_t len;
 
-	/* FIXME handle commands with multiple blocks */
 	/* Wait until the busy bit is clear */
 	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
 		return -1;
@@ -322,14 +358,21 @@ static int pio_data_in(struct controller *ctrl, const struct ide_pio_command *cm
 
 	/* How do I tell if INTRQ is asserted? */
 	pio_set_registers(ctrl, cmd);
-	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
-		return -1;
-	}
-	status = inb(IDE_REG_STATUS(ctrl));
-	if (!(status & IDE_STATUS_DRQ)) {
-		return -1;
+	/* A multiple block command raises DRQ once for every block */
+	while (bytes > 0) {
+		ndelay(400);
+		if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+			return -1;
+		}
+		status = inb(IDE_REG_STATUS(ctrl));
+		if (!(status & IDE_STATUS_DRQ)) {
+			return -1;
+		}
+		len = bytes < block ? bytes : block;
+		insw(IDE_REG_DATA(ctrl), buf, len/2);
+		buf += len;
+		bytes -= len;
 	}
-	insw(IDE_REG_DATA(ctrl), buffer, bytes/2);
 	status = inb(IDE_REG_STATUS(ctrl));
 	if (status & IDE_STATUS_DRQ) {
 		return -1;
@@ -337,6 +380,99 @@ static int pio_data_in(struct controller *ctrl, const struct ide_pio_command *cm
 	return 0;
 }
 
+static int dma_done(struct controller *ctrl)
+{
+	return !(inb(IDE_BM_STATUS(ctrl)) & IDE_BM_STAT_ACTIVE) ||
+		!(inb(IDE_REG_ALTSTATUS(ctrl)) &
+			(IDE_STATUS_BSY | IDE_STATUS_DRQ));
+}
+
+static int dma_data_in(struct controller *ctrl, const struct ide_pio_command *cmd,
+	void *buffer, size_t bytes)
+{
+	struct ide_prd *prd = ide_prd_table;
+	unsigned long addr, len;
+	unsigned int status, bm_status;
+	int i, result = -1;
+
+	addr = virt_to_phys(buffer);
+	if (addr & 1) {
+		return -1;
+	}
+	for (i = 0; bytes > 0; i++) {
+		if (i == IDE_PRD_MAX) {
+			goto out;
+		}
+		len = 0x10000 - (addr & 0xffff);
+		if (len > bytes)
+			len = bytes;
+		prd[i].addr = addr;
+		prd[i].count = len;
+		prd[i].flags = 0;
+		addr += len;
+		bytes -= len;
+	}
+	prd[i - 1].flags = IDE_PRD_EOT;
+
+	/* Wait until the busy bit is clear */
+	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		goto out;
+	}
+	outl(virt_to_phys(prd), IDE_BM_PRD(ctrl));
+	outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+	/* Clear error and interrupt, they are cleared by writing 1 */
+	bm_status = inb(IDE_BM_STATUS(ctrl));
+	outb((bm_status & IDE_BM_STAT_DMA_CAP) |
+		IDE_BM_STAT_ERROR | IDE_BM_STAT_INTR, IDE_BM_STATUS(ctrl));
+	pio_set_registers(ctrl, cmd);
+	outb(IDE_BM_CMD_READ | IDE_BM_CMD_START, IDE_BM_COMMAND(ctrl));
+	ndelay(400);
+	/* Interrupts are disabled, so poll for the end of the transfer */
+	if (await_ide(dma_done, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+		goto out;
+	}
+	bm_status = inb(IDE_BM_STATUS(ctrl));
+	outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		goto out;
+	}
+	status = inb(IDE_REG_STATUS(ctrl));
+	if ((bm_status & (IDE_BM_STAT_ACTIVE | IDE_BM_STAT_ERROR)) ||
+		(status & (IDE_STATUS_ERR | IDE_STATUS_DF | IDE_STATUS_DRQ))) {
+		goto out;
+	}
+	result = 0;
+out:
+	return result;
+}
+
+/* Read count sectors with the fastest transfer the drive is set up for,
+ * cmd is a READ SECTORS (EXT) command */
+static int ide_data_in(struct harddisk_info *info, struct ide_pio_command *cmd,
+	void *buffer, int count)
+{
+	int lba48 = cmd->command == IDE_CMD_READ_SECTORS_EXT;
+
+	if (info->dma && info->ctrl->bm_base) {
+		cmd->command = lba48 ? IDE_CMD_READ_DMA_EXT : IDE_CMD_READ_DMA;
+		if (dma_data_in(info->ctrl, cmd, buffer,
+				count * IDE_SECTOR_SIZE) == 0)
+			return 0;
+		printf("IDE DMA failed, falling back to PIO\n");
+		info->dma = 0;
+	}
+	if (info->multiple) {
+		cmd->command = lba48 ? IDE_CMD_READ_MULTIPLE_EXT :
+			IDE_CMD_READ_MULTIPLE;
+		return pio_data_in(info->ctrl, cmd, buffer,
+			count * IDE_SECTOR_SIZE, info->multiple * IDE_SECTOR_SIZE);
+	}
+	cmd->command = lba48 ? IDE_CMD_READ_SECTORS_EXT : IDE_CMD_READ_SECTORS;
+	return pio_data_in(info->ctrl, cmd, buffer,
+		count * IDE_SECTOR_SIZE, IDE_SECTOR_SIZE);
+}
+
 #if 0
 static int pio_packet(struct controller *ctrl, int in,
 	const void *packet, int packet_len,
@@ -374,7 +510,8 @@ static int pio_packet(struct controller *ctrl, int in,
 #endif
 
 static inline int ide_read_sector_chs(
-	struct harddisk_info *info, void *buffer, unsigned long sector)
+	struct harddisk_info *info, void *buffer, unsigned long sector,
+	int count)
 {
 	struct ide_pio_command cmd;
 	unsigned int track;
@@ -382,7 +519,7 @@ static inline int ide_read_sector_chs(
 	unsigned int cylinder;
 		
 	memset(&cmd, 0, sizeof(cmd));
-	cmd.sector_count = 1;
+	cmd.sector_count = count;	/* 256 is written as 0 */
 
 	track = sector / info->sectors_per_track;
 	/* Sector number */
@@ -396,16 +533,17 @@ static inline int ide_read_sector_chs(
 		info->slave |
 		IDE_DH_CHS;
 	cmd.command = IDE_CMD_READ_SECTORS;
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
 }
 
 static inline int ide_read_sector_lba(
-	struct harddisk_info *info, void *buffer, unsigned long sector)
+	struct harddisk_info *info, void *buffer, unsigned long sector,
+	int count)
 {
 	struct ide_pio_command cmd;
 	memset(&cmd, 0, sizeof(cmd));
 
-	cmd.sector_count = 1;
+	cmd.sector_count = count;
 	cmd.lba_low = sector & 0xff;
 	cmd.lba_mid = (sector >> 8) & 0xff;
 	cmd.lba_high = (sector >> 16) & 0xff;
@@ -414,16 +552,18 @@ static inline int ide_read_sector_lba(
 		info->slave | 
 		IDE_DH_LBA;
 	cmd.command = IDE_CMD_READ_SECTORS;
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
 }
 
 static inline int ide_read_sector_lba48(
-	struct harddisk_info *info, void *buffer, sector_t sector)
+	struct harddisk_info *info, void *buffer, sector_t sector,
+	int count)
 {
 	struct ide_pio_command cmd;
 	memset(&cmd, 0, sizeof(cmd));
 
-	cmd.sector_count = 1;
+	cmd.sector_count = count & 0xff;
+	cmd.sector_count2 = (count >> 8) & 0xff;
 	cmd.lba_low = sector & 0xff;
 	cmd.lba_mid = (sector >> 8) & 0xff;
 	cmd.lba_high = (sector >> 16) & 0xff;
@@ -432,7 +572,7 @@ static inline int ide_read_sector_lba48(
 	cmd.lba_high2 = (sector >> 40) & 0xff;
 	cmd.device =  info->slave | IDE_DH_LBA;
 	cmd.command = IDE_CMD_READ_SECTORS_EXT;
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
 }
 
 
@@ -440,28 +580,34 @@ static int ide_read(struct disk *disk, sector_t sector)
 {
 	struct harddisk_info *info = disk->priv;
 	int result;
+	int count;
 
 	/* Report the buffer is empty */
 	disk->sector = 0;
 	disk->bytes = 0;
-	if (sector > info->sectors) {
+	if (sector >= info->sectors) {
 		return -1;
 	}
+	/* Fill the whole track cache, short at the end of the disk */
+	count = IDE_SECTORS_PER_READ;
+	if (info->sectors - sector < (sector_t)count) {
+		count = info->sectors - sector;
+	}
 	if (info->address_mode == ADDRESS_MODE_CHS) {
-		result = ide_read_sector_chs(info, disk->buffer, sector);
+		result = ide_read_sector_chs(info, disk->buffer, sector, count);
 	}
 	else if (info->address_mode == ADDRESS_MODE_LBA) {
-		result = ide_read_sector_lba(info, disk->buffer, sector);
+		result = ide_read_sector_lba(info, disk->buffer, sector, count);
 	}
 	else if (info->address_mode == ADDRESS_MODE_LBA48) {
-		result = ide_read_sector_lba48(info, disk->buffer, sector);
+		result = ide_read_sector_lba48(info, disk->buffer, sector, count);
 	}
 	else {
 		result = -1;
 	}
 	/* On success report the buffer has data */
 	if (result != -1) {
-		disk->bytes = IDE_SECTOR_SIZE;
+		disk->bytes = count * IDE_SECTOR_SIZE;
 		disk->sector = sector;
 	}
 	return result;
@@ -484,6 +630,8 @@ static int init_drive(struct harddisk_info *info, struct controller *ctrl, int s
 	info->slave_absent = 0;
 	info->slave = slave?IDE_DH_SLAVE: IDE_DH_MASTER;
 	info->basedrive = basedrive;
+	info->multiple = 0;
+	info->dma = 0;
 
 #if 0
 	printf("Testing for disk %d\n", info->basedrive);
@@ -522,7 +670,8 @@ static int init_drive(struct harddisk_info *info, struct controller *ctrl, int s
 	cmd.command = IDE_CMD_IDENTIFY_DEVICE;
 
 	
-	if (pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE) < 0) {
+	if (pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE,
+			IDE_SECTOR_SIZE) < 0) {
 		/* Well, if that command didn't work, we probably don't have drive. */
 		return 1;
 	}
@@ -548,7 +697,8 @@ static int init_drive(struct harddisk_info *info, struct controller *ctrl, int s
 		cmd.device = IDE_DH_DEFAULT | IDE_DH_HEAD(0) | IDE_DH_CHS |
 			info->slave;
 		cmd.command = IDE_CMD_IDENTIFY_DEVICE;
-		if(pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE) < 0) {
+		if(pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE,
+				IDE_SECTOR_SIZE) < 0) {
 			/* If the command didn't work give up on the drive. */
 			return 1;
 		}
@@ -616,10 +766,34 @@ static int init_drive(struct harddisk_info *info, struct controller *ctrl, int s
 			return 1;
 		}
 	}
-	printf("disk%d %dk cap: %hx\n",
+
+	/* Have the drive move several sectors per DRQ block */
+	i = drive_info[47] & 0xff;
+	if (i > IDE_MULTIPLE_MAX)
+		i = IDE_MULTIPLE_MAX;
+	while (i & (i - 1))
+		i &= i - 1;
+	if (i > 1) {
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.device = IDE_DH_DEFAULT | info->slave;
+		cmd.sector_count = i;
+		cmd.command = IDE_CMD_SET_MULTIPLE_MODE;
+		if (pio_non_data(ctrl, &cmd) == 0 &&
+			!(inb(IDE_REG_STATUS(ctrl)) & IDE_STATUS_ERR))
+			info->multiple = i;
+	}
+
+	/* Use DMA if the BIOS has selected a multiword or Ultra DMA
+	 * mode, the chipset timings are its business */
+	if ((drive_info[49] & (1 << 8)) &&
+		((drive_info[63] & 0x0700) ||
+		 ((drive_info[53] & (1 << 2)) && (drive_info[88] & 0x7f00))))
+		info->dma = 1;
+	printf("disk%d %dk cap: %hx%s\n",
 		info->basedrive,
 		(unsigned long)(info->sectors >> 1),
-		drive_info[49]);
+		drive_info[49],
+		(info->dma && ctrl->bm_base) ? " DMA" : "");
 	return 0;
 }
 
@@ -709,6 +883,7 @@ static int ide_pci_probe(struct dev *dev, struct pci_device *pci)
 	}
 	for(; index < 4; index++) {
 		unsigned mask;
+		uint32_t bm_base;
 		mask = (index < 2)? (1 << 0) : (1 << 2);
 		if ((pci->class & mask) == 0) {
 			/* IDE special pci mode */
@@ -732,6 +907,12 @@ static int ide_pci_probe(struct dev *dev, struct pci_device *pci)
 			controller.cmd_base  = cmd_base  & ~3;
 			controller.ctrl_base = ctrl_base & ~3;
 		}
+		/* Bus master registers, eight for each channel */
+		pcibios_read_config_dword(pci->bus, pci->devfn, PCI_BASE_ADDRESS_4, &bm_base);
+		controller.bm_base = 0;
+		if ((bm_base & PCI_BASE_ADDRESS_SPACE_IO) && (bm_base & ~3)) {
+			controller.bm_base = (bm_base & ~3) + ((index < 2)? 0 : 8);
+		}
 		if (((index & 1) == 0) || (dev->how_probe == PROBE_AWAKE)) {
 			if (init_controller(&controller, disk->drive, disk->buffer) < 0) {
 				/* nothing behind the controller */
@@ -744,7 +925,7 @@ static int ide_pci_probe(struct dev *dev, struct pci_device *pci)
 			continue;
 		}
 		disk->hw_sector_size   = IDE_SECTOR_SIZE;
-		disk->sectors_per_read = 1;
+		disk->sectors_per_read = IDE_SECTORS_PER_READ;
 		disk->sectors          = info->sectors;
 		dev->index   = index;
 		dev->disable = ide_disable;
@@ -852,6 +1033,7 @@ static int ide_isa_probe(struct dev * dev, unsigned short *probe_addrs)
 		if ((index & 1) == 0) {
 			controller.cmd_base = addr;
 			controller.ctrl_base = addr + IDE_REG_EXTENDED_OFFSET;
+			controller.bm_base = 0;
 			if (init_controller(&controller, disk->drive, disk->buffer) < 0) {
 				/* nothing behind the controller */
 				continue;
@@ -862,7 +1044,7 @@ static int ide_isa_probe(struct dev * dev, unsigned short *probe_addrs)
 			/* unknown drive */
 			return 0;
 		}
-		disk->sectors_per_read = 1;
+		disk->sectors_per_read = IDE_SECTORS_PER_READ;
 		disk->sectors = info->sectors;
 		dev->index   = index;
 		dev->disable = ide_disable;
@@ -59,7 +59,7 @@
 static void t3c515_wait(unsigned int nticks)
 {
 	unsigned int to = currticks() + nticks;
-	while (currticks() < to)
+	while ((long)(currticks() - to) < 0)
 		/* wait */ ;
 }
 #endif
@@ -659,7 +659,7 @@ static int t515_probe(struct dev *dev,
 			outw(EEPROM_Read + 7, ioaddr + Wn0EepromCmd);
 			/* Pause for at least 162 us. for the read to take place. */
 			for (timer = 4; timer >= 0; timer--) {
-				t3c515_wait(1);
+				t3c515_wait(USECS_TO_TICKS(55000));
 				if ((inw(ioaddr + Wn0EepromCmd) & 0x0200)
 				    == 0)
 					break;
@@ -739,7 +739,7 @@ corkscrew_probe1(int ioaddr, int irq, int product_index __unused,
 		outw(EEPROM_Read + i, ioaddr + Wn0EepromCmd);
 		/* Pause for at least 162 us. for the read to take place. */
 		for (timer = 4; timer >= 0; timer--) {
-			t3c515_wait(1);
+			t3c515_wait(USECS_TO_TICKS(55000));
 			if ((inw(ioaddr + Wn0EepromCmd) & 0x0200) == 0)
 				break;
 		}
@@ -131,7 +131,7 @@ static int wait_eeprom_ready(void)
 	   just in case EEPROM is ready when SI_BUSY in the
 	   PP_SelfST is clear */
 	while(readreg(PP_SelfST) & SI_BUSY) {
-		if (currticks() >= tmo)
+		if ((long)(currticks() - tmo) >= 0)
 			return -1; }
 	return 0;
 }
@@ -206,7 +206,7 @@ static void control_dc_dc(int on_not_off)
 	writereg(PP_SelfCTL, selfcontrol);
 
 	/* Wait for the DC/DC converter to power up - 1000ms */
-	while (currticks() < tmo);
+	while ((long)(currticks() - tmo) < 0);
 
 	return;
 }
@@ -230,7 +230,7 @@ static int detect_tp(void)
 
         /* Delay for the hardware to work out if the TP cable is
 	   present - 150ms */
-	for (tmo = currticks() + 4; currticks() < tmo; );
+	for (tmo = currticks() + USECS_TO_TICKS(220000); (long)(currticks() - tmo) < 0; );
 
 	if ((readreg(PP_LineST) & LINK_OK) == 0)
 		return 0;
@@ -275,9 +275,9 @@ static int send_test_pkt(struct nic *nic)
 	outw(ETH_ZLEN, eth_nic_base + TX_LEN_PORT);
 
 	/* Test to see if the chip has allocated memory for the packet */
-	for (tmo = currticks() + 2;
+	for (tmo = currticks() + USECS_TO_TICKS(110000);
 	     (readreg(PP_BusST) & READY_FOR_TX_NOW) == 0; )
-		if (currticks() >= tmo)
+		if ((long)(currticks() - tmo) >= 0)
 			return(0);
 
 	/* Write the contents of the packet */
@@ -286,7 +286,7 @@ static int send_test_pkt(struct nic *nic)
 
 	printf(" sending test packet ");
 	/* wait a couple of timer ticks for packet to be received */
-	for (tmo = currticks() + 2; currticks() < tmo; );
+	for (tmo = currticks() + USECS_TO_TICKS(110000); (long)(currticks() - tmo) < 0; );
 
 	if ((readreg(PP_TxEvent) & TX_SEND_OK_BITS) == TX_OK) {
 			printf("succeeded");
@@ -335,7 +335,7 @@ static void cs89x0_reset(struct nic *nic)
 	writereg(PP_SelfCTL, readreg(PP_SelfCTL) | POWER_ON_RESET);
 
 	/* wait for two ticks; that is 2*55ms */
-	for (reset_tmo = currticks() + 2; currticks() < reset_tmo; );
+	for (reset_tmo = currticks() + USECS_TO_TICKS(110000); (long)(currticks() - reset_tmo) < 0; );
 
 	if (eth_cs_type != CS8900) {
 		/* Hardware problem requires PNP registers to be reconfigured
@@ -351,9 +351,9 @@ static void cs89x0_reset(struct nic *nic)
 			outb((eth_mem_start >> 24) & 0xff, eth_nic_base + DATA_PORT + 1); } }
 
 	/* Wait until the chip is reset */
-	for (reset_tmo = currticks() + 2;
+	for (reset_tmo = currticks() + USECS_TO_TICKS(110000);
 	     (readreg(PP_SelfST) & INIT_DONE) == 0 &&
-		     currticks() < reset_tmo; );
+		     (long)(currticks() - reset_tmo) < 0; );
 
 	/* disable interrupts and memory accesses */
 	writereg(PP_BusCTL, 0);
@@ -410,7 +410,7 @@ retry:
 	if ((readreg(PP_BusST) & READY_FOR_TX_NOW) == 0) {
 		/* Oops... this should not happen! */
 		printf("cs: unable to send packet; retrying...\n");
-		for (tmo = currticks() + 5*TICKS_PER_SEC; currticks() < tmo; );
+		for (tmo = currticks() + 5*TICKS_PER_SEC; (long)(currticks() - tmo) < 0; );
 		cs89x0_reset(nic);
 		goto retry; }
 
@@ -425,7 +425,7 @@ retry:
 
 	/* wait for transfer to succeed */
 	for (tmo = currticks()+5*TICKS_PER_SEC;
-	     (s = readreg(PP_TxEvent)&~0x1F) == 0 && currticks() < tmo;)
+	     (s = readreg(PP_TxEvent)&~0x1F) == 0 && (long)(currticks() - tmo) < 0;)
 		/* nothing */ ;
 	if ((s & TX_SEND_OK_BITS) != TX_OK) {
 		printf("\ntransmission error %#hX\n", s);
@@ -188,7 +188,7 @@ static void davicom_more()
 static void davicom_wait(unsigned int nticks)
 {
   unsigned int to = currticks() + nticks;
-  while (currticks() < to)
+  while ((long)(currticks() - to) < 0)
     /* wait */ ;
 }
 
@@ -355,7 +355,7 @@ static void davicom_media_chk(struct nic * nic __unused)
   } else {
     /* For DM9102/DM9102A */
     to = currticks() + 2 * TICKS_PER_SEC;
-    while ( ((phy_read(1) & 0x24)!=0x24) && (currticks() < to))
+    while ( ((phy_read(1) & 0x24)!=0x24) && ((long)(currticks() - to) < 0))
       /* wait */ ;
 
     if ( (phy_read(1) & 0x24) == 0x24 ) {
@@ -506,10 +506,10 @@ static void davicom_reset(struct nic *nic)
   outl(0, ioaddr + CSR1);
 
   to = currticks() + TX_TIME_OUT;
-  while ((txd[TxPtr].status & 0x80000000) && (currticks() < to)) /* Sten 10/9 */
+  while ((txd[TxPtr].status & 0x80000000) && ((long)(currticks() - to) < 0)) /* Sten 10/9 */
     /* wait */ ;
 
-  if (currticks() >= to) {
+  if ((long)(currticks() - to) >= 0) {
     printf ("TX Setup Timeout!\n");
   }
   /* Point to next TX descriptor */
@@ -557,10 +557,10 @@ static void davicom_transmit(struct nic *nic, const char *d, unsigned int t,
   outl(0, ioaddr + CSR1);
 
   to = currticks() + TX_TIME_OUT;
-  while ((txd[TxPtr].status & 0x80000000) && (currticks() < to))
+  while ((txd[TxPtr].status & 0x80000000) && ((long)(currticks() - to) < 0))
     /* wait */ ;
 
-  if (currticks() >= to) {
+  if ((long)(currticks() - to) >= 0) {
     printf ("TX Timeout!\n");
   }
  
@@ -87,19 +87,21 @@ typedef enum {
 
 #include "e1000_hw.h"
 
-#define RX_BUFS		8
+#define RX_BUFS		32	/* must be a multiple of 8 */
 #define MAX_PACKET	2096
+#define TX_BUFS		16	/* must be a multiple of 8 */
 
 /* NIC specific static variables go here */
 static struct e1000_hw hw;
-static char tx_pool[128 + 16];
-static char rx_pool[128 + 16];
+static char tx_pool[TX_BUFS * sizeof(struct e1000_tx_desc) + 16];
+static char rx_pool[RX_BUFS * sizeof(struct e1000_rx_desc) + 16];
 static char packets[MAX_PACKET * RX_BUFS];
+static char tx_packets[ETH_FRAME_LEN * TX_BUFS];
 
 static struct e1000_tx_desc *tx_base;
 static struct e1000_rx_desc *rx_base;
 
-static int tx_tail;
+static int tx_tail, tx_last, tx_pending;
 static int rx_tail, rx_last;
 
 /* Function forward declarations */
@@ -3617,7 +3619,7 @@ static void fill_rx (void)
 	rd = rx_base + rx_tail;
 	memset (rd, 0, 16);
 	rd->buffer_addr = virt_to_bus(&packets[MAX_PACKET*(rx_tail%RX_BUFS)]);
-	rx_tail = (rx_tail + 1) % 8;
+	rx_tail = (rx_tail + 1) % RX_BUFS;
 	E1000_WRITE_REG (&hw, RDT, rx_tail);
 }
 
@@ -3635,13 +3637,15 @@ static void init_descriptor (void)
 
 	E1000_WRITE_REG (&hw, TDBAL, virt_to_bus(tx_base));
 	E1000_WRITE_REG (&hw, TDBAH, 0);
-	E1000_WRITE_REG (&hw, TDLEN, 128);
+	E1000_WRITE_REG (&hw, TDLEN, TX_BUFS * sizeof(struct e1000_tx_desc));
 
 	/* Setup the HW Tx Head and Tail descriptor pointers */
 
 	E1000_WRITE_REG (&hw, TDH, 0);
 	E1000_WRITE_REG (&hw, TDT, 0);
 	tx_tail = 0;
+	tx_last = 0;
+	tx_pending = 0;
 
 	/* Program the Transmit Control Register */
 
@@ -3663,6 +3667,7 @@ static void init_descriptor (void)
 
 
 	rx_tail = 0;
+	rx_last = 0;
 	/* disable receive */
 	E1000_WRITE_REG (&hw, RCTL, 0);
 	ptr = virt_to_phys(rx_pool);
@@ -3675,7 +3680,7 @@ static void init_descriptor (void)
 	E1000_WRITE_REG (&hw, RDBAL, virt_to_bus(rx_base));
 	E1000_WRITE_REG (&hw, RDBAH, 0);
 
-	E1000_WRITE_REG (&hw, RDLEN, 128);
+	E1000_WRITE_REG (&hw, RDLEN, RX_BUFS * sizeof(struct e1000_rx_desc));
 
 	/* Setup the HW Rx Head and Tail Descriptor Pointers */
 	E1000_WRITE_REG (&hw, RDH, 0);
@@ -3686,7 +3691,8 @@ static void init_descriptor (void)
 		E1000_RCTL_BAM | 
 		E1000_RCTL_SZ_2048 | 
 		E1000_RCTL_MPE);
-	for (i = 0; i < RX_BUFS; i++)
+	/* Keep one descriptor back: head == tail means an empty ring */
+	for (i = 0; i < RX_BUFS - 1; i++)
 		fill_rx();
 }
 
@@ -3699,23 +3705,22 @@ static int
 e1000_poll (struct nic *nic, int retrieve)
 {
 	/* return true if there's an ethernet packet ready to read */
-	/* nic->packet should contain data on return */
+	/* nic->packet points at the receive buffer on return, */
+	/* which stays ours until e1000_rx_release() */
 	/* nic->packetlen should contain length of data */
 	struct e1000_rx_desc *rd;
-	char *packet = &packets[MAX_PACKET*(rx_last%RX_BUFS)];
 	uint32_t icr;
 
 	rd = rx_base + rx_last;
-	if (!rd->status & E1000_RXD_STAT_DD)
+	if (!(rd->status & E1000_RXD_STAT_DD))
 		return 0;
 
 	if ( ! retrieve ) return 1;
 
 	//      printf("recv: packet %! -> %! len=%d \n", packet+6, packet,rd->Length);
-	memcpy (nic->packet, packet, rd->length);
+	nic->packet = (unsigned char *)&packets[MAX_PACKET*rx_last];
 	nic->packetlen = rd->length;
-	rx_last = (rx_last + 1) %8;
-	fill_rx ();
+	rx_last = (rx_last + 1) % RX_BUFS;
 
 	/* Acknowledge interrupt. */
 	icr = E1000_READ_REG(&hw, ICR);
@@ -3724,43 +3729,93 @@ e1000_poll (struct nic *nic, int retrieve)
 }
 
 /**************************************************************************
-TRANSMIT - Transmit a frame
+RX_RELEASE - Give the buffer of the last received frame back to the NIC
 ***************************************************************************/
 static void
-e1000_transmit (struct nic *nic, const char *d,	/* Destination */
+e1000_rx_release (struct nic *nic __unused)
+{
+	/* Re-arming lags one descriptor behind, so the buffer of the
+	 * frame just handed out is not given back before now */
+	fill_rx ();
+}
+
+/**************************************************************************
+TX_QUEUE - Put a frame on the transmit ring, without starting the NIC
+***************************************************************************/
+static int
+e1000_tx_queue (struct nic *nic, const char *d,	/* Destination */
 		    unsigned int type,	/* Type */
 		    unsigned int size,	/* size */
 		    const char *p)	/* Packet */
 {
-	/* send the packet to destination */
-	struct eth_hdr {
-		unsigned char dst_addr[ETH_ALEN];
-		unsigned char src_addr[ETH_ALEN];
-		unsigned short type;
-	} hdr;
-	struct e1000_tx_desc *txhd;	/* header */
-	struct e1000_tx_desc *txp;	/* payload */
-	DEBUGFUNC("send");
+	struct e1000_tx_desc *txd;
+	char *packet;
+	DEBUGFUNC("queue");
 
-	memcpy (&hdr.dst_addr, d, ETH_ALEN);
-	memcpy (&hdr.src_addr, nic->node_addr, ETH_ALEN);
+	/* One descriptor stays unused: head == tail means an empty ring */
+	if (tx_pending >= TX_BUFS - 1)
+		return 0;
 
-	hdr.type = htons (type);
-	txhd = tx_base + tx_tail;
-	tx_tail = (tx_tail + 1) % 8;
-	txp = tx_base + tx_tail;
-	tx_tail = (tx_tail + 1) % 8;
+	/* The frame is copied, the caller's buffer may go away before the
+	 * NIC gets around to sending it */
+	packet = &tx_packets[ETH_FRAME_LEN*tx_tail];
+	memcpy (packet, d, ETH_ALEN);
+	memcpy (packet + ETH_ALEN, nic->node_addr, ETH_ALEN);
+	packet[2*ETH_ALEN] = type >> 8;
+	packet[2*ETH_ALEN+1] = type;
+	memcpy (packet + ETH_HLEN, p, size);
+
+	txd = tx_base + tx_tail;
+	txd->buffer_addr = virt_to_bus (packet);
+	txd->lower.data = E1000_TXD_CMD_RPS | E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | (ETH_HLEN + size);
+	txd->upper.data = 0;
+
+	tx_tail = (tx_tail + 1) % TX_BUFS;
+	tx_pending++;
+	return 1;
+}
 
-	txhd->buffer_addr = virt_to_bus (&hdr);
-	txhd->lower.data = sizeof (hdr);
-	txhd->upper.data = 0;
+/**************************************************************************
+TX_KICK - Let the NIC send all queued frames
+***************************************************************************/
+static void
+e1000_tx_kick (struct nic *nic __unused)
+{
+	E1000_WRITE_REG (&hw, TDT, tx_tail);
+}
 
-	txp->buffer_addr = virt_to_bus(p);
-	txp->lower.data = E1000_TXD_CMD_RPS | E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | size;
-	txp->upper.data = 0;
+/**************************************************************************
+TX_REAP - Reclaim descriptors of sent frames
+***************************************************************************/
+static int
+e1000_tx_reap (struct nic *nic __unused)
+{
+	while (tx_pending &&
+	       ((tx_base + tx_last)->upper.data & E1000_TXD_STAT_DD)) {
+		tx_last = (tx_last + 1) % TX_BUFS;
+		tx_pending--;
+	}
+	return tx_pending;
+}
 
-	E1000_WRITE_REG (&hw, TDT, tx_tail);
-	while (!(txp->upper.data & E1000_TXD_STAT_DD)) {
+/**************************************************************************
+TRANSMIT - Transmit a frame
+***************************************************************************/
+static void
+e1000_transmit (struct nic *nic, const char *d,	/* Destination */
+		    unsigned int type,	/* Type */
+		    unsigned int size,	/* size */
+		    const char *p)	/* Packet */
+{
+	/* send the packet to destination */
+	DEBUGFUNC("send");
+
+	while (!e1000_tx_queue (nic, d, type, size, p)) {
+		e1000_tx_kick (nic);
+		e1000_tx_reap (nic);
+	}
+	e1000_tx_kick (nic);
+	while (e1000_tx_reap (nic)) {
 		udelay(10);	/* give the nic a chance to write to the register */
 		poll_interruptions();
 	}
@@ -3926,7 +3981,11 @@ static int e1000_probe(struct dev *dev, struct pci_device *p)
 	/* point to NIC specific routines */
 	dev->disable  = e1000_disable;
 	nic->poll     = e1000_poll;
+	nic->rx_release = e1000_rx_release;
 	nic->transmit = e1000_transmit;
+	nic->tx_queue = e1000_tx_queue;
+	nic->tx_kick  = e1000_tx_kick;
+	nic->tx_reap  = e1000_tx_reap;
 	nic->irq      = e1000_irq;
 
 	return 1;
@@ -257,7 +257,7 @@ static int ib_driver_close(int fw_fatal)
 	return ret;
 }
 
-static int poll_cqe_tout(cq_t cqh, __u16 tout, void **wqe, int *good_p)
+static int poll_cqe_tout(cq_t cqh, unsigned long tout, void **wqe, int *good_p)
 {
 	int rc;
 	struct ib_cqe_st ib_cqe;
@@ -279,7 +279,7 @@ static int poll_cqe_tout(cq_t cqh, __u16 tout, void **wqe, int *good_p)
 			return 0;
 		}
 	}
-	while (currticks() < end);
+	while ((long)(currticks() - end) < 0);
 
 	return -1;
 }
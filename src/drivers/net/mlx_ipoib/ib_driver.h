@@ -36,8 +36,8 @@
 
 #define FL_EOL 255		/* end of free list */
 
-#define SEND_CQE_POLL_TOUT 38	/* 2 sec */
-#define SA_RESP_POLL_TOUT 91	/* 5 seconds */
+#define SEND_CQE_POLL_TOUT (2*TICKS_PER_SEC)
+#define SA_RESP_POLL_TOUT (5*TICKS_PER_SEC)
 
 #define NUM_AVS 10
 
@@ -156,7 +156,7 @@ static void free_ud_av(ud_av_t av);
 static int ib_poll_cq(cq_t cq, struct ib_cqe_st *ib_cqe_p, __u8 * num_cqes);
 static int add_qp_to_mcast_group(union ib_gid_u mcast_gid, __u8 add);
 static int clear_interrupt(void);
-static int poll_cqe_tout(cq_t cqh, __u16 tout, void **wqe, int *good_p);
+static int poll_cqe_tout(cq_t cqh, unsigned long tout, void **wqe, int *good_p);
 
 static void *get_inprm_buf(void);
 static void *get_outprm_buf(void);
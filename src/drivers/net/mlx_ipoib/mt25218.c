@@ -29,7 +29,7 @@ int prompt_key(int secs, unsigned char *ch_p)
 	unsigned long tmo;
 	unsigned char ch;
 
-	for (tmo = currticks() + secs * TICKS_PER_SEC; currticks() < tmo;) {
+	for (tmo = currticks() + secs * TICKS_PER_SEC; (long)(currticks() - tmo) < 0;) {
 		if (iskey()) {
 			ch = getchar();
 			/* toupper does not work ... */
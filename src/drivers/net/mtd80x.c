@@ -55,7 +55,7 @@
 
 /* Operational parameters that usually are not changed. */
 /* Time in jiffies before concluding the transmitter is hung. */
-#define HZ 100
+#define HZ TICKS_PER_SEC	/* timeouts below are in currticks() */
 #define TX_TIME_OUT   (6*HZ)
 
 /* Allocation size of Rx buffers with normal sized Ethernet frames.
@@ -615,13 +615,13 @@ static void mtd_transmit(
     outl(0, mtdx.ioaddr + TXPDR);
 
     to = currticks() + TX_TIME_OUT;
-    while(( mtdx.tx_ring[0].status & TXOWN) && (currticks() < to));
+    while(( mtdx.tx_ring[0].status & TXOWN) && ((long)(currticks() - to) < 0));
 
     /* Disable Tx */
     outl( mtdx.crvalue & (~TxEnable), mtdx.ioaddr + TCRRCR);
 
     tx_status = mtdx.tx_ring[0].status;
-    if (currticks() >= to){
+    if ((long)(currticks() - to) >= 0){
         DBGPRNT(("TX Time Out"));
     } else if( tx_status & (CSL | LC | EC | UDF | HF)){
         printf("Transmit error: %s %s %s %s %s.\n",
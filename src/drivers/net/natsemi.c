@@ -639,10 +639,10 @@ natsemi_transmit(struct nic  *nic,
 
     to = currticks() + TX_TIMEOUT;
 
-    while ((((volatile u32) (tx_status=txd.cmdsts)) & OWN) && (currticks() < to))
+    while ((((volatile u32) (tx_status=txd.cmdsts)) & OWN) && ((long)(currticks() - to) < 0))
         /* wait */ ;
 
-    if (currticks() >= to) {
+    if ((long)(currticks() - to) >= 0) {
         printf("natsemi_transmit: TX Timeout! Tx status %X.\n", tx_status);
     }
 
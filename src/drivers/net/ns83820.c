@@ -53,7 +53,7 @@
 #define dprintf(x)
 #endif
 
-#define HZ 100
+#define HZ TICKS_PER_SEC	/* timeouts below are in currticks() */
 
 /* Condensed operations for readability. */
 #define virt_to_le32desc(addr)  cpu_to_le32(virt_to_bus(addr))
@@ -350,7 +350,7 @@ static void eth_rx_overrun(struct nic *nic)
 
 	/* wait for at least 1.6ms - we wait one timer tick */
 	start_time = currticks();
-	while (currticks() - start_time <= 1)
+	while (currticks() - start_time <= USECS_TO_TICKS(55000))
 		/* Nothing */;
 
 	outb(0, eth_nic_base+D8390_P0_RBCR0);	/* reset byte counter */
@@ -626,7 +626,7 @@ static void pcnet32_transmit(struct nic *nic __unused, const char *d,	/* Destina
 	/* wait for transmit complete */
 	lp->cur_tx = 0;		/* (lp->cur_tx + 1); */
 	time = currticks() + TICKS_PER_SEC;	/* wait one second */
-	while (currticks() < time &&
+	while ((long)(currticks() - time) < 0 &&
 	       ((short) le16_to_cpu(tx_ring[entry].status) < 0));
 
 	if ((short) le16_to_cpu(tx_ring[entry].status) < 0)
@@ -97,7 +97,7 @@
 #define DBGP(...)
 #endif
 
-#define HZ 1000
+#define HZ TICKS_PER_SEC	/* timeouts below are in currticks() */
 #define TX_TIMEOUT  (6*HZ)
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
@@ -227,7 +227,7 @@
 #define R8169_NAPI_WEIGHT	64
 
 #define NUM_TX_DESC	2	/* Number of Tx descriptor registers */
-#define NUM_RX_DESC	4	/* Number of Rx descriptor registers */
+#define NUM_RX_DESC	16	/* Number of Rx descriptor registers */
 
 #define RX_BUF_SIZE	1536	/* Rx Buffer size */
 #define TX_BUF_SIZE	1536	/* Rx Buffer size */
@@ -615,7 +615,7 @@ struct RxDesc {
  **/
 
 static u8 tx_ring[NUM_TX_DESC * sizeof(struct TxDesc) + 256];
-static u8 rx_ring[NUM_RX_DESC * sizeof(struct TxDesc) + 256];
+static u8 rx_ring[NUM_RX_DESC * sizeof(struct RxDesc) + 256];
 
 static unsigned char txb[NUM_TX_DESC * TX_BUF_SIZE];
 static unsigned char rxb[NUM_RX_DESC * RX_BUF_SIZE];
@@ -651,6 +651,7 @@ struct rtl8169_private {
 
 	unsigned long cur_rx;
 	unsigned long cur_tx;
+	unsigned long held_rx;	/* Rx descriptor lent out through nic->packet */
 
 	struct TxDesc *TxDescArray;	/* Ptr to 256-byte-aligned Tx Descriptor Ring */
 	struct RxDesc *RxDescArray;	/* Ptr to 256-byte-aligned Rx Descriptor Ring */
@@ -2338,6 +2339,27 @@ r8169_irq ( struct nic *nic __unused, irq_action_t action )
 	}
 }
 
+/**
+ * rx_refill - give an Rx descriptor and its buffer back to the NIC
+ **/
+static void
+r8169_rx_refill ( unsigned int entry )
+{
+        tp->RxDescArray[entry].vlan_tag = 0;
+
+        tp->RxDescArray[entry].buf_Haddr = 0;
+
+	tp->RxBufferRing[entry] = &rxb[entry * RX_BUF_SIZE];
+        tp->RxDescArray[entry].buf_addr =
+                virt_to_bus ( tp->RxBufferRing[entry] );
+
+        tp->RxDescArray[entry].status =
+                ( ( entry == ( NUM_RX_DESC - 1 ) ) ? EORbit : 0 ) |
+                RX_BUF_SIZE;
+
+        tp->RxDescArray[entry].status |= OWNbit;
+}
+
 /**
  * poll - check for packet and retrieve if requested
  *
@@ -2347,7 +2369,8 @@ r8169_irq ( struct nic *nic __unused, irq_action_t action )
  *    available, return 1, but do not consume the packet
  *
  * If there is a packet ready:
- *     nic->packet should contain data on return
+ *     nic->packet points to the Rx buffer, which stays
+ *         ours until r8169_rx_release() is called
  *     nic->packetlen should contain length of data
  **/
 static int 
@@ -2380,13 +2403,15 @@ r8169_poll ( struct nic *nic, int retrieve )
 		if ( retrieve == 0 )
 			return rc;
 
+		tp->cur_rx = (cur_rx + 1) % NUM_RX_DESC;
+
                 /* Packet received without error */
 		if ( ! (tp->RxDescArray[cur_rx].status & RxRES ) ) {
 
 			nic->packetlen = (int) ( tp->RxDescArray[cur_rx].
 						status & 0x00001FFF ) - 4;
-			memcpy ( nic->packet, tp->RxBufferRing[cur_rx],
-			       nic->packetlen );
+			nic->packet = tp->RxBufferRing[cur_rx];
+			tp->held_rx = cur_rx;
                         DBG ( "RX %d bytes\n", nic->packetlen );
 
 		} else {
@@ -2396,30 +2421,26 @@ r8169_poll ( struct nic *nic, int retrieve )
 
                         /* Indicate that no valid packet was received */
                         rc = 0;
-                }
-
-                /* Prepare descriptor for next packet */
-
-                tp->RxDescArray[cur_rx].vlan_tag = 0;
-
-                tp->RxDescArray[cur_rx].buf_Haddr = 0;
-
-		tp->RxBufferRing[cur_rx] = &rxb[cur_rx * RX_BUF_SIZE];
-                tp->RxDescArray[cur_rx].buf_addr =
-                        virt_to_bus ( tp->RxBufferRing[cur_rx] );
-
-                tp->RxDescArray[cur_rx].status =
-                        ( ( cur_rx == ( NUM_RX_DESC - 1 ) ) ? EORbit : 0 ) |
-                        RX_BUF_SIZE;
-
-                tp->RxDescArray[cur_rx].status |= OWNbit;
-
-		tp->cur_rx = (cur_rx + 1) % NUM_RX_DESC;
 
+                        /* Prepare descriptor for next packet */
+                        r8169_rx_refill ( cur_rx );
+                }
 	}
 	return rc;
 }
 
+/**
+ * rx_release - return the Rx buffer handed out by the last poll
+ **/
+static void
+r8169_rx_release ( struct nic *nic __unused )
+{
+	DBGP ( "r8169_rx_release\n" );
+
+        /* Prepare descriptor for next packet */
+        r8169_rx_refill ( tp->held_rx );
+}
+
 static void 
 r8169_transmit ( struct nic *nic, 
                  const char *d,	   /* Destination */
@@ -2463,11 +2484,11 @@ r8169_transmit ( struct nic *nic,
 
 	to = currticks() + TX_TIMEOUT;
 	while ( ( tp->TxDescArray[entry].status & OWNbit) && 
-                ( currticks() < to ) ) {
+                ( (long)(currticks() - to) < 0 ) ) {
                 RTL_R8 ( ChipCmd );   /* wait */
         }
 
-	if ( currticks () >= to ) {
+	if ( (long)(currticks() - to) >= 0 ) {
 		DBG ( "TX Time Out!\n" );
                 return;
 	}
@@ -2574,6 +2595,7 @@ r8169_probe ( struct dev *dev, struct pci_device *pdev )
 
 	nic->transmit = r8169_transmit;
 	nic->poll = r8169_poll;
+	nic->rx_release = r8169_rx_release;
 	nic->irq = r8169_irq;
 	dev->disable = r8169_disable;
 
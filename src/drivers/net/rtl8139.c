@@ -401,7 +401,7 @@ static void rtl_transmit(struct nic *nic, const char *destaddr,
 		 * rtl_poll() function.  */
 		outw(status & (TxOK | TxErr | PCIErr), nic->ioaddr + IntrStatus);
 		if ((status & (TxOK | TxErr | PCIErr)) != 0) break;
-	} while (currticks() < to);
+	} while ((long)(currticks() - to) < 0);
 
 	txstatus = inl(nic->ioaddr+ TxStatus0 + cur_tx*4);
 
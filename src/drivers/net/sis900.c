@@ -1133,10 +1133,10 @@ sis900_transmit(struct nic  *nic,
 
     to = currticks() + TX_TIMEOUT;
 
-    while ((((volatile u32) (tx_status=txd.cmdsts)) & OWN) && (currticks() < to))
+    while ((((volatile u32) (tx_status=txd.cmdsts)) & OWN) && ((long)(currticks() - to) < 0))
         /* wait */ ;
 
-    if (currticks() >= to) {
+    if ((long)(currticks() - to) >= 0) {
         printf("sis900_transmit: TX Timeout! Tx status %X.\n", tx_status);
     }
     
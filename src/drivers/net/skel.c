@@ -51,6 +51,12 @@ static int skel_poll(struct nic *nic, int retrieve)
 	   return 1;
 	*/
 
+	/* Cards with a ring of receive buffers can avoid the copy by
+	 * pointing nic->packet at the buffer instead and providing
+	 * nic->rx_release, which gets called to give the buffer back to
+	 * the card once the frame has been dealt with.
+	 */
+
 	return 0;	/* Remove this line once this method is implemented */
 }
 
@@ -651,7 +651,7 @@ static void smc9000_transmit(
 
       status = 0;
       /* wait for the memory allocation to finnish */
-      for (time_out = currticks() + 5*TICKS_PER_SEC; currticks() < time_out; ) {
+      for (time_out = currticks() + 5*TICKS_PER_SEC; (long)(currticks() - time_out) < 0; ) {
 	 status = inb(smc9000_base + INTERRUPT);
 	 if ( status & IM_ALLOC_INT ) {
 	    /* acknowledge the interrupt */
@@ -752,7 +752,7 @@ static void smc9000_transmit(
 
 	 return;
       }
-   }while(currticks() < time_out);
+   }while((long)(currticks() - time_out) < 0);
 
    printf("SMC9000: Waring TX timed out, resetting board\n");
    smc_reset(smc9000_base);
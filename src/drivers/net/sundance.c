@@ -52,7 +52,7 @@
 #define drv_version "v1.12"
 #define drv_date "2004-03-21"
 
-#define HZ 100
+#define HZ TICKS_PER_SEC	/* timeouts below are in currticks() */
 
 /* Condensed operations for readability. */
 #define virt_to_le32desc(addr)  cpu_to_le32(virt_to_bus(addr))
@@ -535,9 +535,9 @@ static void sundance_transmit(struct nic *nic, const char *d,	/* Destination */
 	outw(0, BASE + TxStatus);
 
 	to = currticks() + TX_TIME_OUT;
-	while (!(tx_ring[0].status & 0x00010000) && (currticks() < to));	/* wait */
+	while (!(tx_ring[0].status & 0x00010000) && ((long)(currticks() - to) < 0));	/* wait */
 
-	if (currticks() >= to) {
+	if ((long)(currticks() - to) >= 0) {
 		printf("TX Time Out");
 	}
 	/* Disable Tx */
@@ -39,7 +39,9 @@ struct tg3 tg3;
  * them in the NIC onboard memory.
  */
 #define TG3_RX_RING_SIZE		512
-#define TG3_DEF_RX_RING_PENDING		20	/* RX_RING_PENDING seems to be o.k. at 20 and 200 */
+/* RX_RING_PENDING seems to be o.k. at 20 and 200.  It must divide the ring
+ * size, so that a refilled descriptor always gets the buffer just returned */
+#define TG3_DEF_RX_RING_PENDING		64
 #define TG3_RX_RCB_RING_SIZE	1024
 
 /*	(GET_ASIC_REV(tp->pci_chip_rev_id) == ASIC_REV_5705 ? \
@@ -3162,7 +3164,8 @@ static void tg3_ack_irqs(struct tg3 *tp)
 static int tg3_poll(struct nic *nic, int retrieve)
 {
 	/* return true if there's an ethernet packet ready to read */
-	/* nic->packet should contain data on return */
+	/* nic->packet points at the receive buffer on return, */
+	/* the buffer is only reposted in tg3_rx_release() */
 	/* nic->packetlen should contain length of data */
 
 	struct tg3 *tp = &tg3;
@@ -3183,24 +3186,30 @@ static int tg3_poll(struct nic *nic, int retrieve)
 			len = ((desc->idx_len & RXD_LEN_MASK) >> RXD_LEN_SHIFT) - 4; /* omit crc */
 			
 			nic->packetlen = len;
-			memcpy(nic->packet, bus_to_virt(desc->addr_lo), len);
+			nic->packet = bus_to_virt(desc->addr_lo);
 			result = 1;
 		}
 		tp->rx_rcb_ptr = (tp->rx_rcb_ptr + 1) % TG3_RX_RCB_RING_SIZE;
 		
 		/* ACK the status ring */
 		tw32_mailbox2(MAILBOX_RCVRET_CON_IDX_0 + TG3_64BIT_REG_LOW, tp->rx_rcb_ptr);
-
-		/* Refill RX ring. */
-		if (result) {
-			tp->rx_std_ptr = (tp->rx_std_ptr + 1) % TG3_RX_RING_SIZE;
-			tw32_mailbox2(MAILBOX_RCV_STD_PROD_IDX + TG3_64BIT_REG_LOW, tp->rx_std_ptr);
-		}
 	}
 	tg3_poll_link(tp);
 	return result;
 }
 
+/**************************************************************************
+RX_RELEASE - Repost the buffer of the last received frame
+***************************************************************************/
+static void tg3_rx_release(struct nic *nic __unused)
+{
+	struct tg3 *tp = &tg3;
+
+	/* Refill RX ring. */
+	tp->rx_std_ptr = (tp->rx_std_ptr + 1) % TG3_RX_RING_SIZE;
+	tw32_mailbox2(MAILBOX_RCV_STD_PROD_IDX + TG3_64BIT_REG_LOW, tp->rx_std_ptr);
+}
+
 /**************************************************************************
 TRANSMIT - Transmit a frame
 ***************************************************************************/
@@ -3222,29 +3231,80 @@ static void tg3_set_txd(struct tg3 *tp, int entry,
 }
 #endif
 
-static void tg3_transmit(struct nic *nic, const char *dst_addr,
+/* Frames which may be in flight at once, must divide the ring size */
+#define TG3_TX_FRAMES	8
+
+static struct eth_frame {
+	uint8_t  dst_addr[ETH_ALEN];
+	uint8_t  src_addr[ETH_ALEN];
+	uint16_t type;
+	uint8_t  data [ETH_FRAME_LEN - ETH_HLEN];
+} tg3_tx_frame[TG3_TX_FRAMES];
+
+static int tg3_tx_queue(struct nic *nic, const char *dst_addr,
 	unsigned int type, unsigned int size, const char *packet)
 {
-	static struct eth_frame {
-		uint8_t  dst_addr[ETH_ALEN];
-		uint8_t  src_addr[ETH_ALEN];
-		uint16_t type;
-		uint8_t  data [ETH_FRAME_LEN - ETH_HLEN];
-	} frame[2];
-	static int frame_idx;
-	
-	/* send the packet to destination */
 	struct tg3_tx_buffer_desc *txd;
-	struct tg3 *tp;
+	struct tg3 *tp = &tg3;
+	struct eth_frame *frame;
 	uint32_t entry;
+
+	entry = tp->tx_prod;
+	if (((entry - tp->hw_status->idx[0].tx_consumer) &
+		(TG3_TX_RING_SIZE - 1)) >= TG3_TX_FRAMES) {
+		/* All frame buffers are still in use */
+		return 0;
+	}
+
+	/* Copy the packet to the our local buffer */
+	frame = &tg3_tx_frame[entry % TG3_TX_FRAMES];
+	memcpy(&frame->dst_addr, dst_addr, ETH_ALEN);
+	memcpy(&frame->src_addr, nic->node_addr, ETH_ALEN);
+	frame->type = htons(type);
+	memset(&frame->data, 0, sizeof(frame->data));
+	memcpy(&frame->data, packet, size);
+
+	/* Setup the ring buffer entry to transmit */
+	txd            = &tp->tx_ring[entry];
+	txd->addr_hi   = 0; /* Etherboot runs under 4GB */
+	txd->addr_lo   = virt_to_bus(frame);
+	txd->len_flags = ((size + ETH_HLEN) << TXD_LEN_SHIFT) | TXD_FLAG_END;
+	txd->vlan_tag  = 0 << TXD_VLAN_TAG_SHIFT;
+
+	/* Advance to the next entry */
+	tp->tx_prod = NEXT_TX(entry);
+	return 1;
+}
+
+static void tg3_tx_kick(struct nic *nic __unused)
+{
+	struct tg3 *tp = &tg3;
+
+	/* Packets are ready, update Tx producer idx on card */
+	tw32_mailbox((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), tp->tx_prod);
+	tw32_mailbox2((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), tp->tx_prod);
+}
+
+static int tg3_tx_reap(struct nic *nic __unused)
+{
+	struct tg3 *tp = &tg3;
+
+	/* The card keeps the consumer index in the status block */
+	return (tp->tx_prod - tp->hw_status->idx[0].tx_consumer) &
+		(TG3_TX_RING_SIZE - 1);
+}
+
+static void tg3_transmit(struct nic *nic, const char *dst_addr,
+	unsigned int type, unsigned int size, const char *packet)
+{
+	struct tg3 *tp;
 	int i;
 
 	/* Wait until there is a free packet frame */
 	tp = &tg3;
 	i = 0;
-	entry = tp->tx_prod;
-	while((tp->hw_status->idx[0].tx_consumer != entry) &&
-		(tp->hw_status->idx[0].tx_consumer != PREV_TX(entry))) {
+	while (!tg3_tx_queue(nic, dst_addr, type, size, packet)) {
+		tg3_tx_kick(nic);
 		mdelay(10);	/* give the nick a chance */
 		poll_interruptions();
 		if (++i > 500) { /* timeout 5s for transmit */
@@ -3257,29 +3317,7 @@ static void tg3_transmit(struct nic *nic, const char *dst_addr,
 	if (i != 0) {
 		printf("#");
 	}
-	
-	/* Copy the packet to the our local buffer */
-	memcpy(&frame[frame_idx].dst_addr, dst_addr, ETH_ALEN);
-	memcpy(&frame[frame_idx].src_addr, nic->node_addr, ETH_ALEN);
-	frame[frame_idx].type = htons(type);
-	memset(&frame[frame_idx].data, 0, sizeof(frame[frame_idx].data));
-	memcpy(&frame[frame_idx].data, packet, size);
-
-	/* Setup the ring buffer entry to transmit */
-	txd            = &tp->tx_ring[entry];
-	txd->addr_hi   = 0; /* Etherboot runs under 4GB */
-	txd->addr_lo   = virt_to_bus(&frame[frame_idx]);
-	txd->len_flags = ((size + ETH_HLEN) << TXD_LEN_SHIFT) | TXD_FLAG_END;
-	txd->vlan_tag  = 0 << TXD_VLAN_TAG_SHIFT;
-
-	/* Advance to the next entry */
-	entry = NEXT_TX(entry);
-	frame_idx ^= 1;
-
-	/* Packets are ready, update Tx producer idx local and on card */
-	tw32_mailbox((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), entry);
-	tw32_mailbox2((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), entry);
-	tp->tx_prod = entry;
+	tg3_tx_kick(nic);
 }
 
 /**************************************************************************
@@ -3441,7 +3479,11 @@ static int tg3_probe(struct dev *dev, struct pci_device *pdev)
 
 	dev->disable  = tg3_disable;
 	nic->poll     = tg3_poll;
+	nic->rx_release = tg3_rx_release;
 	nic->transmit = tg3_transmit;
+	nic->tx_queue = tg3_tx_queue;
+	nic->tx_kick  = tg3_tx_kick;
+	nic->tx_reap  = tg3_tx_reap;
 	nic->irq      = tg3_irq;
 
 	return 1;
@@ -51,7 +51,7 @@
 #define drv_date "01-17-2004"
 
 /* NIC specific static variables go here */
-#define HZ 100
+#define HZ TICKS_PER_SEC	/* timeouts below are in currticks() */
 #define TX_TIME_OUT	  (6*HZ)
 
 /* Condensed operations for readability. */
@@ -666,7 +666,7 @@ static void tlan_transmit(struct nic *nic, const char *d,	/* Destination */
 	dprintf(("INT2-0x%hX\n", inw(BASE + TLAN_HOST_INT)));
 
 	to = currticks() + TX_TIME_OUT;
-	while ((tail_list->cStat == TLAN_CSTAT_READY) && currticks() < to);
+	while ((tail_list->cStat == TLAN_CSTAT_READY) && (long)(currticks() - to) < 0);
 
 	head_list = priv->txList + priv->txHead;
 	while (((tmpCStat = head_list->cStat) & TLAN_CSTAT_FRM_CMP) 
@@ -710,7 +710,7 @@ static void tlan_transmit(struct nic *nic, const char *d,	/* Destination */
 		
 	}
 			
-	if (currticks() >= to) {
+	if ((long)(currticks() - to) >= 0) {
 		printf("TX Time Out");
 	}
 }
@@ -535,7 +535,7 @@ static void tulip_more(void)
 static void tulip_wait(unsigned int nticks)
 {
     unsigned int to = currticks() + nticks;
-    while (currticks() < to)
+    while ((long)(currticks() - to) < 0)
         /* wait */ ;
 }
 
@@ -978,13 +978,13 @@ static void tulip_reset(struct nic *nic)
  
     /* Reset the chip, holding bit 0 set at least 50 PCI cycles. */
     outl(0x00000001, ioaddr + CSR0);
-    tulip_wait(1);
+    tulip_wait(USECS_TO_TICKS(55000));
 
     /* turn off reset and set cache align=16lword, burst=unlimit */
     outl(tp->csr0, ioaddr + CSR0);
 
     /*  Wait the specified 50 PCI cycles after a reset */
-    tulip_wait(1);
+    tulip_wait(USECS_TO_TICKS(55000));
 
     /* set up transmit and receive descriptors */
     tulip_init_ring(nic);
@@ -1057,10 +1057,10 @@ static void tulip_reset(struct nic *nic)
 	outl(0, ioaddr + CSR1);
 
 	to = currticks() + TX_TIME_OUT;
-	while ((tx_ring[0].status & 0x80000000) && (currticks() < to))
+	while ((tx_ring[0].status & 0x80000000) && ((long)(currticks() - to) < 0))
 	    /* wait */ ;
 
-	if (currticks() >= to) {
+	if ((long)(currticks() - to) >= 0) {
 	    printf ("%s: TX Setup Timeout.\n", tp->nic_name);
 	}
     }
@@ -1124,10 +1124,10 @@ static void tulip_transmit(struct nic *nic, const char *d, unsigned int t,
     outl(0, ioaddr + CSR1);
 
     to = currticks() + TX_TIME_OUT;
-    while ((tx_ring[0].status & 0x80000000) && (currticks() < to))
+    while ((tx_ring[0].status & 0x80000000) && ((long)(currticks() - to) < 0))
         /* wait */ ;
 
-    if (currticks() >= to) {
+    if ((long)(currticks() - to) >= 0) {
         printf ("TX Timeout!\n");
     }
 
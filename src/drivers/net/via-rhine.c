@@ -1078,8 +1078,8 @@ rhine_probe1 (struct nic *nic, struct pci_device *pci, int ioaddr, int chip_id,
     for (i = 0; i < 5; i++)
     {
 	/* need to wait 1 millisecond - we will round it up to 50-100ms */
-	timeout = currticks() + 2;
-	for (timeout = currticks() + 2; currticks() < timeout;)
+	timeout = currticks() + USECS_TO_TICKS(110000);
+	for (timeout = currticks() + USECS_TO_TICKS(110000); (long)(currticks() - timeout) < 0;)
 	    /* nothing */;
 	if (ReadMII (1, ioaddr) & 0x0020)
 	    break;
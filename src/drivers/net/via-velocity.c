@@ -521,7 +521,7 @@ static int velocity_poll(struct nic *nic __unused, int retrieve)
 	return 0;
 }
 
-#define TX_TIMEOUT  (1000);
+#define TX_TIMEOUT  (2*TICKS_PER_SEC)
 /**************************************************************************
 TRANSMIT - Transmit a frame
 ***************************************************************************/
@@ -600,9 +600,9 @@ static void velocity_transmit(struct nic *nic, const char *dest,	/* Destination
 	}
 
 	to = currticks() + TX_TIMEOUT;
-	while ((td_ptr->tdesc0.owner & OWNED_BY_NIC) && (currticks() < to));	/* wait */
+	while ((td_ptr->tdesc0.owner & OWNED_BY_NIC) && ((long)(currticks() - to) < 0));	/* wait */
 
-	if (currticks() >= to) {
+	if ((long)(currticks() - to) >= 0) {
 		printf("TX Time Out");
 	}
 }
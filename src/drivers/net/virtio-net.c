@@ -49,16 +49,23 @@ struct eth_frame {
 
 typedef unsigned char virtio_queue_t[PAGE_MASK + vring_size(MAX_QUEUE_NUM)];
 
-/* TX: virtio header and eth buffer */
+/* TX: virtio header (shared, it is always the same) and eth buffers */
 
+#define TX_BUF_NB  8
 static struct virtio_net_hdr tx_virtio_hdr;
-static struct eth_frame tx_eth_frame;
+static struct eth_frame tx_eth_frame[TX_BUF_NB];
+static unsigned int tx_len[TX_BUF_NB];
+static int tx_busy[TX_BUF_NB];
+static int tx_buf_nb;	/* buffers usable with the queue size we got */
+static int tx_inflight;	/* frames queued and not yet reaped */
+static int tx_added;	/* frames queued and not yet kicked */
 
 /* RX: virtio headers and buffers */
 
-#define RX_BUF_NB  6
+#define RX_BUF_NB  32
 static struct virtio_net_hdr rx_hdr[RX_BUF_NB];
 static unsigned char rx_buffer[RX_BUF_NB][ETH_FRAME_LEN];
+static u16 rx_held;	/* buffer lent out through nic->packet */
 
 /* virtio queues and vrings */
 
@@ -218,7 +225,7 @@ static void vring_add_buf(int queue_index, int index, int num_added)
 
    if (queue_index == TX_INDEX) {
 
-           BUG_ON(index != 0);
+           BUG_ON(index >= TX_BUF_NB);
 
            /* add header into vring */
 
@@ -230,8 +237,8 @@ static void vring_add_buf(int queue_index, int index, int num_added)
            /* add frame buffer into vring */
 
            vr->desc[i].flags = 0;
-           vr->desc[i].addr = (u64)virt_to_phys(&tx_eth_frame);
-           vr->desc[i].len = ETH_FRAME_LEN;
+           vr->desc[i].addr = (u64)virt_to_phys(&tx_eth_frame[index]);
+           vr->desc[i].len = tx_len[index];
            i = vr->desc[i].next;
 
    } else if (queue_index == RX_INDEX) {
@@ -300,7 +307,8 @@ static void virtnet_disable(struct dev *dev)
  *
  * return true if there is a packet ready to read
  *
- * nic->packet should contain data on return
+ * nic->packet points to the receive buffer on return,
+ * it goes back to the device in virtnet_rx_release()
  * nic->packetlen should contain length of data
  *
  */
@@ -323,32 +331,47 @@ static int virtnet_poll(struct nic *nic, int retrieve)
    hdr = &rx_hdr[token];   /* FIXME: check flags */
    len -= sizeof(struct virtio_net_hdr);
 
-        nic->packetlen = len;
-   memcpy(nic->packet, (char *)rx_buffer[token], nic->packetlen);
+   nic->packetlen = len;
+   nic->packet = rx_buffer[token];
+   rx_held = token;
+
+   return 1;
+}
 
+/*
+ * virtnet_rx_release
+ *
+ * Give the buffer of the last received frame back to the device
+ *
+ */
+static void virtnet_rx_release(struct nic *nic)
+{
    /* add buffer to desc */
 
-   vring_add_buf(RX_INDEX, token, 0);
+   vring_add_buf(RX_INDEX, rx_held, 0);
    vring_kick(nic, RX_INDEX, 1);
-
-   return 1;
 }
 
 /*
  *
- * virtnet_transmit
+ * virtnet_tx_queue
  *
- * Transmit a frame
+ * Put a frame into the TX queue, without notifying the device
+ *
+ * return false if all TX buffers are in use
  *
  */
 
-static void virtnet_transmit(struct nic *nic, const char *destaddr,
+static int virtnet_tx_queue(struct nic *nic, const char *destaddr,
         unsigned int type, unsigned int len, const char *data)
 {
-   /*
-    * from http://www.etherboot.org/wiki/dev/devmanual :
-    *     "You do not need more than one transmit buffer."
-    */
+   int index;
+
+   for (index = 0; index < tx_buf_nb; index++)
+           if (!tx_busy[index])
+                   break;
+   if (index == tx_buf_nb)
+           return 0;
 
    /* FIXME: initialize header according to vp_get_features() */
 
@@ -361,16 +384,74 @@ static void virtnet_transmit(struct nic *nic, const char *destaddr,
 
    /* add ethernet frame into vring */
 
-   BUG_ON(len > sizeof(tx_eth_frame.data));
+   BUG_ON(len > sizeof(tx_eth_frame[index].data));
+
+   memcpy(tx_eth_frame[index].hdr.dst_addr, destaddr, ETH_ALEN);
+   memcpy(tx_eth_frame[index].hdr.src_addr, nic->node_addr, ETH_ALEN);
+   tx_eth_frame[index].hdr.type = htons(type);
+   memcpy(tx_eth_frame[index].data, data, len);
+   tx_len[index] = ETH_HLEN + len;
 
-   memcpy(tx_eth_frame.hdr.dst_addr, destaddr, ETH_ALEN);
-   memcpy(tx_eth_frame.hdr.src_addr, nic->node_addr, ETH_ALEN);
-   tx_eth_frame.hdr.type = htons(type);
-   memcpy(tx_eth_frame.data, data, len);
+   vring_add_buf(TX_INDEX, index, tx_added);
 
-   vring_add_buf(TX_INDEX, 0, 0);
+   tx_busy[index] = 1;
+   tx_added++;
+   tx_inflight++;
 
-   vring_kick(nic, TX_INDEX, 1);
+   return 1;
+}
+
+/*
+ *
+ * virtnet_tx_kick
+ *
+ * Notify the device of the frames queued so far
+ *
+ */
+
+static void virtnet_tx_kick(struct nic *nic)
+{
+   if (tx_added) {
+           vring_kick(nic, TX_INDEX, tx_added);
+           tx_added = 0;
+   }
+}
+
+/*
+ *
+ * virtnet_tx_reap
+ *
+ * Free the buffers of frames the device is done with
+ *
+ * return the number of frames still in flight
+ *
+ */
+
+static int virtnet_tx_reap(struct nic *nic __unused)
+{
+   while (vring_more_used(TX_INDEX)) {
+           tx_busy[vring_get_buf(TX_INDEX, NULL)] = 0;
+           tx_inflight--;
+   }
+   return tx_inflight;
+}
+
+/*
+ *
+ * virtnet_transmit
+ *
+ * Transmit a frame
+ *
+ */
+
+static void virtnet_transmit(struct nic *nic, const char *destaddr,
+        unsigned int type, unsigned int len, const char *data)
+{
+   while (!virtnet_tx_queue(nic, destaddr, type, len, data)) {
+           virtnet_tx_kick(nic);
+           virtnet_tx_reap(nic);
+   }
+   virtnet_tx_kick(nic);
 
    /*
     * http://www.etherboot.org/wiki/dev/devmanual
@@ -379,15 +460,11 @@ static void virtnet_transmit(struct nic *nic, const char *destaddr,
     *    before returning from this routine"
     */
 
-   while (!vring_more_used(TX_INDEX)) {
+   while (virtnet_tx_reap(nic)) {
            mb();
            udelay(10);
            poll_interruptions();
    }
-
-   /* free desc */
-
-   (void)vring_get_buf(TX_INDEX, NULL);
 }
 
 static void virtnet_irq(struct nic *nic __unused, irq_action_t action)
@@ -410,7 +487,9 @@ static void provide_buffers(struct nic *nic)
 {
    int i;
 
-   for (i = 0; i < RX_BUF_NB; i++)
+   /* each buffer takes two descriptors, header and frame */
+
+   for (i = 0; i < RX_BUF_NB && 2 * (i + 1) <= (int)vring[RX_INDEX].num; i++)
            vring_add_buf(RX_INDEX, i, i);
 
    /* nofify */
@@ -462,6 +541,16 @@ static int virtnet_probe(struct dev *dev, struct pci_device *pci)
                    printf("Cannot register queue #%d\n", i);
    }
 
+   /* each TX buffer takes two descriptors, header and frame */
+
+   tx_buf_nb = vring[TX_INDEX].num / 2;
+   if (tx_buf_nb > TX_BUF_NB)
+           tx_buf_nb = TX_BUF_NB;
+   for (i = 0; i < TX_BUF_NB; i++)
+           tx_busy[i] = 0;
+   tx_inflight = 0;
+   tx_added = 0;
+
    /* provide some receive buffers */
 
     provide_buffers(nic);
@@ -470,7 +559,11 @@ static int virtnet_probe(struct dev *dev, struct pci_device *pci)
 
    dev->disable = virtnet_disable;
    nic->poll = virtnet_poll;
+   nic->rx_release = virtnet_rx_release;
    nic->transmit = virtnet_transmit;
+   nic->tx_queue = virtnet_tx_queue;
+   nic->tx_kick = virtnet_tx_kick;
+   nic->tx_reap = virtnet_tx_reap;
    nic->irq = virtnet_irq;
 
    /* driver is ready */
@@ -0,0 +1,446 @@
+/*
+ * AHCI SATA disk driver.
+ *
+ * Reads are DMA through a single port at a time; large reads are split
+ * into commands of AHCI_MAX_SECTORS that the drive gets all at once with
+ * native command queuing when both it and the HBA support it.
+ *
+ * The port is only given our command list while a read is in progress,
+ * the BIOS's is put back afterwards so int13 keeps working and the HBA
+ * has nowhere to DMA once the loaded image runs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ */
+
+#include <etherboot.h>
+#include <pci.h>
+#include <timer.h>
+#include <lib.h>
+#include <fs.h>
+
+#define DEBUG_THIS DEBUG_AHCI
+#include <debug.h>
+
+#define AHCI_MAX_CONTROLLERS 4
+#define AHCI_MAX_DRIVES 8
+
+/* Commands queued at once with NCQ */
+#define AHCI_SLOTS 8
+/* Sectors read by each command */
+#define AHCI_MAX_SECTORS 128
+
+#define AHCI_SECTOR_SIZE 0x200
+
+#define AHCI_TIMEOUT (32*TICKS_PER_SEC)
+#define AHCI_STOP_TIMEOUT (TICKS_PER_SEC/2)
+
+/* HBA registers */
+#define AHCI_CAP	0x00
+#define   AHCI_CAP_NCS(cap)	((((cap) >> 8) & 0x1f) + 1)
+#define   AHCI_CAP_SNCQ		(1UL << 30)
+#define AHCI_GHC	0x04
+#define   AHCI_GHC_AE		(1UL << 31)
+#define AHCI_PI		0x0c
+
+/* Port registers */
+#define AHCI_PORT(abar, port)	((abar) + 0x100 + (port) * 0x80)
+#define PxCLB		0x00
+#define PxCLBU		0x04
+#define PxFB		0x08
+#define PxFBU		0x0c
+#define PxIS		0x10
+#define   PxIS_TFES		(1UL << 30)
+#define PxCMD		0x18
+#define   PxCMD_ST		(1UL << 0)
+#define   PxCMD_FRE		(1UL << 4)
+#define   PxCMD_FR		(1UL << 14)
+#define   PxCMD_CR		(1UL << 15)
+#define PxTFD		0x20
+#define   PxTFD_ERR		0x01
+#define   PxTFD_DRQ		0x08
+#define   PxTFD_BSY		0x80
+#define PxSIG		0x24
+#define   SIG_ATA		0x00000101
+#define PxSSTS		0x28
+#define   PxSSTS_DET_PRESENT	3
+#define PxSERR		0x30
+#define PxSACT		0x34
+#define PxCI		0x38
+
+#define ATA_CMD_READ_DMA		0xC8
+#define ATA_CMD_READ_DMA_EXT		0x25
+#define ATA_CMD_READ_FPDMA_QUEUED	0x60
+#define ATA_CMD_IDENTIFY_DEVICE		0xEC
+
+#define FIS_TYPE_REG_H2D	0x27
+#define FIS_H2D_CMD		0x80	/* the FIS carries a command */
+#define FIS_DEV_LBA		0x40
+
+struct ahci_cmd_header {
+	uint32_t opts;		/* FIS length in dwords, PRD count << 16 */
+	uint32_t prdbc;		/* bytes transferred */
+	uint32_t ctba;
+	uint32_t ctbau;
+	uint32_t reserved[4];
+};
+
+struct ahci_prd {
+	uint32_t dba;
+	uint32_t dbau;
+	uint32_t reserved;
+	uint32_t dbc;		/* byte count - 1 */
+};
+
+/* Aligned as the HBA wants, which also pads it to 256 bytes */
+struct ahci_cmd_table {
+	uint8_t cfis[64];
+	uint8_t acmd[16];
+	uint8_t reserved[48];
+	struct ahci_prd prd[1];
+} __attribute__ ((aligned (128)));
+
+struct ahci_disk {
+	uint8_t *abar;
+	uint8_t *port;
+	int port_no;
+	uint32_t cap;
+	sector_t sectors;
+	int lba48;
+	int ncq;		/* queue depth, 0 without NCQ */
+	uint8_t model_number[41];
+};
+
+static struct ahci_cmd_header cmd_list[32] __attribute__ ((aligned (1024)));
+static uint8_t rx_fis[256] __attribute__ ((aligned (256)));
+static struct ahci_cmd_table cmd_table[AHCI_SLOTS];
+static uint16_t ahci_buffer[AHCI_SECTOR_SIZE / 2];
+
+static struct ahci_disk ahci_disks[AHCI_MAX_DRIVES];
+static int ahci_ndisks = -1;
+
+/* What the BIOS had on the port while we use it */
+static uint32_t saved_clb, saved_fb, saved_cmd;
+
+#define port_read(d, reg)	readl((d)->port + (reg))
+#define port_write(d, val, reg)	writel((val), (d)->port + (reg))
+
+static int await_port(struct ahci_disk *d, int reg, uint32_t mask,
+	unsigned long timeout)
+{
+	timeout += currticks();
+	while (port_read(d, reg) & mask) {
+		if ((long)(currticks() - timeout) > 0) {
+			printf("AHCI time out\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int ahci_port_stop(struct ahci_disk *d)
+{
+	uint32_t cmd;
+
+	cmd = port_read(d, PxCMD);
+	if (cmd & PxCMD_ST) {
+		port_write(d, cmd & ~PxCMD_ST, PxCMD);
+		if (await_port(d, PxCMD, PxCMD_CR, AHCI_STOP_TIMEOUT) < 0)
+			return -1;
+	}
+	cmd = port_read(d, PxCMD);
+	if (cmd & PxCMD_FRE) {
+		port_write(d, cmd & ~PxCMD_FRE, PxCMD);
+		if (await_port(d, PxCMD, PxCMD_FR, AHCI_STOP_TIMEOUT) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Point the port at our command list and start it */
+static int ahci_port_start(struct ahci_disk *d)
+{
+	uint32_t cmd;
+
+	saved_cmd = port_read(d, PxCMD);
+	saved_clb = port_read(d, PxCLB);
+	saved_fb = port_read(d, PxFB);
+	if (ahci_port_stop(d) < 0)
+		return -1;
+
+	port_write(d, virt_to_phys(cmd_list), PxCLB);
+	port_write(d, 0, PxCLBU);
+	port_write(d, virt_to_phys(rx_fis), PxFB);
+	port_write(d, 0, PxFBU);
+	port_write(d, ~0UL, PxSERR);
+	port_write(d, ~0UL, PxIS);
+
+	cmd = port_read(d, PxCMD) | PxCMD_FRE;
+	port_write(d, cmd, PxCMD);
+	if (await_port(d, PxTFD, PxTFD_BSY | PxTFD_DRQ, AHCI_TIMEOUT) < 0)
+		return -1;
+	port_write(d, cmd | PxCMD_ST, PxCMD);
+	return 0;
+}
+
+/* Stop the port and give it back to the BIOS */
+static void ahci_port_release(struct ahci_disk *d)
+{
+	if (ahci_port_stop(d) < 0)
+		return;
+	port_write(d, saved_clb, PxCLB);
+	port_write(d, saved_fb, PxFB);
+	if (saved_cmd & PxCMD_FRE) {
+		port_write(d, port_read(d, PxCMD) | PxCMD_FRE, PxCMD);
+		if (saved_cmd & PxCMD_ST)
+			port_write(d, port_read(d, PxCMD) | PxCMD_ST, PxCMD);
+	}
+}
+
+/* Build the command in slot for count sectors from sector into buf */
+static void ahci_fill(int slot, int command,
+	sector_t sector, int count, void *buf, int bytes)
+{
+	struct ahci_cmd_header *hdr = &cmd_list[slot];
+	struct ahci_cmd_table *tbl = &cmd_table[slot];
+	uint8_t *fis = tbl->cfis;
+
+	memset(tbl, 0, sizeof(*tbl));
+	fis[0] = FIS_TYPE_REG_H2D;
+	fis[1] = FIS_H2D_CMD;
+	fis[2] = command;
+	fis[4] = sector & 0xff;
+	fis[5] = (sector >> 8) & 0xff;
+	fis[6] = (sector >> 16) & 0xff;
+	if (command == ATA_CMD_IDENTIFY_DEVICE) {
+		fis[7] = 0;
+	} else if (command == ATA_CMD_READ_DMA) {
+		fis[7] = FIS_DEV_LBA | ((sector >> 24) & 0x0f);
+		fis[12] = count & 0xff;
+	} else {
+		fis[7] = FIS_DEV_LBA;
+		fis[8] = (sector >> 24) & 0xff;
+		fis[9] = (sector >> 32) & 0xff;
+		fis[10] = (sector >> 40) & 0xff;
+		if (command == ATA_CMD_READ_FPDMA_QUEUED) {
+			/* The count goes in the features, the tag in
+			 * the count */
+			fis[3] = count & 0xff;
+			fis[11] = (count >> 8) & 0xff;
+			fis[12] = slot << 3;
+		} else {
+			fis[12] = count & 0xff;
+			fis[13] = (count >> 8) & 0xff;
+		}
+	}
+	tbl->prd[0].dba = virt_to_phys(buf);
+	tbl->prd[0].dbc = bytes - 1;
+
+	hdr->opts = 5 | (1 << 16);
+	hdr->prdbc = 0;
+	hdr->ctba = virt_to_phys(tbl);
+	hdr->ctbau = 0;
+}
+
+/* Issue the commands in slots and wait for them all to finish */
+static int ahci_issue(struct ahci_disk *d, uint32_t slots, int queued)
+{
+	unsigned long timeout;
+
+	if (queued)
+		port_write(d, slots, PxSACT);
+	port_write(d, slots, PxCI);
+
+	timeout = currticks() + AHCI_TIMEOUT;
+	while ((port_read(d, PxCI) | port_read(d, PxSACT)) & slots) {
+		if (port_read(d, PxIS) & PxIS_TFES)
+			goto err;
+		if ((long)(currticks() - timeout) > 0) {
+			printf("AHCI time out\n");
+			return -1;
+		}
+	}
+	if (!(port_read(d, PxIS) & PxIS_TFES))
+		return 0;
+err:
+	debug("task file error, tfd=%#x\n", port_read(d, PxTFD));
+	return -1;
+}
+
+static int ahci_identify(struct ahci_disk *d)
+{
+	uint16_t *id = ahci_buffer;
+	int i, result;
+
+	if (ahci_port_start(d) < 0) {
+		ahci_port_release(d);
+		return -1;
+	}
+	ahci_fill(0, ATA_CMD_IDENTIFY_DEVICE, 0, 0, id, AHCI_SECTOR_SIZE);
+	result = ahci_issue(d, 1, 0);
+	ahci_port_release(d);
+	if (result < 0)
+		return -1;
+
+	for (i = 27; i < 47; i++) {
+		d->model_number[(i-27) << 1] = (id[i] >> 8) & 0xff;
+		d->model_number[((i-27) << 1) + 1] = id[i] & 0xff;
+	}
+	d->model_number[40] = '\0';
+
+	if (id[83] & (1 << 10)) {
+		d->lba48 = 1;
+		d->sectors = ((sector_t)id[103] << 48) |
+			((sector_t)id[102] << 32) |
+			((sector_t)id[101] << 16) |
+			((sector_t)id[100] << 0);
+	} else {
+		d->lba48 = 0;
+		d->sectors = ((sector_t)id[61] << 16) | id[60];
+	}
+
+	/* Queue only as deep as the HBA, the drive and we go */
+	d->ncq = 0;
+	if ((d->cap & AHCI_CAP_SNCQ) && d->lba48 && (id[76] & (1 << 8))) {
+		d->ncq = (id[75] & 0x1f) + 1;
+		if (d->ncq > (int) AHCI_CAP_NCS(d->cap))
+			d->ncq = AHCI_CAP_NCS(d->cap);
+		if (d->ncq > AHCI_SLOTS)
+			d->ncq = AHCI_SLOTS;
+	}
+	return 0;
+}
+
+/* Find the disks on all AHCI controllers, sda is the first one found */
+static void ahci_scan(void)
+{
+	struct pci_device *dev;
+	struct ahci_disk *d;
+	uint8_t *abar;
+	uint32_t bar, pi;
+	uint16_t command;
+	int index, port;
+
+	ahci_ndisks = 0;
+	for (index = 0; index < AHCI_MAX_CONTROLLERS; index++) {
+		dev = pci_find_device(-1, -1, 0x0106, 0x01, index);
+		if (!dev)
+			break;
+		pci_read_config_dword(dev, PCI_BASE_ADDRESS_5, &bar);
+		if ((bar & PCI_BASE_ADDRESS_SPACE_IO) || !(bar & ~0xf)) {
+			debug("AHCI #%d has no ABAR\n", index);
+			continue;
+		}
+		pci_read_config_word(dev, PCI_COMMAND, &command);
+		command |= PCI_COMMAND_MEM | PCI_COMMAND_MASTER;
+		pci_write_config_word(dev, PCI_COMMAND, command);
+
+		abar = phys_to_virt(bar & ~0xf);
+		writel(readl(abar + AHCI_GHC) | AHCI_GHC_AE, abar + AHCI_GHC);
+		pi = readl(abar + AHCI_PI);
+		debug("AHCI #%d abar=%#x pi=%#x\n", index, bar & ~0xf, pi);
+
+		for (port = 0; port < 32; port++) {
+			if (!(pi & (1UL << port)))
+				continue;
+			if (ahci_ndisks == AHCI_MAX_DRIVES)
+				return;
+			d = &ahci_disks[ahci_ndisks];
+			d->abar = abar;
+			d->port = AHCI_PORT(abar, port);
+			d->port_no = port;
+			d->cap = readl(abar + AHCI_CAP);
+			if ((port_read(d, PxSSTS) & 0xf) != PxSSTS_DET_PRESENT)
+				continue;
+			if (port_read(d, PxSIG) != SIG_ATA) {
+				debug("port %d: not a disk\n", port);
+				continue;
+			}
+			if (ahci_identify(d) < 0) {
+				printf("AHCI port %d: IDENTIFY failed\n", port);
+				continue;
+			}
+			printf("sd%c: AHCI port %d %s", 'a' + ahci_ndisks,
+				port, d->lba48 ? "LBA48" : "LBA");
+			if (d->ncq)
+				printf(" NCQ%d", d->ncq);
+			printf(": %s\n", d->model_number);
+			ahci_ndisks++;
+		}
+	}
+}
+
+int ahci_probe(int drive)
+{
+	if (ahci_ndisks < 0)
+		ahci_scan();
+	if (drive >= ahci_ndisks) {
+		printf("Drive %d does not exist\n", drive);
+		return -1;
+	}
+	return 0;
+}
+
+/* The HBA ignores bit 0 of the data address, so a buffer at an odd
+ * address is filled a sector at a time through ahci_buffer */
+static int ahci_read_bounce(struct ahci_disk *d, sector_t sector, int count,
+	uint8_t *buf)
+{
+	for (; count > 0; count--, sector++, buf += AHCI_SECTOR_SIZE) {
+		ahci_fill(0, d->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA,
+			sector, 1, ahci_buffer, AHCI_SECTOR_SIZE);
+		if (ahci_issue(d, 1, 0) < 0)
+			return -1;
+		memcpy(buf, ahci_buffer, AHCI_SECTOR_SIZE);
+	}
+	return 0;
+}
+
+/* Read count sectors into buffer, AHCI_MAX_SECTORS per command and as
+ * many commands at once as the queue allows */
+int ahci_read(int drive, sector_t sector, int count, void *buffer)
+{
+	struct ahci_disk *d = &ahci_disks[drive];
+	uint8_t *buf = buffer;
+	uint32_t slots;
+	int slot, depth, n, result = 0;
+
+	if (drive >= ahci_ndisks || sector + count > d->sectors)
+		return -1;
+	if (ahci_port_start(d) < 0) {
+		ahci_port_release(d);
+		return -1;
+	}
+	if (virt_to_phys(buf) & 1) {
+		result = ahci_read_bounce(d, sector, count, buf);
+		ahci_port_release(d);
+		return result;
+	}
+	depth = d->ncq ? d->ncq : 1;
+	while (count > 0 && result == 0) {
+		slots = 0;
+		for (slot = 0; slot < depth && count > 0; slot++) {
+			n = count > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : count;
+			ahci_fill(slot,
+				d->ncq ? ATA_CMD_READ_FPDMA_QUEUED :
+				d->lba48 ? ATA_CMD_READ_DMA_EXT :
+				ATA_CMD_READ_DMA,
+				sector, n, buf, n * AHCI_SECTOR_SIZE);
+			slots |= 1UL << slot;
+			buf += n * AHCI_SECTOR_SIZE;
+			sector += n;
+			count -= n;
+		}
+		result = ahci_issue(d, slots, d->ncq);
+	}
+	if (result < 0 && d->ncq) {
+		/* Recovering a queued error needs READ LOG EXT, it is
+		 * simpler to stop queuing */
+		printf("AHCI NCQ read failed, disabling NCQ\n");
+		d->ncq = 0;
+	}
+	ahci_port_release(d);
+	return result;
+}
@@ -36,6 +36,7 @@
 struct controller {
 	uint16_t cmd_base;
 	uint16_t ctrl_base;
+	uint16_t bm_base;	/* bus master DMA registers, 0 if none */
 };
 
 struct harddisk_info {
@@ -52,6 +53,8 @@ struct harddisk_info {
 #define ADDRESS_MODE_LBA48  2
 #define ADDRESS_MODE_PACKET 3
 	uint32_t hw_sector_size;
+	uint8_t  multiple;	/* sectors per READ MULTIPLE block, 0 if off */
+	unsigned dma : 1;
 	unsigned drive_exists : 1;
 	unsigned slave_absent : 1;
 	unsigned removable : 1;
@@ -59,6 +62,15 @@ struct harddisk_info {
 
 #define IDE_SECTOR_SIZE 0x200
 #define CDROM_SECTOR_SIZE 0x800
+/* Largest byte count limit of a PACKET command that is a whole number
+ * of CD-ROM sectors */
+#define ATAPI_BYTE_LIMIT (31*CDROM_SECTOR_SIZE)
+/* Most sectors read by one command, the sector count register of a
+ * 28 bit command wraps at 256 */
+#define IDE_MAX_MULTI 256
+#define IDE_MAX_MULTI48 2048
+/* Largest READ MULTIPLE block asked for */
+#define IDE_MULTIPLE_MAX 16
 
 #define IDE_BASE0             (0x1F0u) /* primary controller */
 #define IDE_BASE1             (0x170u) /* secondary */
@@ -87,6 +99,33 @@ struct harddisk_info {
 #define IDE_REG_ALTSTATUS(ctrl)      ((ctrl)->ctrl_base + 2u)
 #define IDE_REG_DEVICE_CONTROL(ctrl) ((ctrl)->ctrl_base + 2u)
 
+/* PCI bus master IDE (SFF-8038i) */
+#define IDE_BM_COMMAND(ctrl)         ((ctrl)->bm_base + 0u)
+#define IDE_BM_STATUS(ctrl)          ((ctrl)->bm_base + 2u)
+#define IDE_BM_PRD(ctrl)             ((ctrl)->bm_base + 4u)
+
+#define IDE_BM_CMD_START	0x01
+#define IDE_BM_CMD_READ		0x08	/* the bus master writes memory */
+#define IDE_BM_STAT_ACTIVE	0x01
+#define IDE_BM_STAT_ERROR	0x02
+#define IDE_BM_STAT_INTR	0x04
+#define IDE_BM_STAT_DMA_CAP	0x60	/* drive 0/1 DMA capable, set by BIOS */
+
+/* Physical region descriptor, no region may cross 64K */
+struct ide_prd {
+	uint32_t addr;
+	uint16_t count;		/* 0 is 64K */
+	uint16_t flags;
+#define IDE_PRD_EOT 0x8000
+};
+/* Enough for IDE_MAX_MULTI48 sectors at any alignment */
+#define IDE_PRD_MAX 32
+
+/* Aligned to its size the table can't cross 64K.  It is not taken off
+ * the heap, where a segment being loaded may end. */
+static struct ide_prd ide_prd_table[IDE_PRD_MAX]
+	__attribute__ ((aligned(IDE_PRD_MAX * sizeof(struct ide_prd))));
+
 struct ide_pio_command
 {
 	uint8_t feature;
@@ -162,8 +201,10 @@ struct ide_pio_command
 #define IDE_CMD_PACKET                       0xA0
 #define IDE_CMD_READ_BUFFER                  0xE4
 #define IDE_CMD_READ_DMA                     0xC8
+#define IDE_CMD_READ_DMA_EXT                 0x25
 #define IDE_CMD_READ_DMA_QUEUED              0xC7
 #define IDE_CMD_READ_MULTIPLE                0xC4
+#define IDE_CMD_READ_MULTIPLE_EXT            0x29
 #define IDE_CMD_READ_SECTORS                 0x20
 #define IDE_CMD_READ_SECTORS_EXT             0x24
 #define IDE_CMD_READ_VERIFY_SECTORS          0x40
@@ -234,7 +275,7 @@ static int await_ide(int (*done)(struct controller *ctrl),
 			return 0;
 		}
 		//poll_interruptions();
-		if ((timeout == 0) || (currticks() > timeout)) {
+		if ((timeout == 0) || ((long)(currticks() - timeout) > 0)) {
 			break;
 		}
 	}
@@ -325,7 +366,9 @@ static void pio_set_registers(
 		mdelay(50); 
 	}
 	outb(cmd->feature,         IDE_REG_FEATURE(ctrl));
-	if (cmd->command == IDE_CMD_READ_SECTORS_EXT) {
+	if (cmd->command == IDE_CMD_READ_SECTORS_EXT ||
+			cmd->command == IDE_CMD_READ_MULTIPLE_EXT ||
+			cmd->command == IDE_CMD_READ_DMA_EXT) {
 		outb(cmd->sector_count2,   IDE_REG_SECTOR_COUNT(ctrl));
 		outb(cmd->lba_low2,        IDE_REG_LBA_LOW(ctrl));
 		outb(cmd->lba_mid2,        IDE_REG_LBA_MID(ctrl));
@@ -356,11 +399,12 @@ static int pio_non_data(struct controller *ctrl, const struct ide_pio_command *c
 }
 
 static int pio_data_in(struct controller *ctrl, const struct ide_pio_command *cmd,
-	void *buffer, size_t bytes)
+	void *buffer, size_t bytes, size_t block)
 {
 	unsigned int status;
+	uint8_t *buf = buffer;
+	size_t len;
 
-	/* FIXME handle commands with multiple blocks */
 	/* Wait until the busy bit is clear */
 	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
 		return -1;
@@ -368,22 +412,123 @@ static int pio_data_in(struct controller *ctrl, const struct ide_pio_command *cm
 
 	/* How do I tell if INTRQ is asserted? */
 	pio_set_registers(ctrl, cmd);
-	ndelay(400);
-	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
-		return -1;
+	/* A multiple block command raises DRQ once for every block */
+	while (bytes > 0) {
+		ndelay(400);
+		if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+			return -1;
+		}
+		status = inb(IDE_REG_STATUS(ctrl));
+		if (!(status & IDE_STATUS_DRQ)) {
+			print_status(ctrl);
+			return -1;
+		}
+		len = bytes < block ? bytes : block;
+		insw(IDE_REG_DATA(ctrl), buf, len/2);
+		buf += len;
+		bytes -= len;
 	}
 	status = inb(IDE_REG_STATUS(ctrl));
-	if (!(status & IDE_STATUS_DRQ)) {
+	if (status & IDE_STATUS_DRQ) {
 		print_status(ctrl);
 		return -1;
 	}
-	insw(IDE_REG_DATA(ctrl), buffer, bytes/2);
+	return 0;
+}
+
+static int dma_done(struct controller *ctrl)
+{
+	return !(inb(IDE_BM_STATUS(ctrl)) & IDE_BM_STAT_ACTIVE) ||
+		!(inb(IDE_REG_ALTSTATUS(ctrl)) &
+			(IDE_STATUS_BSY | IDE_STATUS_DRQ));
+}
+
+static int dma_data_in(struct controller *ctrl, const struct ide_pio_command *cmd,
+	void *buffer, size_t bytes)
+{
+	struct ide_prd *prd = ide_prd_table;
+	unsigned long addr, len;
+	unsigned int status, bm_status;
+	int i, result = -1;
+
+	addr = virt_to_phys(buffer);
+	if (addr & 1) {
+		return -1;
+	}
+	for (i = 0; bytes > 0; i++) {
+		if (i == IDE_PRD_MAX) {
+			goto out;
+		}
+		len = 0x10000 - (addr & 0xffff);
+		if (len > bytes)
+			len = bytes;
+		prd[i].addr = addr;
+		prd[i].count = len;
+		prd[i].flags = 0;
+		addr += len;
+		bytes -= len;
+	}
+	prd[i - 1].flags = IDE_PRD_EOT;
+
+	/* Wait until the busy bit is clear */
+	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		goto out;
+	}
+	outl(virt_to_phys(prd), IDE_BM_PRD(ctrl));
+	outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+	/* Clear error and interrupt, they are cleared by writing 1 */
+	bm_status = inb(IDE_BM_STATUS(ctrl));
+	outb((bm_status & IDE_BM_STAT_DMA_CAP) |
+		IDE_BM_STAT_ERROR | IDE_BM_STAT_INTR, IDE_BM_STATUS(ctrl));
+	pio_set_registers(ctrl, cmd);
+	outb(IDE_BM_CMD_READ | IDE_BM_CMD_START, IDE_BM_COMMAND(ctrl));
+	ndelay(400);
+	/* Interrupts are disabled, so poll for the end of the transfer */
+	if (await_ide(dma_done, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+		goto out;
+	}
+	bm_status = inb(IDE_BM_STATUS(ctrl));
+	outb(IDE_BM_CMD_READ, IDE_BM_COMMAND(ctrl));
+	if (await_ide(not_bsy, ctrl, currticks() + IDE_TIMEOUT) < 0) {
+		goto out;
+	}
 	status = inb(IDE_REG_STATUS(ctrl));
-	if (status & IDE_STATUS_DRQ) {
+	if ((bm_status & (IDE_BM_STAT_ACTIVE | IDE_BM_STAT_ERROR)) ||
+		(status & (IDE_STATUS_ERR | IDE_STATUS_DF | IDE_STATUS_DRQ))) {
+		debug("DMA: bm_status=%#x\n", bm_status);
 		print_status(ctrl);
-		return -1;
+		goto out;
 	}
-	return 0;
+	result = 0;
+out:
+	return result;
+}
+
+/* Read count sectors with the fastest transfer the drive is set up for,
+ * cmd is a READ SECTORS (EXT) command */
+static int ide_data_in(struct harddisk_info *info, struct ide_pio_command *cmd,
+	void *buffer, int count)
+{
+	int lba48 = cmd->command == IDE_CMD_READ_SECTORS_EXT;
+
+	if (info->dma && info->ctrl->bm_base) {
+		cmd->command = lba48 ? IDE_CMD_READ_DMA_EXT : IDE_CMD_READ_DMA;
+		if (dma_data_in(info->ctrl, cmd, buffer,
+				count * IDE_SECTOR_SIZE) == 0)
+			return 0;
+		printf("IDE DMA failed, falling back to PIO\n");
+		info->dma = 0;
+	}
+	if (info->multiple) {
+		cmd->command = lba48 ? IDE_CMD_READ_MULTIPLE_EXT :
+			IDE_CMD_READ_MULTIPLE;
+		return pio_data_in(info->ctrl, cmd, buffer,
+			count * IDE_SECTOR_SIZE, info->multiple * IDE_SECTOR_SIZE);
+	}
+	cmd->command = lba48 ? IDE_CMD_READ_SECTORS_EXT : IDE_CMD_READ_SECTORS;
+	return pio_data_in(info->ctrl, cmd, buffer,
+		count * IDE_SECTOR_SIZE, IDE_SECTOR_SIZE);
 }
 
 static int pio_packet(struct harddisk_info *info, int in,
@@ -392,6 +537,8 @@ static int pio_packet(struct harddisk_info *info, int in,
 {
 	unsigned int status;
 	struct ide_pio_command cmd;
+	uint8_t *buf = buffer;
+	int limit, len;
 
 	memset(&cmd, 0, sizeof(cmd));
 
@@ -400,9 +547,11 @@ static int pio_packet(struct harddisk_info *info, int in,
 		return -1;
 	}
 
-	/* Issue a PACKET command */
-	cmd.lba_mid = (uint8_t) buffer_len;
-	cmd.lba_high = (uint8_t) (buffer_len >> 8);
+	/* Issue a PACKET command, the byte count limit is 16 bits so
+	 * a large transfer comes in several DRQ blocks */
+	limit = buffer_len > ATAPI_BYTE_LIMIT ? ATAPI_BYTE_LIMIT : buffer_len;
+	cmd.lba_mid = (uint8_t) limit;
+	cmd.lba_high = (uint8_t) (limit >> 8);
 	cmd.device = IDE_DH_DEFAULT | info->slave;
 	cmd.command = IDE_CMD_PACKET;
 	pio_set_registers(info->ctrl, &cmd);
@@ -439,7 +588,32 @@ static int pio_packet(struct harddisk_info *info, int in,
 		return -1;
 	}
 
-	insw(IDE_REG_DATA(info->ctrl), buffer, buffer_len/2);
+	for (;;) {
+		/* The drive says how much this DRQ block holds */
+		len = inb(IDE_REG_LBA_MID(info->ctrl)) |
+			(inb(IDE_REG_LBA_HIGH(info->ctrl)) << 8);
+		if (len == 0 || len > buffer_len)
+			len = buffer_len;
+		insw(IDE_REG_DATA(info->ctrl), buf, len/2);
+		buf += len;
+		buffer_len -= len;
+		if (buffer_len == 0)
+			break;
+		ndelay(400);
+		if (await_ide(not_bsy, info->ctrl, currticks() + IDE_TIMEOUT) < 0) {
+			return -1;
+		}
+		status = inb(IDE_REG_STATUS(info->ctrl));
+		if (!(status & IDE_STATUS_DRQ)) {
+			/* The drive had less to send than asked for */
+			if (status & IDE_STATUS_CHK) {
+				debug("error in packet data\n");
+				print_status(info->ctrl);
+				return -1;
+			}
+			return 0;
+		}
+	}
 
 	status = inb(IDE_REG_STATUS(info->ctrl));
 	if (status & IDE_STATUS_DRQ) {
@@ -451,7 +625,8 @@ static int pio_packet(struct harddisk_info *info, int in,
 }
 
 static inline int ide_read_sector_chs(
-	struct harddisk_info *info, void *buffer, unsigned long sector)
+	struct harddisk_info *info, void *buffer, unsigned long sector,
+	int count)
 {
 	struct ide_pio_command cmd;
 	unsigned int track;
@@ -459,7 +634,7 @@ static inline int ide_read_sector_chs(
 	unsigned int cylinder;
 		
 	memset(&cmd, 0, sizeof(cmd));
-	cmd.sector_count = 1;
+	cmd.sector_count = count;	/* 256 is written as 0 */
 
 	//debug("ide_read_sector_chs: sector= %ld.\n",sector);
 
@@ -475,16 +650,17 @@ static inline int ide_read_sector_chs(
 		info->slave |
 		IDE_DH_CHS;
 	cmd.command = IDE_CMD_READ_SECTORS;
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
 }
 
 static inline int ide_read_sector_lba(
-	struct harddisk_info *info, void *buffer, unsigned long sector)
+	struct harddisk_info *info, void *buffer, unsigned long sector,
+	int count)
 {
 	struct ide_pio_command cmd;
 	memset(&cmd, 0, sizeof(cmd));
 
-	cmd.sector_count = 1;
+	cmd.sector_count = count;
 	cmd.lba_low = sector & 0xff;
 	cmd.lba_mid = (sector >> 8) & 0xff;
 	cmd.lba_high = (sector >> 16) & 0xff;
@@ -494,17 +670,18 @@ static inline int ide_read_sector_lba(
 		IDE_DH_LBA;
 	cmd.command = IDE_CMD_READ_SECTORS;
 	//debug("%s: sector= %ld, device command= 0x%x.\n",__FUNCTION__,(unsigned long) sector, cmd.device);
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
 }
 
 static inline int ide_read_sector_lba48(
-	struct harddisk_info *info, void *buffer, sector_t sector)
+	struct harddisk_info *info, void *buffer, sector_t sector, int count)
 {
 	struct ide_pio_command cmd;
 	memset(&cmd, 0, sizeof(cmd));
 	//debug("ide_read_sector_lba48: sector= %ld.\n",(unsigned long) sector);
 
-	cmd.sector_count = 1;
+	cmd.sector_count = count & 0xff;
+	cmd.sector_count2 = (count >> 8) & 0xff;
 	cmd.lba_low = sector & 0xff;
 	cmd.lba_mid = (sector >> 8) & 0xff;
 	cmd.lba_high = (sector >> 16) & 0xff;
@@ -513,13 +690,35 @@ static inline int ide_read_sector_lba48(
 	cmd.lba_high2 = (sector >> 40) & 0xff;
 	cmd.device =  info->slave | IDE_DH_LBA;
 	cmd.command = IDE_CMD_READ_SECTORS_EXT;
-	return pio_data_in(info->ctrl, &cmd, buffer, IDE_SECTOR_SIZE);
+	return ide_data_in(info, &cmd, buffer, count);
+}
+
+/* Read count hardware sectors straight into buffer */
+static int ide_read_packet(struct harddisk_info *info, void *buffer,
+	uint32_t hw_sector, int count)
+{
+	char packet[12];
+
+	memset(packet, 0, sizeof packet);
+	packet[0] = 0x28; /* READ */
+	packet[2] = hw_sector >> 24;
+	packet[3] = hw_sector >> 16;
+	packet[4] = hw_sector >> 8;
+	packet[5] = hw_sector >> 0;
+	packet[7] = count >> 8;
+	packet[8] = count; /* length */
+
+	if (pio_packet(info, 1, packet, sizeof packet,
+				buffer, count * info->hw_sector_size) != 0) {
+		debug("read error\n");
+		return -1;
+	}
+	return 0;
 }
 
 static inline int ide_read_sector_packet(
 	struct harddisk_info *info, void *buffer, sector_t sector)
 {
-	char packet[12];
 	static uint8_t cdbuffer[CDROM_SECTOR_SIZE];
 	static struct harddisk_info *last_disk = 0;
 	static sector_t last_sector = (sector_t) -1;
@@ -538,20 +737,8 @@ static inline int ide_read_sector_packet(
 
 	if (buf==buffer || info != last_disk || hw_sector != last_sector) {
 		//debug("hw_sector=%u\n", hw_sector);
-		memset(packet, 0, sizeof packet);
-		packet[0] = 0x28; /* READ */
-		packet[2] = hw_sector >> 24;
-		packet[3] = hw_sector >> 16;
-		packet[4] = hw_sector >> 8;
-		packet[5] = hw_sector >> 0;
-		packet[7] = 0;
-		packet[8] = 1; /* length */
-
-		if (pio_packet(info, 1, packet, sizeof packet,
-					buf, info->hw_sector_size) != 0) {
-			debug("read error\n");
+		if (ide_read_packet(info, buf, hw_sector, 1) != 0)
 			return -1;
-		}
 		last_disk = info;
 		last_sector = hw_sector;
 	}
@@ -572,13 +759,13 @@ int ide_read(int drive, sector_t sector, void *buffer)
 		return -1;
 	}
 	if (info->address_mode == ADDRESS_MODE_CHS) {
-		result = ide_read_sector_chs(info, buffer, sector);
+		result = ide_read_sector_chs(info, buffer, sector, 1);
 	}
 	else if (info->address_mode == ADDRESS_MODE_LBA) {
-		result = ide_read_sector_lba(info, buffer, sector);
+		result = ide_read_sector_lba(info, buffer, sector, 1);
 	}
 	else if (info->address_mode == ADDRESS_MODE_LBA48) {
-		result = ide_read_sector_lba48(info, buffer, sector);
+		result = ide_read_sector_lba48(info, buffer, sector, 1);
 	}
 	else if (info->address_mode == ADDRESS_MODE_PACKET) {
 		result = ide_read_sector_packet(info, buffer, sector);
@@ -589,6 +776,55 @@ int ide_read(int drive, sector_t sector, void *buffer)
 	return result;
 }
 
+/* Read count sectors into buffer with as few commands as possible */
+int ide_read_multi(int drive, sector_t sector, int count, void *buffer)
+{
+	struct harddisk_info *info = &harddisk_info[drive];
+	uint8_t *buf = buffer;
+	int n, result;
+
+	if (sector + count > info->sectors) {
+		return -1;
+	}
+	while (count > 0) {
+		n = count > IDE_MAX_MULTI ? IDE_MAX_MULTI : count;
+		if (info->address_mode == ADDRESS_MODE_LBA48)
+			n = count > IDE_MAX_MULTI48 ? IDE_MAX_MULTI48 : count;
+		if (info->address_mode == ADDRESS_MODE_CHS) {
+			result = ide_read_sector_chs(info, buf, sector, n);
+		}
+		else if (info->address_mode == ADDRESS_MODE_LBA) {
+			result = ide_read_sector_lba(info, buf, sector, n);
+		}
+		else if (info->address_mode == ADDRESS_MODE_LBA48) {
+			result = ide_read_sector_lba48(info, buf, sector, n);
+		}
+		else if (info->address_mode == ADDRESS_MODE_PACKET) {
+			if (info->hw_sector_size != CDROM_SECTOR_SIZE) {
+				result = ide_read_packet(info, buf, sector, n);
+			}
+			else if ((sector & 3) || n < 4) {
+				/* Partial CD-ROM sector, through cdbuffer */
+				n = 1;
+				result = ide_read_sector_packet(info, buf, sector);
+			}
+			else {
+				n &= ~3;
+				result = ide_read_packet(info, buf, sector >> 2, n >> 2);
+			}
+		}
+		else {
+			result = -1;
+		}
+		if (result != 0)
+			return result;
+		buf += n * IDE_SECTOR_SIZE;
+		sector += n;
+		count -= n;
+	}
+	return 0;
+}
+
 static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 		int slave, int drive, unsigned char *buffer, int ident_command)
 {
@@ -606,6 +842,8 @@ static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 	info->drive_exists = 0;
 	info->slave_absent = 0;
 	info->removable = 0;
+	info->multiple = 0;
+	info->dma = 0;
 	info->hw_sector_size = IDE_SECTOR_SIZE;
 	info->slave = slave?IDE_DH_SLAVE: IDE_DH_MASTER;
 
@@ -642,7 +880,8 @@ static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 	cmd.command = ident_command;
 
 	
-	if (pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE) < 0) {
+	if (pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE,
+			IDE_SECTOR_SIZE) < 0) {
 		/* Well, if that command didn't work, we probably don't have drive. */
 		return 1;
 	}
@@ -667,7 +906,8 @@ static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 		cmd.device = IDE_DH_DEFAULT | IDE_DH_HEAD(0) | IDE_DH_CHS |
 			info->slave;
 		cmd.command = ident_command;
-		if(pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE) < 0) {
+		if(pio_data_in(ctrl, &cmd, buffer, IDE_SECTOR_SIZE,
+				IDE_SECTOR_SIZE) < 0) {
 			/* If the command didn't work give up on the drive. */
 			return 1;
 		}
@@ -758,6 +998,30 @@ static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 		else{
 			debug("ok\n");
 		}
+
+		/* Have the drive move several sectors per DRQ block */
+		i = drive_info[47] & 0xff;
+		if (i > IDE_MULTIPLE_MAX)
+			i = IDE_MULTIPLE_MAX;
+		while (i & (i - 1))
+			i &= i - 1;
+		if (i > 1) {
+			memset(&cmd, 0, sizeof(cmd));
+			cmd.device = IDE_DH_DEFAULT | info->slave;
+			cmd.sector_count = i;
+			cmd.command = IDE_CMD_SET_MULTIPLE_MODE;
+			if (pio_non_data(ctrl, &cmd) == 0 &&
+				!(inb(IDE_REG_STATUS(ctrl)) & IDE_STATUS_ERR))
+				info->multiple = i;
+		}
+
+		/* Use DMA if the BIOS has selected a multiword or
+		 * Ultra DMA mode, the chipset timings are its business */
+		if ((drive_info[49] & (1 << 8)) &&
+			((drive_info[63] & 0x0700) ||
+			 ((drive_info[53] & (1 << 2)) &&
+			  (drive_info[88] & 0x7f00))))
+			info->dma = 1;
 	}
 
 	printf("hd%c: %s",
@@ -766,6 +1030,10 @@ static int init_drive_x(struct harddisk_info *info, struct controller *ctrl,
 		(info->address_mode==ADDRESS_MODE_LBA) ? "LBA" :
 		(info->address_mode==ADDRESS_MODE_LBA48) ? "LBA48" :
 		(info->address_mode==ADDRESS_MODE_PACKET) ? "ATAPI" : "???");
+	if (info->dma && ctrl->bm_base)
+		printf(" DMA");
+	else if (info->multiple)
+		printf(" MULTI%d", info->multiple);
 #if 0
 // can not pass compiler	
 	if (info->sectors > (10LL*1000*1000*1000/512))
@@ -802,7 +1070,7 @@ static int ide_bus_floating(struct controller *ctrl)
 		/* If BSY bit is not set, it's harmless to continue probing. */
 		if ((status & IDE_STATUS_BSY) == 0)
 			return 0;
-	} while (currticks() < timeout);
+	} while ((long)(currticks() - timeout) < 0);
 	/* Timed out. Logical ORed status didn't make 0xFF.
 	 * We have something there. */
 	return 0;
@@ -942,7 +1210,7 @@ static int atapi_detect_medium(struct harddisk_info *info)
 	 * 30 seconds is added. */
 	timeout = currticks() + 5*TICKS_PER_SEC;
 	in_progress = 0;
-	while (currticks() < timeout) {
+	while ((long)(currticks() - timeout) < 0) {
 		if (pio_packet(info, 1, packet, sizeof packet, buf, sizeof buf)
 				== 0)
 			goto ok;
@@ -1063,6 +1331,18 @@ static int find_ide_controller(struct controller *ctrl, int ctrl_index)
 			return -1;
 	}
 
+	/* Bus master registers, eight for each channel */
+	pci_read_config_dword(dev, PCI_BASE_ADDRESS_4, &x);
+	if ((x & PCI_BASE_ADDRESS_SPACE_IO) && (x & ~3)) {
+		uint16_t command;
+		ctrl->bm_base = (x & ~3) + ((ctrl_index & 1) ? 8 : 0);
+		pci_read_config_word(dev, PCI_COMMAND, &command);
+		if (!(command & PCI_COMMAND_MASTER))
+			pci_write_config_word(dev, PCI_COMMAND,
+				command | PCI_COMMAND_MASTER);
+		debug("bm_base=%#x\n", ctrl->bm_base);
+	}
+
 	debug("cmd_base=%#x ctrl_base=%#x\n", ctrl->cmd_base, ctrl->ctrl_base);
 #if 0
 	debug("cmd+0=%0#x\n", inb(ctrl->cmd_base+0));
@@ -6,9 +6,39 @@
 #define DEBUG_THIS DEBUG_BLOCKDEV
 #include <debug.h>
 
-#define NUM_CACHE 64
-static unsigned char buf_cache[NUM_CACHE][512];
-static unsigned long cache_sect[NUM_CACHE];
+/* Sector cache, BLOCK_CACHE_WAYS sectors to a set with the least
+ * recently used one replaced.  It takes up to BLOCK_CACHE_KB but no more
+ * than a sixteenth of the free heap, the static cache is used when the
+ * heap can't give more. */
+#ifndef BLOCK_CACHE_KB
+#define BLOCK_CACHE_KB 1024
+#endif
+#ifndef BLOCK_CACHE_WAYS
+#define BLOCK_CACHE_WAYS 4
+#endif
+/* Sectors read at once when misses are sequential */
+#ifndef BLOCK_READ_AHEAD
+#define BLOCK_READ_AHEAD 16
+#endif
+#define STATIC_CACHE 64
+/* Reads of at least this many whole sectors go straight to the caller's
+ * buffer, smaller ones are metadata and worth caching */
+#define BULK_SECTORS 16
+
+struct cache_tag {
+    unsigned long sector;
+    unsigned long used;		/* cache_clock at last use, 0 if empty */
+};
+
+static unsigned char static_data[STATIC_CACHE][512];
+static struct cache_tag static_tag[STATIC_CACHE];
+static unsigned char (*cache_data)[512] = static_data;
+static struct cache_tag *cache_tag = static_tag;
+static unsigned long cache_sets = STATIC_CACHE / BLOCK_CACHE_WAYS;
+static unsigned long cache_clock;
+static unsigned long cache_hits, cache_misses, cache_reads;
+static unsigned long ra_next = (unsigned long) -1;
+static unsigned char ra_buf[BLOCK_READ_AHEAD][512];
 
 static char dev_name[256];
 
@@ -124,9 +154,48 @@ static int open_pc_partition(int part, unsigned long *start_p,
 
 static void flush_cache(void)
 {
-    int i;
-    for (i = 0; i < NUM_CACHE; i++)
-	cache_sect[i] = (unsigned long) -1;
+    unsigned long i;
+    for (i = 0; i < cache_sets * BLOCK_CACHE_WAYS; i++)
+	cache_tag[i].used = 0;
+    ra_next = (unsigned long) -1;
+}
+
+/* Size the cache from the heap.  Called each time FILO starts, as the
+ * heap is given back when it returns. */
+void devcache_init(void)
+{
+    unsigned long line, budget, sets;
+    void *mem;
+
+    cache_data = static_data;
+    cache_tag = static_tag;
+    cache_sets = STATIC_CACHE / BLOCK_CACHE_WAYS;
+
+    line = BLOCK_CACHE_WAYS * (512 + sizeof(struct cache_tag));
+    budget = (heap_ptr - heap_top) / 16;
+    if (budget > BLOCK_CACHE_KB * 1024UL)
+	budget = BLOCK_CACHE_KB * 1024UL;
+    for (sets = 1; sets * 2 * line <= budget; sets *= 2)
+	;
+    if (sets > cache_sets) {
+	mem = allot(sets * line);
+	if (mem) {
+	    cache_data = mem;
+	    cache_tag = (struct cache_tag *)
+		(cache_data + sets * BLOCK_CACHE_WAYS);
+	    cache_sets = sets;
+	}
+    }
+    debug("cache: %d sets of %d\n", cache_sets, BLOCK_CACHE_WAYS);
+    flush_cache();
+    cache_hits = cache_misses = cache_reads = 0;
+}
+
+void devcache_stats(void)
+{
+    printf("cache: %d sectors, %d hits, %d misses, %d reads\n",
+	    cache_sets * BLOCK_CACHE_WAYS, cache_hits, cache_misses,
+	    cache_reads);
 }
 
 static int parse_device_name(const char *name, int *type, int *drive,
@@ -156,6 +225,15 @@ static int parse_device_name(const char *name, int *type, int *drive,
         }
         *drive = *name - 'a';
         name++;
+    } else if (memcmp(name, "sd", 2) == 0) {
+	*type = DISK_AHCI;
+	name += 2;
+	if (*name < 'a' || *name > 'z') {
+	    printf("Invalid drive\n");
+	    return 0;
+	}
+	*drive = *name - 'a';
+	name++;
     } else {
 	printf("Unknown device type\n");
 	return 0;
@@ -229,6 +307,15 @@ int devopen(const char *name, int *reopen)
         }
         disk_size = (uint32_t) -1; /* FIXME */
         break;
+#endif
+#ifdef AHCI_DISK
+    case DISK_AHCI:
+	if (ahci_probe(drive) != 0) {
+	    debug("failed to open ahci\n");
+	    return 0;
+	}
+	disk_size = (uint32_t) -1; /* FIXME */
+	break;
 #endif
     default:
 	printf("Unknown device type %d\n", type);
@@ -290,13 +377,59 @@ int devopen(const char *name, int *reopen)
     return 1;
 }
 
-/* Read a sector from opened device with simple/stupid buffer cache */
-static void *read_sector(unsigned long sector)
+/* Read count sectors into buf with as few device commands as possible */
+static int dev_read(unsigned long sector, unsigned long count, void *buf)
 {
-    unsigned int hash;
-    void *buf;
+    cache_reads++;
+    switch (dev_type) {
+#ifdef IDE_DISK
+    case DISK_IDE:
+	return ide_read_multi(dev_drive, sector, count, buf);
+#endif
+#ifdef USB_DISK
+    case DISK_USB:
+	return usb_read_multi(dev_drive, sector, count, buf);
+#endif
+#ifdef AHCI_DISK
+    case DISK_AHCI:
+	return ahci_read(dev_drive, sector, count, buf);
+#endif
+    default:
+	printf("dev_read: device not open\n");
+	return -1;
+    }
+}
+
+static void read_error(unsigned long sector, unsigned long count)
+{
+    printf("Disk read error dev_type=%d drive=%d sector=%x count=%d\n",
+	    dev_type, dev_drive, sector, count);
+    dev_name[0] = '\0'; /* force re-open the device next time */
+}
+
+/* The line holding sector, or else the one to replace with it */
+static struct cache_tag *cache_lookup(unsigned long sector)
+{
+    struct cache_tag *tag, *victim;
     int i;
 
+    tag = &cache_tag[(sector & (cache_sets - 1)) * BLOCK_CACHE_WAYS];
+    victim = tag;
+    for (i = 0; i < BLOCK_CACHE_WAYS; i++, tag++) {
+	if (tag->used && tag->sector == sector)
+	    return tag;
+	if (tag->used < victim->used)
+	    victim = tag;
+    }
+    return victim;
+}
+
+/* Read a sector from opened device through the cache */
+static void *read_sector(unsigned long sector)
+{
+    struct cache_tag *tag, *t;
+    unsigned long i, n;
+
     /* If reading memory, just return the memory as the buffer */
     if (dev_type == DISK_MEM) {
 	unsigned long phys = sector << 9;
@@ -304,45 +437,46 @@ static void *read_sector(unsigned long sector)
 	return phys_to_virt(phys);
     }
 
-    /* Search in the cache */
-    hash = sector % NUM_CACHE;
-    buf = buf_cache[hash];
-    if (cache_sect[hash] != sector) {
-	cache_sect[hash] = (unsigned long) -1;
-	switch (dev_type) {
-#ifdef IDE_DISK
-	case DISK_IDE:
-	    if (ide_read(dev_drive, sector, buf) != 0)
-		goto readerr;
-	    break;
-#endif
-#ifdef USB_DISK
-        case DISK_USB:
-            if (usb_read(dev_drive, sector, buf) != 0)
-                goto readerr;
-            break;
-#endif
-	default:
-	    printf("read_sector: device not open\n");
+    tag = cache_lookup(sector);
+    if (tag->used && tag->sector == sector) {
+	cache_hits++;
+	tag->used = ++cache_clock;
+	return cache_data[tag - cache_tag];
+    }
+    cache_misses++;
+
+    /* A miss right after the last one read starts reading ahead,
+     * each sector of it goes to a different set */
+    n = 1;
+    if (sector == ra_next) {
+	n = part_start + part_length - sector;
+	if (n > BLOCK_READ_AHEAD)
+	    n = BLOCK_READ_AHEAD;
+	if (n > cache_sets)
+	    n = cache_sets;
+    }
+    if (n > 1 && dev_read(sector, n, ra_buf) == 0) {
+	for (i = 0; i < n; i++) {
+	    t = cache_lookup(sector + i);
+	    memcpy(cache_data[t - cache_tag], ra_buf[i], 512);
+	    t->sector = sector + i;
+	    t->used = ++cache_clock;
+	}
+    } else {
+	/* Read ahead may run off the end of the disk, so try again
+	 * with just the one sector */
+	n = 1;
+	tag->used = 0;
+	if (dev_read(sector, 1, cache_data[tag - cache_tag]) != 0) {
+	    read_error(sector, 1);
 	    return 0;
 	}
-	cache_sect[hash] = sector;
+	tag->sector = sector;
+	tag->used = ++cache_clock;
     }
-#if 0	
-    printf("in read_sector:\n");
-    for(i=0;i<128;i++) {
-             if((i%4)==0) printf("\n %08x:",i*4);
-             printf(" %08x ",(uint32_t)*((uint32_t *)buf+i));
-       }
-#endif
+    ra_next = sector + n;
 
-    return buf;
-
-readerr:
-    printf("Disk read error dev_type=%d drive=%d sector=%x\n",
-	    dev_type, dev_drive, sector);
-    dev_name[0] = '\0'; /* force re-open the device next time */
-    return 0;
+    return cache_data[tag - cache_tag];
 }
 
 int devread(unsigned long sector, unsigned long byte_offset,
@@ -364,6 +498,17 @@ int devread(unsigned long sector, unsigned long byte_offset,
     }
 
     while (byte_len > 0) {
+	len = byte_len >> 9;
+	if (byte_offset == 0 && len >= BULK_SECTORS && dev_type != DISK_MEM) {
+	    if (dev_read(part_start + sector, len, dest) != 0) {
+		read_error(part_start + sector, len);
+		return 0;
+	    }
+	    sector += len;
+	    byte_len -= len << 9;
+	    dest += len << 9;
+	    continue;
+	}
 	sector_buffer = read_sector(part_start + sector);
 	if (!sector_buffer) {
 	    debug("read sector failed\n");
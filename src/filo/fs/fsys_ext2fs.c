@@ -395,6 +395,7 @@ ext2fs_read (char *buf, int len)
   int logical_block;
   int offset;
   int map;
+  int nblocks;
   int ret = 0;
   int size = 0;
 
@@ -431,6 +432,13 @@ ext2fs_read (char *buf, int len)
 
       size = EXT2_BLOCK_SIZE (SUPERBLOCK);
       size -= offset;
+      /* take in the following blocks while they follow on disk, so
+	 that they come in one device read */
+      for (nblocks = 1;
+	   size < len
+	     && ext2fs_block_map (logical_block + nblocks) == map + nblocks;
+	   nblocks++)
+	size += EXT2_BLOCK_SIZE (SUPERBLOCK);
       if (size > len)
 	size = len;
 
@@ -320,11 +320,10 @@ iso9660_read (char *buf, int len)
   ret = 0;
   blkoffset = filepos & (ISO_SECTOR_SIZE - 1);
   sector = filepos >> ISO_SECTOR_BITS;
-  while (len > 0)
+  if (len > 0)
   {
-    size = ISO_SECTOR_SIZE - blkoffset;
-    if (size > len)
-        size = len;
+    /* The file is a single extent, so it is read in one go */
+    size = len;
 
     disk_read_func = disk_read_hook;
 
@@ -333,12 +332,8 @@ iso9660_read (char *buf, int len)
 
     disk_read_func = NULL;
 
-    len -= size;
-    buf += size;
     ret += size;
     filepos += size;
-    sector++;
-    blkoffset = 0;
   }
 
   return ret;
@@ -180,7 +180,11 @@ static int load_segments(Elf_phdr *phdr, int phnum,
 	debug("ok\n");
 
     }
-    time = (currticks() - start_time)*1000/18;
+#if TICKS_PER_SEC >= 1000
+    time = (currticks() - start_time) / (TICKS_PER_SEC / 1000);
+#else
+    time = (currticks() - start_time) * 1000 / TICKS_PER_SEC;
+#endif
     printf("Loaded %d bytes in %dms (%dKB/s)\n", bytes, time,
 	    time? bytes/time : 0);
     return 1;
@@ -20,6 +20,7 @@ struct sys_info sys_info;
 static void init(void)
 {
     collect_sys_info(&sys_info);
+    devcache_init();
 
     printf("%s version %s\n", program_name, program_version);
 
@@ -59,7 +60,7 @@ static inline int autoboot_delay(void)
     for (sec = AUTOBOOT_DELAY; sec>0 && key==0; sec--) {
 	printf("%d", sec);
 	timeout = currticks() + TICKS_PER_SEC;
-	while (currticks() < timeout) {
+	while ((long)(currticks() - timeout) < 0) {
 	    if (iskey()) {
 		key = getchar();
 		if (key==ENTER || key==ESCAPE)
@@ -121,6 +122,10 @@ int filo(void)
 	getline(line, sizeof line);
 // BY LYH add "quit" to exit filo
 	if (strcmp(line,"quit")==0) break;
+	if (strcmp(line,"cache")==0) {
+	    devcache_stats();
+	    continue;
+	}
 //	if (memcmp(line,"quit",4)==0) break;
 	if (line[0])
 	    boot(line);
@@ -1122,6 +1122,9 @@ void ohci_urb_complete(struct urb *urb) {
 
 }
 /*-------------------------------------------------------------------*/
+// A whole bulk transfer is queued as one TD per 4096 bytes and the first
+// done head can take a full TD at 12Mbit/s plus the device's NAKs to come
+#define OHCI_BULK_TIMEOUT 100000
 // it will 1. call usb_bulk_msg_x 
 // 	   2. call dl_list and find the data return
 int ohci_bulk_transfer( uchar devnum, uchar ep, unsigned int data_len, uchar *data) {
@@ -1131,7 +1134,7 @@ int ohci_bulk_transfer( uchar devnum, uchar ep, unsigned int data_len, uchar *da
         t = ep;
         pipe |=(t&0xf)<<15;
 	
-	usb_bulk_msg_x(&usb_device[devnum], pipe, data, data_len, &actual_length, 10000, ohci_urb_complete);
+	usb_bulk_msg_x(&usb_device[devnum], pipe, data, data_len, &actual_length, OHCI_BULK_TIMEOUT, ohci_urb_complete);
 	
 	return actual_length;
 
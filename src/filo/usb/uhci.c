@@ -568,6 +568,16 @@ void init_sched(uchar dev)
 
 }
 
+/* Packets chained into one transaction, the rest of MAX_TD is left for
+ * control messages */
+#define BULK_MAX_TDS (MAX_TD/2)
+/* Bulk packets are at most 64 bytes at full speed */
+#define BULK_MAX_LEN (BULK_MAX_TDS * 64)
+
+/* Bounce buffer for bulk transfers.  It is taken once here, before any
+ * image is loaded, so that it never sits on top of a loaded segment. */
+static uchar *bulk_buffer;
+
 void uhci_init(void)
 {
 	int i;
@@ -575,6 +585,13 @@ void uhci_init(void)
 	init_td();
 	init_qh();
 	init_transactions();
+#if ALLOCATE==1
+	if(!bulk_buffer) {
+		bulk_buffer = allot2(BULK_MAX_LEN, 0x7ff);
+		if(bulk_buffer==0)
+			printf("uhci_init: no mem for bulk buffer\n");
+	}
+#endif
 
 	for(i=0;i<MAX_CONTROLLERS; i++) {
 		if(hc_type[i] == 0x00) {
@@ -876,7 +893,7 @@ void unlink_transaction( uchar dev, transaction_t *trans)
 	sched_queue[dev]->depth.link = 0;	// just in case
 }
 
-int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
+static int bulk_transfer_chunk( uchar devnum, uchar ep, unsigned int len, uchar *data)
 {
 	transaction_t *trans;
 	td_t *td;
@@ -885,11 +902,12 @@ int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
 	uchar *buffer;
 	DPRINTF("bulk_transfer: ep = %x len=%d\n", ep, len);
 #if ALLOCATE==1
-        buffer = allot2(2048, 0x7ff);
-	if(buffer==0){
-                printf("bulk_transfer: can not allot\n");
+        buffer = bulk_buffer;
+	if(buffer==0 || len > BULK_MAX_LEN){
+                printf("bulk_transfer: no buffer\n");
+		return(-1);
         }
-	memset(buffer,0,2048);
+	memset(buffer,0,len);
 //	DPRINTF("bulk_transfer: buffer(virt) = %x buffer(phys) = %x len = %d\n", buffer, virt_to_phys(buffer), len);
 
         if( !(ep & 0x80))
@@ -915,9 +933,6 @@ int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
 #endif
  		unlink_transaction( usb_device[devnum].controller, trans);
 		free_transaction(trans);
-#if ALLOCATE==1
-                forget2(buffer);
-#endif
 		return(-1);
 	}
 
@@ -961,7 +976,6 @@ int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
 #if ALLOCATE==1
 	if( (ep & 0x80))
 	        memcpy(data, buffer, len);
-        forget2(buffer);
 #endif
 
 
@@ -969,6 +983,31 @@ int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
 	return(data_len);
 }
 
+/* Transfer len bytes with as few transactions as the TD pool allows, each
+ * one is scheduled with all its packets chained and waited for once */
+int uhci_bulk_transfer( uchar devnum, uchar ep, unsigned int len, uchar *data)
+{
+	unsigned int chunk, max_chunk;
+	int ret, total = 0;
+
+	max_chunk = BULK_MAX_TDS * usb_device[devnum].max_packet[ep & 0x7f];
+	if(max_chunk > BULK_MAX_LEN)
+		max_chunk = BULK_MAX_LEN;
+	do {
+		chunk = len > max_chunk ? max_chunk : len;
+		ret = bulk_transfer_chunk(devnum, ep, chunk, data);
+		if(ret<0)
+			return(-1);
+		total += ret;
+		if((unsigned int) ret < chunk)	// short packet ends the transfer
+			break;
+		data += chunk;
+		len -= chunk;
+	} while(len);
+
+	return(total);
+}
+
 int uhci_control_msg( uchar devnum, uchar request_type, uchar request, unsigned short wValue, unsigned short wIndex, unsigned short wLength, void *data)
 {
 	transaction_t *trans;
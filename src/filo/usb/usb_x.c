@@ -160,4 +160,27 @@ int usb_read(int drive, sector_t sector, void *buffer)
 
 	return 0;	
 }
+
+/* Sectors per READ(10).  Bulk-only devices do not report a limit, 32K is
+ * taken by any stick and is one chained transaction on UHCI and OHCI */
+#define USB_MAX_SECTORS 64
+
+int usb_read_multi(int drive __unused, sector_t sector, int count,
+		   void *buffer)
+{
+        struct usbdisk_info_t *info = &usbdisk_info;
+	char *buf = buffer;
+	int n;
+
+	while (count > 0) {
+		n = count > USB_MAX_SECTORS ? USB_MAX_SECTORS : count;
+		if (ll_read_block(info->usb_device_address, buf, sector, n)
+				!= n * 512)
+			return -1;
+		buf += n * 512;
+		sector += n;
+		count -= n;
+	}
+	return 0;
+}
 #endif 
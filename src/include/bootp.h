@@ -201,6 +201,8 @@
 #endif
 #define RFC1533_VENDOR_NIC_DEV_ID 175
 #define RFC1533_VENDOR_ARCH     177
+/* Load of the server making an offer, 0 idle to 255 busy */
+#define RFC1533_VENDOR_SERVER_LOAD 178
 
 #define RFC1533_END		255
 
@@ -7,8 +7,8 @@
 // We only query with INTERNET class (not CHAOS or whatever)
 #define	QUERYCLASS_INET	1
 
-// Our first query will have the identifier <1> (arbitrary -
-// remember however that (256 - QUERYIDENTIFIER)/2 > MAX_CNAME_RECURSION !!!
+// Our first query will have the identifier <1> (arbitrary), every
+// query sent after it the next one
 #define	QUERYIDENTIFIER	1
 
 // Query flags are standard values here
@@ -26,7 +26,16 @@
 #define	QINDEX_QUESTION	12
 #define	QINDEX_QTYPE	14
 #define	QINDEX_QCLASS	16
-#define	QINDEX_STORE_A	256
+
+// Longest query name, in the encoded form with length bytes
+#define	DNS_MAX_NAME	240
+
+// Resolved names are remembered for their TTL, but at most an hour, or
+// for as long as currticks() differences fit in a long if that is less
+#define	DNS_CACHE_SIZE	4
+#define	DNS_CACHE_NAMELEN	64
+#define	DNS_CACHE_MAX_TTL	( 3600 < LONG_MAX / TICKS_PER_SEC ? 3600 : \
+				  LONG_MAX / TICKS_PER_SEC )
 
 // Constant UDP port number for DNS traffic
 #define	UDP_PORT_DNS	53
@@ -36,12 +45,8 @@
 #define	RET_PACK_GARBAG	0
 //	Retrieved an address - query finishes
 #define	RET_GOT_ADDR	1
-//	No A record for that hostname - try running a CNAME query
-#define	RET_RUN_CNAME_Q	2
-//	The CNAME query returned a valid hostname - run A query on that
+//	The answer ended in a CNAME without an A - run A query on that
 #define	RET_RUN_NEXT_A	3
-//	The CNAME query failed - stop resolving
-#define	RET_CNAME_FAIL	4
 //	We have a reliable input that claims that the hostname does not exist
 #define	RET_NOSUCHNAME	5
 //	The name server response is somehow bogus/can not be parsed -> Abort
@@ -79,6 +79,8 @@ typedef struct Elf_Nhdr
 #define EB_HEADER		0x00000006
 #define EB_IA64_IMAGE_HANDLE	0x00000007
 #define EB_I386_MEMMAP		0x00000008
+#define EB_BOOT_TRACE		0x00000009
+/* Address of a struct boot_trace, see etherboot.h */
 
 
 #endif /* ELF_BOOT_H */
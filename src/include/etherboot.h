@@ -103,6 +103,14 @@
 #define VALID_LINK_TIMEOUT	100 /* 10.0 seconds */
 #endif
 
+/* Ticks in a time given in microseconds, rounded up */
+#if TICKS_PER_SEC >= 1000000
+#define USECS_TO_TICKS(us)	((us) * (TICKS_PER_SEC / 1000000))
+#else
+#define USECS_TO_TICKS(us)	(((us) + 1000000 / TICKS_PER_SEC - 1) / \
+				 (1000000 / TICKS_PER_SEC))
+#endif
+
 /* Inter-packet retry in ticks */
 #ifndef TIMEOUT
 #define TIMEOUT			(10*TICKS_PER_SEC)
@@ -112,6 +120,11 @@
 #define BOOTP_TIMEOUT		(2*TICKS_PER_SEC)
 #endif
 
+/* How long other DHCP servers may take to better the first offer */
+#ifndef DHCP_OFFER_WINDOW
+#define DHCP_OFFER_WINDOW	USECS_TO_TICKS(500000)
+#endif
+
 /* Max interval between IGMP packets */
 #define IGMP_INTERVAL			(10*TICKS_PER_SEC)
 #define IGMPv1_ROUTER_PRESENT_TIMEOUT	(400*TICKS_PER_SEC)
@@ -126,16 +139,33 @@
 #define TFTP_REXMT		TIMEOUT
 #endif
 
+/* Bounds on the retransmission timeout of the UDP protocols, and where
+ * it starts for a server that has not answered yet */
+#ifndef RTT_MIN_TIMEOUT
+#define RTT_MIN_TIMEOUT		USECS_TO_TICKS(100000)
+#endif
+#ifndef RTT_MAX_TIMEOUT
+#define RTT_MAX_TIMEOUT		(60*TICKS_PER_SEC)
+#endif
+#ifndef RTT_INITIAL_TIMEOUT
+#define RTT_INITIAL_TIMEOUT	TICKS_PER_SEC
+#endif
+
 #ifndef	NULL
 #define NULL	((void *)0)
 #endif
 
 #include	"if_ether.h"
 
+#ifndef	MAX_NAMESERVERS
+#define	MAX_NAMESERVERS		3	/* DNS servers taken from DHCP */
+#endif
+
 enum {
 	ARP_CLIENT, ARP_SERVER, ARP_GATEWAY,
 #ifdef DNS_RESOLVER
 	ARP_NAMESERVER,
+	ARP_NAMESERVER_LAST = ARP_NAMESERVER + MAX_NAMESERVERS - 1,
 #endif
 #ifdef PXE_EXPORT
 	ARP_PROXYDHCP,
@@ -237,6 +267,9 @@ extern int tcp_transmit(unsigned long destip, unsigned int srcsock,
                        unsigned int destsock, long send_seq, long recv_seq,
                        int window, int flags, int len, const void *buf);
 extern int tcp_reset(struct iphdr *ip);
+extern int tcp_transaction(unsigned long destip, unsigned int destsock,
+	void *ptr, int (*send)(int len, void *buf, void *ptr),
+	int (*recv)(int len, const void *buf, void *ptr));
 typedef int (*reply_t)(int ival, void *ptr, unsigned short ptype, struct iphdr *ip, struct udphdr *udp, struct tcphdr *tcp);
 extern int await_reply P((reply_t reply,	int ival, void *ptr, long timeout));
 extern int decode_rfc1533 P((unsigned char *, unsigned int, unsigned int, int));
@@ -248,9 +281,82 @@ extern uint16_t add_ipchksums P((unsigned long offset, uint16_t sum, uint16_t ne
 extern int32_t random P((void));
 extern long rfc2131_sleep_interval P((long base, int exp));
 extern long rfc1112_sleep_interval P((long base, int exp));
+
+/* rtt.c */
+struct rtt_estimator {
+	unsigned long	server;		/* IP address being timed */
+	long		srtt;		/* Smoothed RTT in ticks, times 8 */
+	long		rttvar;		/* Mean deviation in ticks, times 4 */
+	long		rto;		/* Retransmission timeout in ticks */
+};
+extern void rtt_server P((struct rtt_estimator *rtt, unsigned long server, long initial));
+extern long rtt_timeout P((struct rtt_estimator *rtt));
+extern void rtt_sample P((struct rtt_estimator *rtt, unsigned long sent));
+extern void rtt_backoff P((struct rtt_estimator *rtt));
+
+#ifdef PACKET_STATS
+struct packet_stats {
+	unsigned long	start;		/* currticks() when counting began */
+	unsigned long	rx_packets;
+	unsigned long	rx_bytes;
+	unsigned long	tx_packets;
+	unsigned long	tx_bytes;
+	unsigned long	copied;		/* bytes copied by the NIC layer */
+	unsigned long	chksum_bytes;
+	uint64_t	chksum_cycles;	/* arch_cycles() spent in ipchksum() */
+};
+extern struct packet_stats packet_stats;
+extern void packet_stats_reset P((void));
+extern void packet_stats_print P((void));
+#endif
+
 #ifndef DOWNLOAD_PROTO_TFTP
 #define	tftp(fname, load_block) 0
 #endif
+
+/* boot_trace.c */
+#ifdef BOOT_TRACE
+#ifndef	BOOT_TRACE_EVENTS
+#define	BOOT_TRACE_EVENTS	32	/* Phase changes kept in the ring */
+#endif
+enum {
+	BT_INIT, BT_PROBE, BT_CONFIG,	/* main_loop states */
+	BT_ARP, BT_DNS,			/* nested in the others */
+	BT_DOWNLOAD,			/* main_loop state 1 */
+	BT_COPY,			/* os_download from load_block */
+	BT_BOOT,			/* done(), about to start the image */
+	BT_PHASES
+};
+/* The layout below is what the EB_BOOT_TRACE note points to */
+struct boot_trace_event {
+	uint32_t	phase;
+	uint32_t	ticks;		/* currticks() on entry */
+	uint64_t	cycles;		/* arch_cycles() on entry, or 0 */
+	uint32_t	rx_packets;	/* Received up to then */
+	uint32_t	rx_bytes;
+};
+struct boot_trace_phase {
+	uint64_t	cycles;
+	uint32_t	ticks;
+	uint32_t	entries;
+	uint32_t	rx_packets;
+	uint32_t	rx_bytes;
+};
+struct boot_trace {
+	uint32_t	ticks_per_sec;
+	uint32_t	events;		/* Logged, the ring has the last ones */
+	uint32_t	rx_packets;	/* Running totals */
+	uint32_t	rx_bytes;
+	struct boot_trace_phase phase[BT_PHASES];
+	struct boot_trace_event event[BOOT_TRACE_EVENTS];
+};
+extern struct boot_trace boot_trace_data;
+extern void boot_trace_init P((void));
+extern void boot_trace P((int phase));
+extern int boot_trace_enter P((int phase));
+extern void boot_trace_leave P((int phase));
+extern void boot_trace_print P((void));
+#endif
 extern void cleanup P((void));
 
 /* nfs.c */
@@ -258,6 +364,9 @@ extern void rpc_init(void);
 extern int nfs P((const char *name, int (*)(unsigned char *, unsigned int, unsigned int, int)));
 extern void nfs_umountall P((int));
 
+/* dns_resolver.c */
+extern int dns_resolver P((const char *filename, in_addr *ip));
+
 /* proto_slam.c */
 extern int url_slam P((const char *name, int (*fnc)(unsigned char *, unsigned int, unsigned int, int)));
 
@@ -292,6 +401,9 @@ typedef uint64_t sector_t;
 typedef sector_t (*os_download_t)(unsigned char *data, unsigned int len, int eof);
 extern os_download_t probe_image(unsigned char *data, unsigned int len);
 extern int load_block P((unsigned char *, unsigned int, unsigned int, int ));
+extern int load_block_place P((unsigned long offset, unsigned int len, unsigned long *addr));
+extern int load_at P((unsigned long offset, unsigned char *data, unsigned int len));
+extern int load_wait_eof;
 
 /* misc.c */
 extern void twiddle P((void));
@@ -8,17 +8,27 @@
 #ifdef IDE_DISK
 int ide_probe(int drive);
 int ide_read(int drive, sector_t sector, void *buffer);
+int ide_read_multi(int drive, sector_t sector, int count, void *buffer);
 #endif
 
 #ifdef USB_DISK
 int usb_probe(int drive);
 int usb_read(int drive, sector_t sector, void *buffer);
+int usb_read_multi(int drive, sector_t sector, int count, void *buffer);
+#endif
+
+#ifdef AHCI_DISK
+int ahci_probe(int drive);
+int ahci_read(int drive, sector_t sector, int count, void *buffer);
 #endif
 
 #define DISK_IDE 1
 #define DISK_MEM 2
 #define DISK_USB 3
+#define DISK_AHCI 4
 
+void devcache_init(void);
+void devcache_stats(void);
 int devopen(const char *name, int *reopen);
 int devread(unsigned long sector, unsigned long byte_offset,
 	unsigned long byte_len, void *buf);
@@ -19,7 +19,16 @@
 #define	NFS_READLINK	5
 #define NFS_READ	6
 
+/* NFSv3 renumbered some procedures; READLINK and READ are unchanged */
+#define NFS3_LOOKUP	3
+#define NFS3_FSINFO	19
+
 #define NFS_FHSIZE	32
+#define NFS3_FHSIZE	64
+
+/* Size in 32 bit words of the file attributes in replies */
+#define NFS_FATTR_WORDS		17
+#define NFS3_FATTR_WORDS	21
 
 #define NFSERR_PERM	1
 #define NFSERR_NOENT	2
@@ -32,13 +41,31 @@
  * Chosen to be a power of two, as most NFS servers are optimized for this.  */
 #define NFS_READ_SIZE	1024
 
+/* Upper limit for NFSv3 reads, which the server may lower through FSINFO.
+ * As IP fragments are not reassembled, this is what still fits a frame
+ * after the larger NFSv3 reply header, rounded down to a multiple of 256. */
+#define NFS3_READ_SIZE	1280
+
+/* Number of READ requests which may be outstanding at the same time while
+ * loading a file.  The reader starts with a small window, opens it by one
+ * request per window's worth of replies and halves it on every timeout.
+ * A value of 1 gives the old lock-step behaviour.  */
+#ifndef NFS_READ_WINDOW
+#define NFS_READ_WINDOW	8
+#endif
+
 #define NFS_MAXLINKDEPTH 16
 
+struct nfs_fh {
+	int len;
+	char data[NFS3_FHSIZE];
+};
+
 struct rpc_t {
 	struct iphdr ip;
 	struct udphdr udp;
 	union {
-		uint8_t  data[300];		/* longest RPC call must fit!!!! */
+		uint8_t  data[400];		/* longest RPC call must fit!!!! */
 		struct {
 			uint32_t id;
 			uint32_t type;
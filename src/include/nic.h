@@ -35,13 +35,30 @@ struct nic
 	unsigned int	ioaddr;
 	unsigned char	irqno;
 	void		*priv_data;	/* driver can hang private data here */
+	/* Drivers with a receive ring may point packet straight at the
+	 * buffer of the received descriptor instead of copying the frame.
+	 * They set rx_release, which eth_poll() calls to hand the buffer
+	 * back to the ring before it polls for the next frame. */
+	void		(*rx_release)P((struct nic *));
+	/* Drivers with a transmit ring may let frames complete in the
+	 * background.  tx_queue copies a frame onto the ring, returning 0
+	 * if the ring is full, tx_kick starts the card on everything
+	 * queued so far and tx_reap reclaims finished descriptors,
+	 * returning how many frames are still in flight. */
+	int		(*tx_queue)P((struct nic *, const char *d,
+				unsigned int t, unsigned int s, const char *p));
+	void		(*tx_kick)P((struct nic *));
+	int		(*tx_reap)P((struct nic *));
 };
 
 
 extern struct nic nic;
 extern int  eth_probe(struct dev *dev);
 extern int  eth_poll(int retrieve);
+extern void eth_rx_release(void);
 extern void eth_transmit(const char *d, unsigned int t, unsigned int s, const void *p);
+extern void eth_transmit_queue(const char *d, unsigned int t, unsigned int s, const void *p);
+extern void eth_transmit_flush(void);
 extern void eth_disable(void);
 extern void eth_irq(irq_action_t action);
 extern int eth_load_configuration(struct dev *dev);
@@ -19,10 +19,10 @@
 
 /* *** FROM ctype.h *** */
 
-#define isdigit(c)	((c & 0x04) != 0)
-#define islower(c)	((c & 0x02) != 0)
+#define isdigit(c)	((c) >= '0' && (c) <= '9')
+#define islower(c)	((c) >= 'a' && (c) <= 'z')
 //#define isspace(c)	((c & 0x20) != 0)
-#define isupper(c)	((c & 0x01) != 0)
+#define isupper(c)	((c) >= 'A' && (c) <= 'Z')
 
 static inline unsigned char tolower(unsigned char c)
 {
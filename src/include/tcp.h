@@ -3,11 +3,32 @@
 
 #define TCP_INITIAL_TIMEOUT     (3*TICKS_PER_SEC)
 #define TCP_MAX_TIMEOUT         (60*TICKS_PER_SEC)
-#define TCP_MIN_TIMEOUT         (TICKS_PER_SEC)
+#define TCP_MIN_TIMEOUT         USECS_TO_TICKS(200000)
 #define TCP_MAX_RETRY           10
 #define TCP_MAX_HEADER          ((int)sizeof(struct iphdr)+64)
 #define TCP_MIN_WINDOW          (1500-TCP_MAX_HEADER)
 #define TCP_MAX_WINDOW          (65535-TCP_MAX_HEADER)
+#define TCP_MSS                 (ETH_MAX_MTU-(int)sizeof(struct iphdr)-20)
+
+/* Receive window, scaled by 2^TCP_WSCALE when the peer agrees (RFC1323) */
+#ifndef TCP_RCV_WINDOW
+#define TCP_RCV_WINDOW          (128*1024)
+#endif
+#ifndef TCP_WSCALE
+#define TCP_WSCALE              2
+#endif
+#if (TCP_RCV_WINDOW >> TCP_WSCALE) > 65535
+#error TCP_RCV_WINDOW too large for TCP_WSCALE
+#endif
+
+/* Segments held for reassembly when they arrive beyond a hole */
+#ifndef TCP_OOO_SEGMENTS
+#define TCP_OOO_SEGMENTS        8
+#endif
+
+/* ACK every second segment, but never wait longer than this */
+#define TCP_DELACK_SEGMENTS     2
+#define TCP_DELACK_TIMEOUT      USECS_TO_TICKS(40000)
 
 
 #define MAX_URL                 80
@@ -20,6 +41,13 @@
 #define ACK             16
 #define URG             32
 
+#define TCPOPT_EOL      0
+#define TCPOPT_NOP      1
+#define TCPOPT_MAXSEG   2
+#define TCPOLEN_MAXSEG  4
+#define TCPOPT_WINDOW   3
+#define TCPOLEN_WINDOW  3
+
 
 struct tcphdr {
        uint16_t src;
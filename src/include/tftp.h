@@ -5,6 +5,12 @@
 #define	TFTP_DEFAULTSIZE_PACKET	512
 #define	TFTP_MAX_PACKET		1432 /* 512 */
 
+/* Number of DATA blocks the server may send per ACK (RFC7440).
+   A value of 1 disables the windowsize option. */
+#ifndef	TFTP_WINDOWSIZE
+#define	TFTP_WINDOWSIZE		4
+#endif
+
 #define TFTP_RRQ	1
 #define TFTP_WRQ	2
 #define TFTP_DATA	3
@@ -63,6 +69,7 @@ struct tftpreq_info_t {
 	const char *name;
 	unsigned short port;
 	unsigned short blksize;
+	unsigned short windowsize;
 } PACKED;
 
 struct tftpblk_info_t {